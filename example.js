@@ -61,13 +61,51 @@ function attachListeners() {
   $('randomize').addEventListener('click', randomize, false);
   $('zero').addEventListener('click', function() { clear(0); }, false);
   $('splat').addEventListener('click', splat, false);
+  $('saveCheckpoint').addEventListener('click', saveCheckpoint, false);
+  $('loadCheckpoint').addEventListener('change', onLoadCheckpoint, false);
   $('listener').addEventListener('message', handleMessage, true);
 
   // $('setPaletteNumColorstops').addEventListener('change', onNumColorstopsChanged, false);
 }
 
+var activityNames = ['active', 'dead', 'static', 'periodic'];
+
 function handleMessage(e) {
-  document.getElementById('fps').textContent = 'FPS: ' + e.data.toFixed(2);
+  var msg = e.data;
+  if (msg.msg === 'fps') {
+    document.getElementById('fps').textContent =
+        'FPS: ' + msg.fps.toFixed(2) +
+        ' steps/s: ' + msg.stepsPerSecond.toFixed(1) +
+        ' dt: ' + msg.dt.toFixed(4) +
+        ' rejected steps: ' + msg.rejectedSteps +
+        ' image: ' + msg.imageUs.toFixed(0) + 'us/frame (' +
+        msg.imageAllocations + ' allocs)' +
+        ' ' + activityNames[msg.activity] +
+        (msg.activity === 3 ? ' (period ' + msg.period + ')' : '');
+  } else if (msg.msg === 'governor') {
+    document.getElementById('governor').textContent =
+        'governor: ' + msg.reason +
+        ' (steps/frame: ' + msg.stepsPerFrame +
+        ' filter: ' + msg.filter +
+        ' render scale: ' + msg.renderScale +
+        ' grid scale: ' + msg.gridScale +
+        ' frame: ' + msg.frameMs.toFixed(1) + 'ms' +
+        ' step: ' + msg.stepMs.toFixed(1) + 'ms' +
+        ' render: ' + msg.renderMs.toFixed(1) + 'ms)';
+  } else if (msg.msg === 'checkpoint') {
+    download(msg.data, 'smoothlife.checkpoint');
+  } else if (msg.msg === 'recording') {
+    download(msg.data, 'smoothlife.recording');
+  } else if (msg.msg === 'replayLog') {
+    download(msg.data, 'smoothlife.replay');
+  } else if (msg.msg === 'stats') {
+    document.getElementById('stats').textContent =
+        'mass: ' + msg.mass.toFixed(2) +
+        ' mean |change|: ' + msg.meanChange.toFixed(6) +
+        ' min: ' + msg.min.toFixed(4) +
+        ' max: ' + msg.max.toFixed(4) +
+        ' histogram: [' + msg.histogram.join(', ') + ']';
+  }
 }
 
 // From MDN:
@@ -203,11 +241,27 @@ var functions = [
       {name: 'color', type: 'range', min: 0, max: 1, step: 0.1}]},
   {name: 'setSize', params: [
       {name: 'size', type: 'select', values: [
+          {name: '128x128', value: 128},
           {name: '256x256', value: 256},
           {name: '384x384', value: 384},
-          {name: '512x512', value: 512}]}]},
+          {name: '512x512', value: 512},
+          {name: '768x768', value: 768},
+          {name: '1024x1024', value: 1024}]},
+      {name: 'fitAspect', type: 'select', values: [
+          {name: 'Square', value: 0},
+          {name: 'Fit view aspect', value: 1}]},
+      {name: 'resample', type: 'select', values: [
+          {name: 'Keep pattern', value: 1},
+          {name: 'Reset', value: 0}]},
+      {name: 'scaleKernel', type: 'select', values: [
+          {name: 'Fixed kernel', value: 0},
+          {name: 'Scale kernel', value: 1}]}]},
   {name: 'setMaxScale', params: [
       {name: 'scale', type: 'range', min: 0, max: 5, step: 0.1}]},
+  {name: 'setViewport', params: [
+      {name: 'x', type: 'range', min: 0, max: 512, step: 1},
+      {name: 'y', type: 'range', min: 0, max: 512, step: 1},
+      {name: 'zoom', type: 'range', min: 0, max: 8, step: 0.05}]},
   {name: 'setThreadCount', params: [
       {name: 'threadCount', type: 'select', values: [
           {name: '1 Thread', value: 1},
@@ -216,6 +270,52 @@ var functions = [
           {name: '6 Threads', value: 6},
           {name: '8 Threads', value: 8},
           {name: '12 Threads', value: 12}]}]},
+  {name: 'setCompact', params: [
+      {name: 'compact', type: 'select', values: [
+          {name: 'Off', value: 0},
+          {name: 'On (16-bit state)', value: 1}]}]},
+  {name: 'setStepsPerFrame', params: [
+      {name: 'steps', type: 'range', min: 1, max: 256, step: 1},
+      {name: 'stepsPerSecond', type: 'range', min: 0, max: 1000, step: 10}]},
+  {name: 'setGovernor', params: [
+      {name: 'enabled', type: 'select', values: [
+          {name: 'On', value: 1},
+          {name: 'Off', value: 0}]},
+      {name: 'budgetMs', type: 'range', min: 5, max: 100, step: 1},
+      {name: 'maxStepsPerFrame', type: 'range', min: 1, max: 16, step: 1},
+      {name: 'resizeGrid', type: 'select', values: [
+          {name: 'Fixed grid', value: 0},
+          {name: 'Shrink grid', value: 1}]}]},
+  {name: 'setRecording', params: [
+      {name: 'enabled', type: 'select', values: [
+          {name: 'Off (download)', value: 0},
+          {name: 'On', value: 1}]},
+      {name: 'precision', type: 'range', min: 8, max: 16, step: 1},
+      {name: 'keyframeInterval', type: 'range', min: 1, max: 300, step: 1}]},
+  {name: 'setReplayLog', params: [
+      {name: 'enabled', type: 'select', values: [
+          {name: 'Off (download)', value: 0},
+          {name: 'On', value: 1}]}]},
+  {name: 'setFilter', params: [
+      {name: 'filter', type: 'select', values: [
+          {name: 'Nearest', value: 0},
+          {name: 'Bilinear', value: 1},
+          {name: 'Bicubic', value: 2}]}]},
+  {name: 'setNoise', params: [
+      {name: 'amount', type: 'range', min: 0, max: 0.2, step: 0.005}]},
+  {name: 'setFusedDisplay', params: [
+      {name: 'enabled', type: 'select', values: [
+          {name: 'Off', value: 0},
+          {name: 'On', value: 1}]}]},
+  {name: 'setIdleDetection', params: [
+      {name: 'enabled', type: 'select', values: [
+          {name: 'On', value: 1},
+          {name: 'Off', value: 0}]}]},
+  {name: 'setImagePool', params: [
+      {name: 'enabled', type: 'select', values: [
+          {name: 'On', value: 1},
+          {name: 'Off', value: 0}]}]},
+  {name: 'getStats', params: []},
   {name: 'setBrush', params: [
       {name: 'radius', type: 'range', min: 0, max: 50, step: 0.1},
       {name: 'color', type: 'range', min: 0, max: 1, step: 0.1}]},
@@ -234,7 +334,11 @@ var functions = [
       {name: 'sigmoid', type: 'range', min: 0, max: 3, step: 1},
       {name: 'mix', type: 'range', min: 0, max: 3, step: 1},
       {name: 'sn', type: 'range', min: 0, max: 1, step: 0.1},
-      {name: 'sm', type: 'range', min: 0, max: 1, step: 0.1}]},
+      {name: 'sm', type: 'range', min: 0, max: 1, step: 0.1},
+      {name: 'integrator', type: 'range', min: 0, max: 3, step: 1},
+      {name: 'dtMin', type: 'range', min: 0.001, max: 1, step: 0.001},
+      {name: 'dtMax', type: 'range', min: 0.1, max: 4, step: 0.1},
+      {name: 'tolerance', type: 'range', min: 0.001, max: 0.1, step: 0.001}]},
 ];
 
 var values = {};
@@ -379,6 +483,31 @@ function splat() {
   postMessage({cmd: 'splat'});
 }
 
+function download(data, filename) {
+  var link = document.createElement('a');
+  link.href = URL.createObjectURL(new Blob([data]));
+  link.download = filename;
+  link.click();
+  URL.revokeObjectURL(link.href);
+}
+
+function saveCheckpoint() {
+  postMessage({cmd: 'saveCheckpoint'});
+}
+
+function onLoadCheckpoint(e) {
+  var file = this.files[0];
+  if (!file)
+    return;
+
+  var reader = new FileReader();
+  reader.onload = function() {
+    postMessage({cmd: 'loadCheckpoint', data: reader.result});
+  };
+  reader.readAsArrayBuffer(file);
+  this.value = '';
+}
+
 function getValueArg(arg, id) {
   if (arg !== undefined)
     return arg;
@@ -423,6 +552,14 @@ function setPalette() {
     stops: stops});
 }
 
+// Replaces the disc and ring kernel with a set of Lenia-style kernels; see
+// src/kernel_set_config.h. Each kernel is {mu, sigma, weight, shells}, and
+// each shell is {type: 0 for a ring or 1 for a Gaussian, radius, width,
+// weight}. With no kernels, the disc and ring are used again.
+function setKernelSet(kernels) {
+  postMessage({cmd: 'setKernelSet', kernels: kernels || []});
+}
+
 function postMessage(msg) {
   //console.log(msg);
   common.naclModule.postMessage(msg);
@@ -0,0 +1,86 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "activity.h"
+
+namespace {
+
+// Mean value (for dead) or mean change (for static) below which a cell is
+// considered to be doing nothing.
+const double kDeadThreshold = 1e-6;
+const double kStaticThreshold = 1e-6;
+// A state must stay dead or static for this many steps before it is reported,
+// so a single quiet step doesn't stop the simulation.
+const int kSettleSteps = 8;
+
+}  // namespace
+
+ActivityDetector::ActivityDetector() {
+  Reset();
+}
+
+void ActivityDetector::Reset() {
+  activity_ = ACTIVITY_ACTIVE;
+  period_ = 0;
+  dead_steps_ = 0;
+  static_steps_ = 0;
+  hash_count_ = 0;
+  next_hash_ = 0;
+  for (int i = 0; i < kMaxPeriod; ++i) {
+    hashes_[i] = 0;
+    matches_[i] = 0;
+  }
+}
+
+Activity ActivityDetector::Update(const StepStats& stats) {
+  if (stats.count == 0)
+    return activity_;
+
+  bool dead = stats.mass / stats.count < kDeadThreshold;
+  bool quiet = stats.change / stats.count < kStaticThreshold;
+  dead_steps_ = dead ? dead_steps_ + 1 : 0;
+  static_steps_ = quiet ? static_steps_ + 1 : 0;
+
+  // Compare against the hash k steps ago, for every k. A period is only
+  // reported once it has repeated for a whole period, which makes an
+  // accidental hash collision very unlikely to be reported.
+  period_ = 0;
+  for (int k = 1; k <= hash_count_; ++k) {
+    int index = (next_hash_ - k + kMaxPeriod) % kMaxPeriod;
+    if (hashes_[index] == stats.hash) {
+      matches_[k - 1]++;
+      if (period_ == 0 && matches_[k - 1] >= k)
+        period_ = k;
+    } else {
+      matches_[k - 1] = 0;
+    }
+  }
+  hashes_[next_hash_] = stats.hash;
+  next_hash_ = (next_hash_ + 1) % kMaxPeriod;
+  if (hash_count_ < kMaxPeriod)
+    hash_count_++;
+
+  // Equal quantized hashes alone don't make a state static: one that drifts
+  // by less than the quantization each step hashes the same.
+  if (dead_steps_ >= kSettleSteps)
+    activity_ = ACTIVITY_DEAD;
+  else if (static_steps_ >= kSettleSteps ||
+           (matches_[0] >= kSettleSteps && quiet))
+    activity_ = ACTIVITY_STATIC;
+  else if (period_ > 1)
+    activity_ = ACTIVITY_PERIODIC;
+  else
+    activity_ = ACTIVITY_ACTIVE;
+  return activity_;
+}
@@ -0,0 +1,60 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ACTIVITY_H_
+#define ACTIVITY_H_
+
+#include <stdint.h>
+
+#include "step_stats.h"
+
+enum Activity {
+  ACTIVITY_ACTIVE,
+  // Nothing is alive.
+  ACTIVITY_DEAD,
+  // The state no longer changes.
+  ACTIVITY_STATIC,
+  // The state repeats every period() steps.
+  ACTIVITY_PERIODIC
+};
+
+// Classifies the simulation from the StepStats of each step.
+class ActivityDetector {
+ public:
+  static const int kMaxPeriod = 64;
+
+  ActivityDetector();
+
+  Activity activity() const { return activity_; }
+  int period() const { return period_; }
+
+  void Reset();
+  Activity Update(const StepStats& stats);
+
+ private:
+  Activity activity_;
+  int period_;
+  // Consecutive steps that were dead or static, respectively.
+  int dead_steps_;
+  int static_steps_;
+  // Ring buffer of the hashes of the last kMaxPeriod steps.
+  uint32_t hashes_[kMaxPeriod];
+  int hash_count_;
+  int next_hash_;
+  // matches_[k - 1] is the number of consecutive steps whose hash equaled the
+  // hash k steps before.
+  int matches_[kMaxPeriod];
+};
+
+#endif  // ACTIVITY_H_
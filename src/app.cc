@@ -12,18 +12,24 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <sys/time.h>
 #include <time.h>
 
 #include <algorithm>
+#include <map>
 #include <string>
+#include <vector>
 
 #include <ppapi/c/pp_rect.h>
+#include <ppapi/c/pp_time.h>
 #include <ppapi/c/ppb_image_data.h>
 #include <ppapi/c/ppb_input_event.h>
+#include <ppapi/cpp/core.h>
 #include <ppapi/cpp/graphics_2d.h>
 #include <ppapi/cpp/image_data.h>
 #include <ppapi/cpp/input_event.h>
@@ -33,12 +39,21 @@
 #include <ppapi/cpp/size.h>
 #include <ppapi/cpp/var.h>
 #include <ppapi/cpp/var_array.h>
+#include <ppapi/cpp/var_array_buffer.h>
 #include <ppapi/cpp/var_dictionary.h>
 #include <ppapi/utility/completion_callback_factory.h>
 
+#include "checkpoint.h"
+#include "fft_size.h"
+#include "frame_governor.h"
+#include "kernel_set_config.h"
+#include "mip_pyramid.h"
 #include "palette.h"
+#include "recorder.h"
+#include "renderer.h"
 #include "simulation.h"
 #include "simulation_config.h"
+#include "world.h"
 
 #ifdef WIN32
 #undef PostMessage
@@ -55,7 +70,25 @@ const int kMaxThreadCount = 32;
 //const pp::Size kSimSize(256, 256);
 //const pp::Size kSimSize(384, 384);
 const pp::Size kSimSize(512, 512);
+const int kMinSimSize = 16;
+const int kMaxSimSize = 4096;
 const int kFpsUpdateMs = 1000;
+// How often to check for changes while the simulation is idle.
+const int kIdlePollMs = 100;
+// Identifies the mouse among touch ids in brush input.
+const uint32_t kMousePointer = 0xffffffff;
+// The governor may raise the steps per frame up to this, unless the
+// setGovernor message allows more.
+const int kDefaultMaxStepsPerFrame = 1;
+// Most steps per frame allowed with setStepsPerFrame. In steps-per-second
+// mode, a frame never takes more steps than this, so a slow frame can't make
+// the next one slower.
+const int kMaxStepsPerFrame = 256;
+// An image passed to ReplaceContents belongs to the context until another
+// image replaces it and that flush completes, so two images are enough.
+const size_t kImagePoolSize = 2;
+const int kDefaultRecordingPrecision = 16;
+const int kDefaultKeyframeInterval = 60;
 
 int TimevalToMs(struct timeval* t) {
     return (t->tv_sec * 1000 + t->tv_usec / 1000);
@@ -65,6 +98,65 @@ int TimeDeltaMs(struct timeval* start, struct timeval* end) {
   return TimevalToMs(end) - TimevalToMs(start);
 }
 
+int TimeDeltaUs(struct timeval* start, struct timeval* end) {
+  return (end->tv_sec - start->tv_sec) * 1000000 +
+         (end->tv_usec - start->tv_usec);
+}
+
+ColorFormat NativeColorFormat() {
+  if (pp::ImageData::GetNativeImageDataFormat() ==
+      PP_IMAGEDATAFORMAT_RGBA_PREMUL)
+    return COLOR_FORMAT_RGBA;
+  return COLOR_FORMAT_BGRA;
+}
+
+// Returns the int at |key|, or |default_value| for optional keys.
+int GetInt(const pp::VarDictionary& dictionary, const char* key,
+           int default_value) {
+  if (!dictionary.HasKey(key))
+    return default_value;
+  return dictionary.Get(key).AsInt();
+}
+
+double GetDouble(const pp::VarDictionary& dictionary, const char* key,
+                 double default_value) {
+  if (!dictionary.HasKey(key))
+    return default_value;
+  return dictionary.Get(key).AsDouble();
+}
+
+// Reads a kernel set from an array of {mu, sigma, weight, shells}, where
+// each shell is {type, radius, width, weight}; see kernel_set_config.h.
+// Kernels and shells beyond the limits there are dropped.
+KernelSetConfig GetKernelSet(const pp::VarArray& kernels) {
+  KernelSetConfig config;
+  uint32_t count = std::min(kernels.GetLength(),
+                            static_cast<uint32_t>(kMaxKernelSetSize));
+  for (uint32_t i = 0; i < count; ++i) {
+    pp::VarDictionary kernel(kernels.Get(i));
+    KernelProfile profile;
+    profile.growth.mu = GetDouble(kernel, "mu", profile.growth.mu);
+    profile.growth.sigma = GetDouble(kernel, "sigma", profile.growth.sigma);
+    profile.growth.weight = GetDouble(kernel, "weight", 1);
+    pp::VarArray shells(kernel.Get("shells"));
+    uint32_t shell_count = std::min(
+        shells.GetLength(), static_cast<uint32_t>(kMaxKernelShells));
+    for (uint32_t j = 0; j < shell_count; ++j) {
+      pp::VarDictionary shell_dictionary(shells.Get(j));
+      KernelShell shell;
+      shell.type = GetInt(shell_dictionary, "type", 0) == 1
+                       ? KERNEL_SHELL_GAUSSIAN
+                       : KERNEL_SHELL_RING;
+      shell.radius = GetDouble(shell_dictionary, "radius", 0);
+      shell.width = GetDouble(shell_dictionary, "width", 1);
+      shell.weight = GetDouble(shell_dictionary, "weight", 1);
+      profile.shells.push_back(shell);
+    }
+    config.profiles.push_back(profile);
+  }
+  return config;
+}
+
 }  // namespace
 
 class Instance : public pp::Instance {
@@ -74,31 +166,63 @@ class Instance : public pp::Instance {
         callback_factory_(this),
         simulation_config_(kDefaultThreadCount, kSimSize),
         simulation_(simulation_config_),
-        palette_(palette_config_),
+        world_(&simulation_),
+        sim_size_(kSimSize),
+        fast_size_(true),
+        palette_(palette_config_, NativeColorFormat()),
+        renderer_(simulation_.thread_pool()),
         max_scale_(kDefaultMaxScale),
         scale_numer_(1),
         scale_denom_(1),
+        viewport_(false),
+        view_x_(0),
+        view_y_(0),
+        view_zoom_(1),
         brush_radius_(10),
         brush_color_(1),
-        frames_drawn_(0) {}
+        needs_render_(true),
+        pool_images_(true),
+        next_image_(0),
+        image_us_(0),
+        image_allocations_(0),
+        filter_(RENDER_FILTER_NEAREST),
+        render_scale_(1),
+        steps_per_frame_(1),
+        governor_enabled_(true),
+        max_steps_per_frame_(kDefaultMaxStepsPerFrame),
+        fixed_steps_(false),
+        frame_timing_valid_(false),
+        steps_per_second_(0),
+        step_fraction_(0),
+        last_update_time_(0),
+        steps_taken_(0),
+        frames_drawn_(0),
+        recording_sink_(NULL),
+        recorder_(NULL) {}
+
+  virtual ~Instance() {
+    delete recorder_;
+    delete recording_sink_;
+  }
 
   virtual bool Init(uint32_t argc, const char* argn[], const char* argv[]) {
     RequestInputEvents(PP_INPUTEVENT_CLASS_MOUSE | PP_INPUTEVENT_CLASS_TOUCH);
+    world_.SetActivityDetection(true);
+    simulation_.SetStatsEnabled(true);
+    governor_.SetLimits(GovernorStepLimit(), filter_);
     gettimeofday(&last_frame_time_, NULL);
     return true;
   }
 
   virtual void DidChangeView(const pp::View& view) {
     pp::Size new_size = view.GetRect().size();
-    if (new_size == context_size_)
+    if (new_size == view_size_)
       return;
 
-    context_size_ = new_size;
-    if (!CreateContext())
+    view_size_ = new_size;
+    if (!ResizeContext())
       return;
 
-    UpdateScreenScale();
-
     // When flush_context_ is null, it means there is no Flush callback in
     // flight. This may have happened if the context was not created
     // successfully, or if this is the first call to DidChangeView (when the
@@ -115,26 +239,65 @@ class Instance : public pp::Instance {
 
       if (mouse_event.GetButton() == PP_INPUTEVENT_MOUSEBUTTON_LEFT) {
         mouse_event_ = mouse_event;
-        if (event.GetType() == PP_INPUTEVENT_TYPE_MOUSEUP)
+        if (event.GetType() == PP_INPUTEVENT_TYPE_MOUSEUP) {
           mouse_event_ = pp::MouseInputEvent();
+          AddBrushPoint(event.GetTimeStamp(), kMousePointer,
+                        pp::FloatPoint(), false);
+        } else {
+          // A press always starts a new stroke, even if the release before
+          // it was never seen (e.g. it happened outside the view).
+          if (event.GetType() == PP_INPUTEVENT_TYPE_MOUSEDOWN) {
+            AddBrushPoint(event.GetTimeStamp(), kMousePointer,
+                          pp::FloatPoint(), false);
+          }
+          pp::Point position = mouse_event.GetPosition();
+          AddBrushPoint(event.GetTimeStamp(), kMousePointer,
+                        pp::FloatPoint(position.x(), position.y()), true);
+        }
       }
       return true;
     } else if (event.GetType() == PP_INPUTEVENT_TYPE_TOUCHSTART ||
                event.GetType() == PP_INPUTEVENT_TYPE_TOUCHMOVE ||
-               event.GetType() == PP_INPUTEVENT_TYPE_TOUCHEND) {
+               event.GetType() == PP_INPUTEVENT_TYPE_TOUCHEND ||
+               event.GetType() == PP_INPUTEVENT_TYPE_TOUCHCANCEL) {
       touch_event_ = pp::TouchInputEvent(event);
+      bool start = event.GetType() == PP_INPUTEVENT_TYPE_TOUCHSTART;
+      bool down = event.GetType() != PP_INPUTEVENT_TYPE_TOUCHEND &&
+                  event.GetType() != PP_INPUTEVENT_TYPE_TOUCHCANCEL;
+      uint32_t touch_count =
+          touch_event_.GetTouchCount(PP_TOUCHLIST_TYPE_CHANGEDTOUCHES);
+      for (uint32_t i = 0; i < touch_count; ++i) {
+        pp::TouchPoint touch_point = touch_event_.GetTouchByIndex(
+            PP_TOUCHLIST_TYPE_CHANGEDTOUCHES, i);
+        // Touch ids may be reused, so a new touch never joins on to an old
+        // one.
+        if (start) {
+          AddBrushPoint(event.GetTimeStamp(), touch_point.id(),
+                        pp::FloatPoint(), false);
+        }
+        AddBrushPoint(event.GetTimeStamp(), touch_point.id(),
+                      touch_point.position(), down);
+      }
       return true;
     }
     return false;
   }
 
-  pp::Point ScreenToSim(const pp::Point& p) const {
-    return ScreenToSim(pp::FloatPoint(p.x(), p.y()));
-  }
+  // The result is not wrapped to the simulation size, so that a stroke
+  // across the edge of the world stays short; drawing wraps it instead.
+  pp::FloatPoint ScreenToSim(const pp::FloatPoint& view_point) const {
+    // Input events are in view coordinates, which differ from the context's
+    // when rendering at a lower resolution.
+    pp::FloatPoint p(view_point.x() * render_scale_,
+                     view_point.y() * render_scale_);
+    if (viewport_) {
+      return pp::FloatPoint(
+          floor(view_x_ + (p.x() - context_size_.width() / 2) / view_zoom_),
+          floor(view_y_ + (p.y() - context_size_.height() / 2) / view_zoom_));
+    }
 
-  pp::Point ScreenToSim(const pp::FloatPoint& p) const {
-    return pp::Point(p.x() * scale_numer_ / scale_denom_,
-                     p.y() * scale_numer_ / scale_denom_);
+    return pp::FloatPoint(p.x() * scale_numer_ / scale_denom_,
+                          p.y() * scale_numer_ / scale_denom_);
   }
 
   virtual void HandleMessage(const pp::Var& var) {
@@ -145,19 +308,62 @@ class Instance : public pp::Instance {
 
     pp::VarDictionary dictionary(var);
     std::string cmd = dictionary.Get("cmd").AsString();
+    needs_render_ = true;
+    mip_pyramid_.Invalidate();
 
     if (cmd == "clear") {
       real color = dictionary.Get("color").AsDouble();
       printf("clear{color: %f}\n", color);
-      simulation_.Clear(color);
+      world_.Clear(color);
     } else if (cmd == "setSize") {
+      // "size" sets both dimensions; "width" and "height" override it.
       int size = dictionary.Get("size").AsInt();
-      printf("setSize{size: %d}\n", size);
-      if (size != 256 && size != 384 && size != 512) {
-        printf("  invalid size (%d), ignoring.\n", size);
+      int width = GetInt(dictionary, "width", size);
+      int height = GetInt(dictionary, "height", size);
+      // Fitting the aspect ratio gives the longer side of the view |size|
+      // cells, so the simulation fills the view without wrapping.
+      bool fit_aspect = GetInt(dictionary, "fitAspect", 0) != 0;
+      // Sizes with large prime factors are much slower to transform.
+      bool fast_size = GetInt(dictionary, "fastSize", 1) != 0;
+      // Resampling keeps the current pattern; otherwise the state must be
+      // cleared or splatted afterward.
+      bool resample = GetInt(dictionary, "resample", 1) != 0;
+      bool scale_kernel = GetInt(dictionary, "scaleKernel", 0) != 0;
+      printf("setSize{width: %d, height: %d, fitAspect: %d, fastSize: %d, "
+             "resample: %d, scaleKernel: %d}\n", width, height, fit_aspect,
+             fast_size, resample, scale_kernel);
+      if (fit_aspect && !view_size_.IsEmpty()) {
+        int view_width = view_size_.width();
+        int view_height = view_size_.height();
+        if (view_width >= view_height) {
+          width = size;
+          height = static_cast<int>(static_cast<int64_t>(size) * view_height /
+                                    view_width);
+        } else {
+          width = static_cast<int>(static_cast<int64_t>(size) * view_width /
+                                   view_height);
+          height = size;
+        }
+      }
+      if (width < kMinSimSize || width > kMaxSimSize ||
+          height < kMinSimSize || height > kMaxSimSize) {
+        printf("  invalid size (%dx%d), ignoring.\n", width, height);
         return;
       }
-      simulation_.SetSize(pp::Size(size, size));
+      if (fast_size) {
+        // Rounding may step just outside the range, if its ends aren't fast.
+        width = std::max(kMinSimSize,
+                         std::min(kMaxSimSize, NearestFastFftSize(width)));
+        height = std::max(kMinSimSize,
+                          std::min(kMaxSimSize, NearestFastFftSize(height)));
+      }
+      fast_size_ = fast_size;
+      sim_size_ = pp::Size(width, height);
+      pp::Size grid_size = GridSize();
+      if (resample)
+        world_.Resize(grid_size, scale_kernel);
+      else
+        world_.SetSize(grid_size);
       UpdateScreenScale();
     } else if (cmd == "setMaxScale") {
       real scale = dictionary.Get("scale").AsDouble();
@@ -168,6 +374,17 @@ class Instance : public pp::Instance {
       }
       max_scale_ = scale;
       UpdateScreenScale();
+    } else if (cmd == "setViewport") {
+      double x = dictionary.Get("x").AsDouble();
+      double y = dictionary.Get("y").AsDouble();
+      double zoom = dictionary.Get("zoom").AsDouble();
+      printf("setViewport{x: %f, y: %f, zoom: %f}\n", x, y, zoom);
+      // A zoom of 0 fits the whole simulation to the screen, as before.
+      viewport_ = zoom > 0;
+      view_x_ = x;
+      view_y_ = y;
+      view_zoom_ = zoom;
+      UpdateScreenScale();
     } else if (cmd == "setThreadCount") {
 #ifdef USE_THREADS
       int thread_count = dictionary.Get("threadCount").AsInt();
@@ -180,6 +397,65 @@ class Instance : public pp::Instance {
 #else
       printf("threads disabled, ignoring message.\n");
 #endif
+    } else if (cmd == "setCompact") {
+      bool compact = dictionary.Get("compact").AsInt() != 0;
+      printf("setCompact{compact: %d}\n", compact);
+      world_.SetCompact(compact);
+    } else if (cmd == "setFilter") {
+      int filter = dictionary.Get("filter").AsInt();
+      printf("setFilter{filter: %d}\n", filter);
+      if (filter < RENDER_FILTER_NEAREST || filter > RENDER_FILTER_BICUBIC) {
+        printf("  invalid filter (%d), ignoring.\n", filter);
+        return;
+      }
+      filter_ = static_cast<RenderFilter>(filter);
+      governor_.SetLimits(GovernorStepLimit(), filter_);
+      renderer_.SetFilter(governor_enabled_ ? governor_.filter() : filter_);
+    } else if (cmd == "setStepsPerFrame") {
+      int steps = dictionary.Get("steps").AsInt();
+      double steps_per_second = dictionary.Get("stepsPerSecond").AsDouble();
+      printf("setStepsPerFrame{steps: %d, stepsPerSecond: %f}\n", steps,
+             steps_per_second);
+      if (steps < 1 || steps > kMaxStepsPerFrame || steps_per_second < 0) {
+        printf("  invalid steps (%d), ignoring.\n", steps);
+        return;
+      }
+      // In steps-per-second mode, |steps| is the most to take per frame.
+      // Either way the governor no longer chooses the step count; it only
+      // trades off rendering quality to stay within budget.
+      steps_per_second_ = steps_per_second;
+      step_fraction_ = 0;
+      fixed_steps_ = true;
+      SetGovernor(governor_enabled_, governor_.budget_ms(), steps);
+    } else if (cmd == "setGovernor") {
+      bool enabled = dictionary.Get("enabled").AsInt() != 0;
+      double budget_ms = dictionary.Get("budgetMs").AsDouble();
+      int max_steps = dictionary.Get("maxStepsPerFrame").AsInt();
+      if (dictionary.HasKey("resizeGrid"))
+        governor_.SetGridResize(dictionary.Get("resizeGrid").AsInt() != 0);
+      printf("setGovernor{enabled: %d, budgetMs: %f, maxStepsPerFrame: %d}\n",
+             enabled, budget_ms, max_steps);
+      if (budget_ms <= 0 || max_steps < 1) {
+        printf("  invalid budget or steps per frame, ignoring.\n");
+        return;
+      }
+      fixed_steps_ = false;
+      SetGovernor(enabled, budget_ms, max_steps);
+    } else if (cmd == "setFusedDisplay") {
+      bool enabled = dictionary.Get("enabled").AsInt() != 0;
+      printf("setFusedDisplay{enabled: %d}\n", enabled);
+      world_.SetFusedDisplay(enabled);
+    } else if (cmd == "setIdleDetection") {
+      bool enabled = dictionary.Get("enabled").AsInt() != 0;
+      printf("setIdleDetection{enabled: %d}\n", enabled);
+      world_.SetActivityDetection(enabled);
+    } else if (cmd == "setImagePool") {
+      pool_images_ = dictionary.Get("enabled").AsInt() != 0;
+      printf("setImagePool{enabled: %d}\n", pool_images_);
+      image_pool_.clear();
+      next_image_ = 0;
+    } else if (cmd == "getStats") {
+      PostStats();
     } else if (cmd == "setBrush") {
       brush_radius_ = dictionary.Get("radius").AsDouble();
       brush_color_ = dictionary.Get("color").AsDouble();
@@ -191,7 +467,13 @@ class Instance : public pp::Instance {
       config.blend_radius = dictionary.Get("blendRadius").AsDouble();
       printf("setKernel{discRadius: %f, ringRadius: %f, blendRadius: %f}\n",
              config.disc_radius, config.ring_radius, config.blend_radius);
-      simulation_.SetKernel(config);
+      world_.SetKernel(config);
+    } else if (cmd == "setKernelSet") {
+      KernelSetConfig config =
+          GetKernelSet(pp::VarArray(dictionary.Get("kernels")));
+      printf("setKernelSet{kernels: %d}\n",
+             static_cast<int>(config.profiles.size()));
+      world_.SetKernelSet(config);
     } else if (cmd == "setPalette") {
       PaletteConfig config;
       config.repeating = dictionary.Get("repeating").AsBool();
@@ -211,6 +493,7 @@ class Instance : public pp::Instance {
         config.stops.push_back(ColorStop(color, stop));
       }
       printf("]}\n");
+      palette_config_ = config;
       palette_.SetConfig(config);
     } else if (cmd == "setSmoother") {
       SmootherConfig config;
@@ -226,16 +509,80 @@ class Instance : public pp::Instance {
       config.mix = static_cast<Sigmoid>(dictionary.Get("mix").AsInt());
       config.sn = dictionary.Get("sn").AsDouble();
       config.sm = dictionary.Get("sm").AsDouble();
+      if (dictionary.HasKey("integrator")) {
+        config.timestep.integrator =
+            static_cast<Integrator>(dictionary.Get("integrator").AsInt());
+      }
+      if (dictionary.HasKey("dtMin"))
+        config.timestep.dt_min = dictionary.Get("dtMin").AsDouble();
+      if (dictionary.HasKey("dtMax"))
+        config.timestep.dt_max = dictionary.Get("dtMax").AsDouble();
+      if (dictionary.HasKey("tolerance"))
+        config.timestep.tolerance = dictionary.Get("tolerance").AsDouble();
       printf("setSmoother{type: %d, dt: %f, b1: %f, d1: %f, b2: %f, d2: %f"
-             ", mode: %d, sigmoid: %d, mix: %d, sn: %f, sm: %f}\n",
+             ", mode: %d, sigmoid: %d, mix: %d, sn: %f, sm: %f"
+             ", integrator: %d, dtMin: %f, dtMax: %f, tolerance: %f}\n",
              config.timestep.type, config.timestep.dt,
              config.b1, config.d1, config.b2, config.d2,
              config.mode, config.sigmoid, config.mix,
-             config.sn, config.sm);
-      simulation_.SetSmoother(config);
+             config.sn, config.sm, config.timestep.integrator,
+             config.timestep.dt_min, config.timestep.dt_max,
+             config.timestep.tolerance);
+      if (!config.timestep.adaptive_limits_valid()) {
+        printf("  invalid dtMin, dtMax or tolerance, ignoring.\n");
+        return;
+      }
+      world_.SetSmoother(config);
+    } else if (cmd == "saveCheckpoint") {
+      printf("saveCheckpoint\n");
+      SaveCheckpoint();
+    } else if (cmd == "loadCheckpoint") {
+      printf("loadCheckpoint\n");
+      pp::Var data = dictionary.Get("data");
+      if (!data.is_array_buffer()) {
+        printf("  data is not an ArrayBuffer, ignoring.\n");
+        return;
+      }
+      LoadCheckpoint(pp::VarArrayBuffer(data));
+    } else if (cmd == "setRecording") {
+      bool enabled = dictionary.Get("enabled").AsInt() != 0;
+      int precision =
+          GetInt(dictionary, "precision", kDefaultRecordingPrecision);
+      int keyframe_interval =
+          GetInt(dictionary, "keyframeInterval", kDefaultKeyframeInterval);
+      printf("setRecording{enabled: %d, precision: %d, keyframeInterval: %d}\n",
+             enabled, precision, keyframe_interval);
+      if (precision < 8 || precision > 16 || keyframe_interval < 1) {
+        printf("  invalid precision or keyframe interval, ignoring.\n");
+        return;
+      }
+      StopRecording();
+      if (enabled)
+        StartRecording(precision, keyframe_interval);
+    } else if (cmd == "setReplayLog") {
+      bool enabled = dictionary.Get("enabled").AsInt() != 0;
+      printf("setReplayLog{enabled: %d}\n", enabled);
+      StopReplayLog();
+      if (enabled)
+        world_.StartReplayLog();
+    } else if (cmd == "setNoise") {
+      real amount = dictionary.Get("amount").AsDouble();
+      printf("setNoise{amount: %f}\n", amount);
+      if (amount < 0 || amount > 1) {
+        printf("  invalid noise amount (%f), ignoring.\n", amount);
+        return;
+      }
+      world_.SetNoise(amount);
     } else if (cmd == "splat") {
-      printf("splat{}\n");
-      simulation_.Splat();
+      // With a seed, the same splat can be made again.
+      if (dictionary.HasKey("seed")) {
+        int seed = dictionary.Get("seed").AsInt();
+        printf("splat{seed: %d}\n", seed);
+        world_.Seed(seed);
+      } else {
+        printf("splat{}\n");
+      }
+      world_.Splat();
     } else {
       printf("Unknown command: %s\n", cmd.c_str());
     }
@@ -245,6 +592,8 @@ class Instance : public pp::Instance {
   bool CreateContext() {
     const bool kIsAlwaysOpaque = true;
     context_ = pp::Graphics2D(this, context_size_, kIsAlwaysOpaque);
+    if (render_scale_ != 1 && !context_.SetScale(1 / render_scale_))
+      fprintf(stderr, "Unable to scale 2d context!\n");
     if (!BindGraphics(context_)) {
       fprintf(stderr, "Unable to bind 2d context!\n");
       context_ = pp::Graphics2D();
@@ -253,6 +602,201 @@ class Instance : public pp::Instance {
     return true;
   }
 
+  // Recreates the context for the current view size and render scale.
+  bool ResizeContext() {
+    if (view_size_.IsEmpty())
+      return false;
+
+    context_size_ = pp::Size(
+        std::max(1, static_cast<int>(view_size_.width() * render_scale_)),
+        std::max(1, static_cast<int>(view_size_.height() * render_scale_)));
+    image_pool_.clear();
+    next_image_ = 0;
+    if (!CreateContext())
+      return false;
+
+    needs_render_ = true;
+    UpdateScreenScale();
+    return true;
+  }
+
+  void SetGovernor(bool enabled, double budget_ms, int max_steps) {
+    governor_enabled_ = enabled;
+    max_steps_per_frame_ = max_steps;
+    governor_.SetBudget(budget_ms);
+    governor_.SetLimits(GovernorStepLimit(), filter_);
+    if (enabled) {
+      ApplyGovernor();
+      return;
+    }
+
+    steps_per_frame_ = max_steps_per_frame_;
+    renderer_.SetFilter(filter_);
+    if (GridSize() != simulation_.size()) {
+      world_.Resize(GridSize(), true);
+      UpdateScreenScale();
+    }
+    if (render_scale_ != 1) {
+      render_scale_ = 1;
+      ResizeContext();
+    }
+  }
+
+  void UpdateGovernor(double frame_ms, double step_ms, int steps,
+                      double render_ms) {
+    if (!governor_.AddFrame(frame_ms, step_ms, steps, render_ms))
+      return;
+
+    printf("governor: %s\n", governor_.reason());
+    ApplyGovernor();
+
+    pp::VarDictionary message;
+    message.Set("msg", "governor");
+    message.Set("reason", governor_.reason());
+    message.Set("stepsPerFrame", governor_.steps_per_frame());
+    message.Set("filter", governor_.filter());
+    message.Set("renderScale", governor_.render_scale());
+    message.Set("gridScale", governor_.grid_scale());
+    message.Set("frameMs", governor_.average_frame_ms());
+    message.Set("stepMs", governor_.average_step_ms());
+    message.Set("renderMs", governor_.average_render_ms());
+    PostMessage(message);
+  }
+
+  void StartRecording(int precision, int keyframe_interval) {
+    recording_sink_ = new MemoryRecordingSink;
+    recorder_ = new Recorder(simulation_.size(), precision, keyframe_interval,
+                             recording_sink_);
+  }
+
+  // Posts the recording made so far, if any.
+  void StopRecording() {
+    if (!recorder_)
+      return;
+
+    recorder_->Finish();
+    printf("Recorded %d frames, %u bytes; waited %.1fms for the encoder.\n",
+           recorder_->frame_count(),
+           static_cast<uint32_t>(recording_sink_->data().size()),
+           recorder_->wait_ms());
+    const std::vector<uint8_t>& data = recording_sink_->data();
+    pp::VarArrayBuffer buffer(data.size());
+    memcpy(buffer.Map(), &data[0], data.size());
+    buffer.Unmap();
+    delete recorder_;
+    delete recording_sink_;
+    recorder_ = NULL;
+    recording_sink_ = NULL;
+
+    pp::VarDictionary message;
+    message.Set("msg", "recording");
+    message.Set("data", buffer);
+    PostMessage(message);
+  }
+
+  // Posts the replay log made so far, if any.
+  void StopReplayLog() {
+    if (!world_.logging())
+      return;
+
+    const std::vector<uint8_t>& data = world_.replay_log();
+    printf("Replay log of %u bytes.\n", static_cast<uint32_t>(data.size()));
+    pp::VarArrayBuffer buffer(data.size());
+    memcpy(buffer.Map(), &data[0], data.size());
+    buffer.Unmap();
+    world_.StopReplayLog();
+
+    pp::VarDictionary message;
+    message.Set("msg", "replayLog");
+    message.Set("data", buffer);
+    PostMessage(message);
+  }
+
+  void RecordFrame() {
+    if (!recorder_)
+      return;
+    // A recording has one size; changing it ends the recording.
+    if (recorder_->size() != simulation_.size()) {
+      StopRecording();
+      return;
+    }
+    recorder_->AddFrame(simulation_.display_buffer().data());
+  }
+
+  // Posts the world as a checkpoint; see checkpoint.h.
+  void SaveCheckpoint() {
+    pp::VarArrayBuffer buffer(simulation_.CheckpointSize());
+    void* data = buffer.Map();
+    simulation_.SaveCheckpoint(data);
+    SetCheckpointPalette(palette_config_,
+                         static_cast<CheckpointHeader*>(data));
+    buffer.Unmap();
+
+    pp::VarDictionary message;
+    message.Set("msg", "checkpoint");
+    message.Set("data", buffer);
+    PostMessage(message);
+  }
+
+  void LoadCheckpoint(pp::VarArrayBuffer buffer) {
+    const void* data = buffer.Map();
+    if (!world_.LoadCheckpoint(data, buffer.ByteLength())) {
+      printf("  invalid checkpoint, ignoring.\n");
+      buffer.Unmap();
+      return;
+    }
+
+    const CheckpointHeader* header = static_cast<const CheckpointHeader*>(data);
+    if (header->palette.stop_count > 0) {
+      palette_config_ = GetCheckpointPalette(*header);
+      palette_.SetConfig(palette_config_);
+    }
+    buffer.Unmap();
+
+    // The checkpoint's size replaces the one chosen with setSize.
+    sim_size_ = simulation_.size();
+    UpdateScreenScale();
+  }
+
+  // The simulation size: the size chosen with setSize, scaled by the
+  // governor.
+  pp::Size GridSize() const {
+    double scale = governor_enabled_ ? governor_.grid_scale() : 1;
+    if (scale == 1)
+      return sim_size_;
+    return pp::Size(ScaleGridDimension(sim_size_.width(), scale),
+                    ScaleGridDimension(sim_size_.height(), scale));
+  }
+
+  int ScaleGridDimension(int size, double scale) const {
+    int result = std::max(kMinSimSize, static_cast<int>(size * scale));
+    return fast_size_ ? NearestFastFftSize(result) : result;
+  }
+
+  // The most steps per frame the governor may choose. With a fixed step
+  // count it stays at one, so when over budget it goes straight to cheaper
+  // rendering instead of "lowering" steps that are never taken.
+  int GovernorStepLimit() const {
+    return fixed_steps_ ? 1 : max_steps_per_frame_;
+  }
+
+  void ApplyGovernor() {
+    steps_per_frame_ =
+        fixed_steps_ ? max_steps_per_frame_ : governor_.steps_per_frame();
+    pp::Size grid_size = GridSize();
+    if (grid_size != simulation_.size()) {
+      // Scale the kernel too, so the pattern keeps evolving the same way.
+      world_.Resize(grid_size, true);
+      UpdateScreenScale();
+    }
+    if (renderer_.filter() != governor_.filter())
+      renderer_.SetFilter(governor_.filter());
+    if (render_scale_ != governor_.render_scale()) {
+      render_scale_ = governor_.render_scale();
+      ResizeContext();
+    }
+  }
+
   void UpdateScreenScale() {
     // Update scale_{numer,denom}_ vars.
     // Keep the aspect ratio, and wrap in the longer dimension.
@@ -277,13 +821,60 @@ class Instance : public pp::Instance {
     }
 
     printf("UpdateScreenScale: scale: %d/%d\n", scale_numer_, scale_denom_);
+    // The last points drawn are in the old mapping; joining on to them would
+    // draw a stroke across the world.
+    last_brush_points_.clear();
+    if (viewport_) {
+      renderer_.SetViewport(simulation_.size(), context_size_, view_x_,
+                            view_y_, view_zoom_);
+    } else {
+      renderer_.SetScale(simulation_.size(), context_size_, scale_numer_,
+                         scale_denom_);
+    }
+  }
+
+  // |down| is false when |pointer| is lifted; its next stroke then starts
+  // afresh instead of joining on to this one.
+  void AddBrushPoint(PP_TimeTicks time, uint32_t pointer,
+                     const pp::FloatPoint& position, bool down) {
+    BrushPoint point;
+    point.time = time;
+    point.pointer = pointer;
+    point.position = position;
+    point.down = down;
+    brush_points_.push_back(point);
   }
 
-  void Update() {
+  // Queues a capsule from where |pointer| was last drawn to |view_point|, so
+  // fast strokes are continuous, or a single dab if it wasn't down.
+  void AddBrushStroke(uint32_t pointer, const pp::FloatPoint& view_point) {
+    pp::FloatPoint sim_point = ScreenToSim(view_point);
+    pp::FloatPoint from = sim_point;
+    std::map<uint32_t, pp::FloatPoint>::iterator last =
+        last_brush_points_.find(pointer);
+    if (last != last_brush_points_.end())
+      from = last->second;
+    brush_capsules_.push_back(Capsule(from.x(), from.y(), sim_point.x(),
+                                      sim_point.y(), brush_radius_,
+                                      brush_color_));
+    last_brush_points_[pointer] = sim_point;
+  }
+
+  // Turns brush_points_[|index|] into a stroke.
+  void AddBrushStroke(size_t index) {
+    const BrushPoint& point = brush_points_[index];
+    if (point.down)
+      AddBrushStroke(point.pointer, point.position);
+    else
+      last_brush_points_.erase(point.pointer);
+  }
+
+  // Queues dabs where the mouse button or touches are held down.
+  void AddHeldBrush() {
     if (!mouse_event_.is_null()) {
-      pp::Point sim_point = ScreenToSim(mouse_event_.GetPosition());
-      simulation_.DrawFilledCircle(sim_point.x(), sim_point.y(),
-                                   brush_radius_, brush_color_);
+      pp::Point position = mouse_event_.GetPosition();
+      AddBrushStroke(kMousePointer,
+                     pp::FloatPoint(position.x(), position.y()));
     }
 
     if (!touch_event_.is_null()) {
@@ -292,71 +883,154 @@ class Instance : public pp::Instance {
       for (uint32_t i = 0; i < touch_count; ++i) {
         pp::TouchPoint touch_point =
             touch_event_.GetTouchByIndex(PP_TOUCHLIST_TYPE_TOUCHES, i);
-        pp::Point sim_point = ScreenToSim(touch_point.position());
-        simulation_.DrawFilledCircle(sim_point.x(), sim_point.y(),
-                                     brush_radius_, brush_color_);
+        AddBrushStroke(touch_point.id(), touch_point.position());
       }
     }
+  }
 
-    simulation_.Step();
+  // Draws the queued brush strokes in a single pass. Returns false if there
+  // were none.
+  bool DrawBrushCapsules() {
+    if (brush_capsules_.empty())
+      return false;
+    world_.DrawCapsules(&brush_capsules_[0], brush_capsules_.size());
+    brush_capsules_.clear();
+    return true;
   }
 
-  void Render() {
+  // The number of simulation steps to take this frame, |elapsed| seconds
+  // after the last one.
+  int StepsThisFrame(PP_TimeTicks elapsed) {
+    if (steps_per_second_ <= 0)
+      return steps_per_frame_;
+
+    double due = steps_per_second_ * elapsed + step_fraction_;
+    int steps = static_cast<int>(due);
+    if (steps > steps_per_frame_) {
+      // Falling behind; drop the backlog rather than trying to catch up.
+      step_fraction_ = 0;
+      return steps_per_frame_;
+    }
+    step_fraction_ = due - steps;
+    return steps;
+  }
+
+  // How long to wait before the next frame when nothing changed.
+  int IdleDelayMs() const {
+    Activity activity = simulation_.activity();
+    if (steps_per_second_ <= 0 || activity == ACTIVITY_DEAD ||
+        activity == ACTIVITY_STATIC) {
+      return kIdlePollMs;
+    }
+    // Waiting for the next step in steps-per-second mode.
+    int delay_ms = static_cast<int>(
+        ceil((1 - step_fraction_) * 1000 / steps_per_second_));
+    return std::max(1, std::min(kIdlePollMs, delay_ms));
+  }
+
+  // Returns false if nothing changed since the last frame. |steps| is set to
+  // the number of simulation steps taken.
+  //
+  // The time since the last frame is split evenly between the steps, and
+  // each brush point is drawn just before the first step that ends after it
+  // was input. Fast strokes then paint a trail through the substeps, instead
+  // of all of it landing before the first step.
+  bool Update(int* steps) {
+    PP_TimeTicks now = pp::Module::Get()->core()->GetTimeTicks();
+    PP_TimeTicks start = last_update_time_;
+    if (start <= 0 || start > now)
+      start = now;
+    last_update_time_ = now;
+
+    int step_count = StepsThisFrame(now - start);
+    bool changed = false;
+    size_t next_point = 0;
+    *steps = 0;
+    for (int i = 0; i < step_count; ++i) {
+      PP_TimeTicks substep_end = start + (now - start) * (i + 1) / step_count;
+      bool last = i == step_count - 1;
+      bool moved = false;
+      while (next_point < brush_points_.size() &&
+             (last || brush_points_[next_point].time <= substep_end)) {
+        AddBrushStroke(next_point++);
+        moved = true;
+      }
+      if (!moved)
+        AddHeldBrush();
+      changed |= DrawBrushCapsules();
+
+      // A dead or static simulation would not change by stepping it.
+      Activity activity = simulation_.activity();
+      if (activity == ACTIVITY_DEAD || activity == ACTIVITY_STATIC)
+        continue;
+      world_.Step();
+      RecordFrame();
+      (*steps)++;
+      changed = true;
+    }
+
+    if (step_count == 0) {
+      for (; next_point < brush_points_.size(); ++next_point)
+        AddBrushStroke(next_point);
+      AddHeldBrush();
+      changed |= DrawBrushCapsules();
+    }
+    brush_points_.clear();
+    steps_taken_ += *steps;
+    return changed;
+  }
+
+  pp::ImageData AllocateImage() {
     PP_ImageDataFormat format = pp::ImageData::GetNativeImageDataFormat();
     const bool kDontInitToZero = false;
-    pp::ImageData image_data(this, format, context_size_, kDontInitToZero);
+    image_allocations_++;
+    return pp::ImageData(this, format, context_size_, kDontInitToZero);
+  }
+
+  // Returns an image to render into. Allocating an image is a round trip to
+  // the browser for shared memory, so images are reused when possible. The
+  // time spent here is reported with the FPS.
+  pp::ImageData AcquireImage() {
+    struct timeval start_time;
+    gettimeofday(&start_time, NULL);
+
+    pp::ImageData image_data;
+    if (!pool_images_) {
+      image_data = AllocateImage();
+    } else {
+      if (next_image_ == image_pool_.size())
+        image_pool_.push_back(AllocateImage());
+      image_data = image_pool_[next_image_];
+      next_image_ = (next_image_ + 1) % kImagePoolSize;
+    }
+
+    struct timeval end_time;
+    gettimeofday(&end_time, NULL);
+    image_us_ += TimeDeltaUs(&start_time, &end_time);
+    return image_data;
+  }
+
+  void Render() {
+    pp::ImageData image_data = AcquireImage();
     uint32_t* pixels = static_cast<uint32_t*>(image_data.data());
     if (!pixels) {
       printf("No pixels.\n");
       return;
     }
 
-    const AlignedReals& buffer = simulation_.buffer();
-    int screen_width = image_data.size().width();
-    int screen_height = image_data.size().height();
-    int buffer_width = buffer.size().width();
-    int buffer_height = buffer.size().height();
-
-    int by = 0;
-    int x_accum = 0;
-    int y_accum = 0;
-    int no_wrap_width = buffer_width * scale_denom_ / scale_numer_;
-
-    const real* row_start = buffer.data();
-    const real* src = row_start;
-    uint32_t* dst = pixels;
-    uint32_t color = palette_.GetColor(*src);
-    for (int sy = 0; sy < screen_height; ++sy) {
-      int row_count = screen_width;
-
-      while (row_count > 0) {
-        int no_wrap_count = std::min(row_count, no_wrap_width);
-        for (int x = 0; x < no_wrap_count; ++x) {
-          *dst++ = color;
-          x_accum += scale_numer_;
-          while (x_accum >= scale_denom_) {
-            x_accum -= scale_denom_;
-            color = palette_.GetColor(*++src);
-          }
-        }
-        row_count -= no_wrap_count;
-        src = row_start;
-        color = palette_.GetColor(*src);
-      }
-
-      x_accum = 0;
-      y_accum += scale_numer_;
-      while (y_accum >= scale_denom_) {
-        y_accum -= scale_denom_;
-        if (++by == buffer_height) {
-          by = 0;
-          src = row_start = buffer.data();
-        } else {
-          row_start += buffer_width;
-          src = row_start;
-        }
-        color = palette_.GetColor(*src);
-      }
+    // When zoomed out, render from a smaller copy of the state.
+    int level = renderer_.mip_level();
+    bool use_display = simulation_.compact() || simulation_.fused_display();
+    if (level > 0) {
+      const AlignedUint16s& mip =
+          use_display
+              ? mip_pyramid_.GetLevel(simulation_.display_buffer(), level)
+              : mip_pyramid_.GetLevel(simulation_.buffer(), level);
+      renderer_.Render(mip, palette_, pixels);
+    } else if (use_display) {
+      renderer_.Render(simulation_.display_buffer(), palette_, pixels);
+    } else {
+      renderer_.Render(simulation_.buffer(), palette_, pixels);
     }
     context_.ReplaceContents(&image_data);
   }
@@ -370,8 +1044,31 @@ class Instance : public pp::Instance {
       return;
     }
 
-    Update();
+    struct timeval frame_start_time;
+    gettimeofday(&frame_start_time, NULL);
+    int steps;
+    bool changed = Update(&steps);
+    if (changed)
+      mip_pyramid_.Invalidate();
+    if (!changed && !needs_render_) {
+      frame_timing_valid_ = false;
+      // Nothing to draw; poll at a low rate instead of flushing every frame.
+      // flush_context_ is left as is, so DidChangeView doesn't start a second
+      // main loop.
+      pp::Module::Get()->core()->CallOnMainThread(
+          IdleDelayMs(), callback_factory_.NewCallback(&Instance::MainLoop));
+      UpdateFps();
+      return;
+    }
+
+    needs_render_ = false;
+    struct timeval step_end_time;
+    gettimeofday(&step_end_time, NULL);
+    if (changed)
+      world_.EndFrame(TimeDeltaUs(&frame_start_time, &step_end_time) / 1000.0);
     Render();
+    struct timeval render_end_time;
+    gettimeofday(&render_end_time, NULL);
     // Store a reference to the context that is being flushed; this ensures
     // the callback is called, even if context_ changes before the flush
     // completes.
@@ -379,6 +1076,17 @@ class Instance : public pp::Instance {
     context_.Flush(callback_factory_.NewCallback(&Instance::MainLoop));
     frames_drawn_++;
     UpdateFps();
+
+    // The frame time covers everything since the last frame started,
+    // including waiting for the flush; it isn't meaningful after idling.
+    if (governor_enabled_ && frame_timing_valid_) {
+      UpdateGovernor(
+          TimeDeltaUs(&last_frame_start_time_, &frame_start_time) / 1000.0,
+          TimeDeltaUs(&frame_start_time, &step_end_time) / 1000.0, steps,
+          TimeDeltaUs(&step_end_time, &render_end_time) / 1000.0);
+    }
+    last_frame_start_time_ = frame_start_time;
+    frame_timing_valid_ = true;
   }
 
   void UpdateFps() {
@@ -388,33 +1096,133 @@ class Instance : public pp::Instance {
     int diff_ms = TimeDeltaMs(&last_frame_time_, &current_frame_time);
     if (diff_ms > kFpsUpdateMs) {
       real fps = static_cast<real>(frames_drawn_ * 1000) / diff_ms;
-      PostMessage(fps);
+      const IntegratorStats& stats = simulation_.integrator_stats();
+      pp::VarDictionary message;
+      message.Set("msg", "fps");
+      message.Set("fps", fps);
+      message.Set("stepsPerSecond",
+                  static_cast<double>(steps_taken_) * 1000 / diff_ms);
+      message.Set("dt", stats.dt);
+      message.Set("simTime", stats.time);
+      message.Set("rejectedSteps", stats.rejected_steps);
+      message.Set("activity", simulation_.activity());
+      message.Set("period", simulation_.period());
+      message.Set("replayingCycle", simulation_.replaying_cycle());
+      message.Set("imageUs",
+                  frames_drawn_ ? static_cast<double>(image_us_) / frames_drawn_
+                                : 0);
+      message.Set("imageAllocations", image_allocations_);
+      PostMessage(message);
       frames_drawn_ = 0;
+      steps_taken_ = 0;
+      image_us_ = 0;
+      image_allocations_ = 0;
       last_frame_time_ = current_frame_time;
     }
   }
 
+  void PostStats() {
+    const StepStats& stats = simulation_.step_stats();
+    pp::VarArray histogram;
+    for (int i = 0; i < StepStats::kHistogramBins; ++i)
+      histogram.Set(i, stats.histogram[i]);
+
+    pp::VarDictionary message;
+    message.Set("msg", "stats");
+    message.Set("count", stats.count);
+    message.Set("mass", stats.mass);
+    message.Set("meanChange", stats.count ? stats.change / stats.count : 0);
+    message.Set("min", stats.min_value);
+    message.Set("max", stats.max_value);
+    message.Set("histogram", histogram);
+    message.Set("activity", simulation_.activity());
+    PostMessage(message);
+  }
+
   pp::CompletionCallbackFactory<Instance> callback_factory_;
   pp::Graphics2D context_;
   pp::Graphics2D flush_context_;
+  pp::Size view_size_;
   pp::Size context_size_;
 
   SimulationConfig simulation_config_;
   Simulation simulation_;
+  // Changes to simulation_ are made through world_, so they can be logged.
+  World world_;
+  // The size chosen with setSize; the governor may simulate a smaller grid.
+  pp::Size sim_size_;
+  bool fast_size_;
   PaletteConfig palette_config_;
   Palette palette_;
+  Renderer renderer_;
+  MipPyramid mip_pyramid_;
 
   real max_scale_;
   int scale_numer_;
   int scale_denom_;
+  // When viewport_ is true, the screen is centered on (view_x_, view_y_) of
+  // the simulation, at view_zoom_ screen pixels per cell.
+  bool viewport_;
+  double view_x_;
+  double view_y_;
+  double view_zoom_;
+
+  struct BrushPoint {
+    PP_TimeTicks time;
+    // kMousePointer, or a touch id.
+    uint32_t pointer;
+    pp::FloatPoint position;
+    bool down;
+  };
 
   pp::MouseInputEvent mouse_event_;
   pp::TouchInputEvent touch_event_;
+  // Brush input since the last frame, in the order it arrived.
+  std::vector<BrushPoint> brush_points_;
+  // Where each pointer that is down was last drawn, in unwrapped simulation
+  // coordinates.
+  std::map<uint32_t, pp::FloatPoint> last_brush_points_;
+  // Strokes waiting to be drawn together by DrawBrushCapsules().
+  std::vector<Capsule> brush_capsules_;
   real brush_radius_;
   real brush_color_;
 
+  // Set when the screen must be redrawn even if the simulation is idle.
+  bool needs_render_;
+  // Images to render into; see AcquireImage().
+  bool pool_images_;
+  std::vector<pp::ImageData> image_pool_;
+  size_t next_image_;
+  // Time spent in AcquireImage() and the number of images allocated, since
+  // the last FPS update.
+  int64_t image_us_;
+  int image_allocations_;
+  // The filter chosen with setFilter; the governor may use a cheaper one.
+  RenderFilter filter_;
+  // The fraction of the view's resolution that the context has.
+  double render_scale_;
+  int steps_per_frame_;
+  FrameGovernor governor_;
+  bool governor_enabled_;
+  int max_steps_per_frame_;
+  // True once setStepsPerFrame picks an exact step count, which the governor
+  // then leaves alone; setGovernor hands the step count back to it.
+  bool fixed_steps_;
+  bool frame_timing_valid_;
+  struct timeval last_frame_start_time_;
+  // When nonzero, the simulation steps at this rate rather than a fixed
+  // number of steps per frame; step_fraction_ carries the remainder.
+  double steps_per_second_;
+  double step_fraction_;
+  PP_TimeTicks last_update_time_;
+  // Simulation steps since the last FPS update.
+  int steps_taken_;
   int frames_drawn_;
   struct timeval last_frame_time_;
+
+  // Both are NULL unless recording; see setRecording.
+  MemoryRecordingSink* recording_sink_;
+  Recorder* recorder_;
 };
 
 class Module : public pp::Module {
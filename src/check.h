@@ -0,0 +1,32 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CHECK_H_
+#define CHECK_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Exits if |x| is false or NULL, for failures there is no recovering from,
+// such as FFTW being unable to make a plan. |x| is tested as is, since
+// casting a pointer to int loses its upper half on 64-bit hosts.
+#define CHECK(x) \
+  do { \
+    if (!(x)) { \
+      printf("%s failed.\n", #x); \
+      exit(1); \
+    } \
+  } while(0)
+
+#endif  // CHECK_H_
@@ -0,0 +1,163 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "checkpoint.h"
+
+#include <string.h>
+#include <algorithm>
+
+namespace {
+
+size_t AlignUp(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+size_t StateElementSize(uint32_t format) {
+  switch (format) {
+    case CHECKPOINT_STATE_FLOAT32: return sizeof(float);
+    case CHECKPOINT_STATE_FLOAT64: return sizeof(double);
+    case CHECKPOINT_STATE_FIXED16: return sizeof(uint16_t);
+    default: return 0;
+  }
+}
+
+}  // namespace
+
+void InitCheckpointHeader(CheckpointStateFormat format, const pp::Size& size,
+                          CheckpointHeader* header) {
+  memset(header, 0, sizeof(*header));
+  header->magic = kCheckpointMagic;
+  header->version = kCheckpointVersion;
+  header->state_offset = AlignUp(sizeof(CheckpointHeader),
+                                 kCheckpointAlignment);
+  header->state_format = format;
+  header->width = size.width();
+  header->height = size.height();
+  header->state_size =
+      static_cast<uint64_t>(size.GetArea()) * StateElementSize(format);
+}
+
+size_t CheckpointSize(const CheckpointHeader& header) {
+  return header.state_offset + header.state_size;
+}
+
+const CheckpointHeader* ReadCheckpointHeader(const void* data, size_t size) {
+  if (size < sizeof(CheckpointHeader))
+    return NULL;
+
+  const CheckpointHeader* header = static_cast<const CheckpointHeader*>(data);
+  if (header->magic != kCheckpointMagic ||
+      header->version != kCheckpointVersion)
+    return NULL;
+
+  size_t element_size = StateElementSize(header->state_format);
+  if (element_size == 0 || header->width <= 0 || header->height <= 0 ||
+      header->state_offset < sizeof(CheckpointHeader) ||
+      header->state_offset % kCheckpointAlignment != 0 ||
+      header->state_size != static_cast<uint64_t>(header->width) *
+                                header->height * element_size ||
+      CheckpointSize(*header) > size)
+    return NULL;
+
+  if (header->palette.stop_count < 0 ||
+      header->palette.stop_count > kCheckpointMaxColorStops)
+    return NULL;
+
+  return header;
+}
+
+void* CheckpointState(void* data) {
+  CheckpointHeader* header = static_cast<CheckpointHeader*>(data);
+  return static_cast<char*>(data) + header->state_offset;
+}
+
+const void* CheckpointState(const void* data) {
+  const CheckpointHeader* header = static_cast<const CheckpointHeader*>(data);
+  return static_cast<const char*>(data) + header->state_offset;
+}
+
+void SetCheckpointKernel(const KernelConfig& config, CheckpointHeader* header) {
+  header->disc_radius = config.disc_radius;
+  header->ring_radius = config.ring_radius;
+  header->blend_radius = config.blend_radius;
+}
+
+KernelConfig GetCheckpointKernel(const CheckpointHeader& header) {
+  KernelConfig config;
+  config.disc_radius = header.disc_radius;
+  config.ring_radius = header.ring_radius;
+  config.blend_radius = header.blend_radius;
+  return config;
+}
+
+void SetCheckpointSmoother(const SmootherConfig& config,
+                           CheckpointHeader* header) {
+  header->timestep_type = config.timestep.type;
+  header->integrator = config.timestep.integrator;
+  header->timestep_dt = config.timestep.dt;
+  header->dt_min = config.timestep.dt_min;
+  header->dt_max = config.timestep.dt_max;
+  header->tolerance = config.timestep.tolerance;
+  header->b1 = config.b1;
+  header->d1 = config.d1;
+  header->b2 = config.b2;
+  header->d2 = config.d2;
+  header->sigmoid_mode = config.mode;
+  header->sigmoid = config.sigmoid;
+  header->mix = config.mix;
+  header->sn = config.sn;
+  header->sm = config.sm;
+}
+
+void SetCheckpointPalette(const PaletteConfig& config,
+                          CheckpointHeader* header) {
+  CheckpointPalette* palette = &header->palette;
+  palette->repeating = config.repeating;
+  palette->stop_count = std::min(static_cast<int>(config.stops.size()),
+                                 kCheckpointMaxColorStops);
+  for (int i = 0; i < palette->stop_count; ++i) {
+    palette->stops[i].color = config.stops[i].color;
+    palette->stops[i].pos = config.stops[i].pos;
+  }
+}
+
+PaletteConfig GetCheckpointPalette(const CheckpointHeader& header) {
+  const CheckpointPalette& palette = header.palette;
+  PaletteConfig config;
+  config.repeating = palette.repeating != 0;
+  for (int i = 0; i < palette.stop_count; ++i)
+    config.stops.push_back(ColorStop(palette.stops[i].color,
+                                     palette.stops[i].pos));
+  return config;
+}
+
+SmootherConfig GetCheckpointSmoother(const CheckpointHeader& header) {
+  SmootherConfig config;
+  config.timestep.type = static_cast<Timestep>(header.timestep_type);
+  config.timestep.integrator = static_cast<Integrator>(header.integrator);
+  config.timestep.dt = header.timestep_dt;
+  config.timestep.dt_min = header.dt_min;
+  config.timestep.dt_max = header.dt_max;
+  config.timestep.tolerance = header.tolerance;
+  config.b1 = header.b1;
+  config.d1 = header.d1;
+  config.b2 = header.b2;
+  config.d2 = header.d2;
+  config.mode = static_cast<SigmoidMode>(header.sigmoid_mode);
+  config.sigmoid = static_cast<Sigmoid>(header.sigmoid);
+  config.mix = static_cast<Sigmoid>(header.mix);
+  config.sn = header.sn;
+  config.sm = header.sm;
+  return config;
+}
@@ -0,0 +1,128 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ppapi/cpp/size.h>
+
+#include "kernel_config.h"
+#include "palette.h"
+#include "smoother_config.h"
+
+// A checkpoint is a CheckpointHeader followed by the raw state, row-major.
+// The state starts at a multiple of kCheckpointAlignment, so a checkpoint
+// file can be mmap'd and its state copied straight into an FftAllocation.
+// Fields are fixed-size, in host byte order, so checkpoints can be shared
+// between the NaCl module and host builds on little-endian machines;
+// readers reject a checkpoint of the other byte order by its magic.
+const uint32_t kCheckpointMagic = 0x4b434d53;  // "SMCK"
+const uint32_t kCheckpointVersion = 1;
+const size_t kCheckpointAlignment = 64;
+const int kCheckpointMaxColorStops = 16;
+
+enum CheckpointStateFormat {
+  CHECKPOINT_STATE_FLOAT32,
+  CHECKPOINT_STATE_FLOAT64,
+  // 16-bit fixed point; see fixed16.h.
+  CHECKPOINT_STATE_FIXED16
+};
+
+struct CheckpointColorStop {
+  uint32_t color;
+  float pos;
+};
+
+// Simulation has no palette, so these fields are filled in by the embedder
+// with SetCheckpointPalette().
+struct CheckpointPalette {
+  int32_t repeating;
+  int32_t stop_count;
+  CheckpointColorStop stops[kCheckpointMaxColorStops];
+};
+
+struct CheckpointHeader {
+  uint32_t magic;
+  uint32_t version;
+  // Offset of the state from the start of the checkpoint.
+  uint32_t state_offset;
+  uint32_t state_format;  // A CheckpointStateFormat.
+  int32_t width;
+  int32_t height;
+  uint64_t state_size;
+
+  // IntegratorStats.
+  int64_t steps;
+  double time;
+  double dt;
+
+  // KernelConfig.
+  double disc_radius;
+  double ring_radius;
+  double blend_radius;
+
+  // SmootherConfig.
+  int32_t timestep_type;
+  int32_t integrator;
+  double timestep_dt;
+  double dt_min;
+  double dt_max;
+  double tolerance;
+  double b1;
+  double d1;
+  double b2;
+  double d2;
+  int32_t sigmoid_mode;
+  int32_t sigmoid;
+  int32_t mix;
+  int32_t reserved;
+  double sn;
+  double sm;
+
+  CheckpointPalette palette;
+
+  // The simulation's random number state (see rng.h), or all zero if
+  // there is none.
+  uint64_t rng_state[4];
+};
+
+// Every field is explicitly aligned, so the layout is the same on every
+// build; this fails to compile if a change adds padding.
+typedef char CheckpointHeaderSizeCheck[
+    sizeof(CheckpointHeader) == 352 ? 1 : -1];
+
+// Sets the format fields of |header| and zeroes the rest.
+void InitCheckpointHeader(CheckpointStateFormat format, const pp::Size& size,
+                          CheckpointHeader* header);
+// The size of the whole checkpoint described by |header|.
+size_t CheckpointSize(const CheckpointHeader& header);
+// Returns the header of the checkpoint in |data|, or NULL if it is not a
+// valid checkpoint of at most |size| bytes.
+const CheckpointHeader* ReadCheckpointHeader(const void* data, size_t size);
+void* CheckpointState(void* data);
+const void* CheckpointState(const void* data);
+
+void SetCheckpointKernel(const KernelConfig& config, CheckpointHeader* header);
+KernelConfig GetCheckpointKernel(const CheckpointHeader& header);
+void SetCheckpointSmoother(const SmootherConfig& config,
+                           CheckpointHeader* header);
+SmootherConfig GetCheckpointSmoother(const CheckpointHeader& header);
+// Only the first kCheckpointMaxColorStops stops are kept.
+void SetCheckpointPalette(const PaletteConfig& config,
+                          CheckpointHeader* header);
+PaletteConfig GetCheckpointPalette(const CheckpointHeader& header);
+
+#endif  // CHECKPOINT_H_
@@ -0,0 +1,307 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ensemble.h"
+
+#include <algorithm>
+#include <string.h>
+
+#include "check.h"
+#include "checkpoint.h"
+#include "fftw_threads.h"
+#include "kernel.h"
+#include "rasterizer.h"
+#include "smoother.h"
+
+namespace {
+
+bool SameKernel(const KernelConfig& a, const KernelConfig& b) {
+  return a.disc_radius == b.disc_radius && a.ring_radius == b.ring_radius &&
+         a.blend_radius == b.blend_radius;
+}
+
+}  // namespace
+
+struct Ensemble::MultiplyTask {
+  void Run(int task) {
+    int count = ensemble->world_count_ * ensemble->spectrum_count_;
+    ensemble->MultiplyRange(count * static_cast<int64_t>(task) / task_count,
+                            count * static_cast<int64_t>(task + 1) /
+                                task_count);
+  }
+
+  Ensemble* ensemble;
+  int task_count;
+};
+
+struct Ensemble::SmootherTask {
+  void Run(int task) {
+    int count = ensemble->world_count_ * ensemble->area_;
+    ensemble->ApplySmootherRange(
+        count * static_cast<int64_t>(task) / task_count,
+        count * static_cast<int64_t>(task + 1) / task_count,
+        stats ? &stats[task * ensemble->world_count_] : NULL);
+  }
+
+  Ensemble* ensemble;
+  // world_count_ stats per task.
+  StepStats* stats;
+  int task_count;
+};
+
+Ensemble::Ensemble(const EnsembleConfig& config)
+    : size_(config.size),
+      world_count_(config.world_count),
+      area_(config.size.GetArea()),
+      spectrum_count_(config.size.height() * (config.size.width() / 2 + 1)),
+      thread_pool_(config.thread_count),
+      thread_count_(config.thread_count),
+      state_(pp::Size(size_.width(), size_.height() * world_count_)),
+      spectra_(pp::Size(size_.width(), size_.height() * world_count_),
+               ReduceSizeForComplex()),
+      products_(pp::Size(size_.width(), 2 * size_.height() * world_count_),
+                ReduceSizeForComplex()),
+      convolutions_(pp::Size(size_.width(),
+                             2 * size_.height() * world_count_)),
+      world_kernels_(world_count_),
+      smoothers_(world_count_),
+      rngs_(world_count_),
+      times_(world_count_),
+      step_stats_(world_count_),
+      task_stats_(std::max(1, thread_count_) * world_count_),
+      collect_stats_(false),
+      steps_(0),
+      forward_plan_(NULL),
+      inverse_plan_(NULL) {
+  // Before anything plans a transform, including Kernel::SetConfig().
+#ifdef USE_THREADS
+  AcquireFftwThreads();
+#endif
+  kernels_.push_back(new Kernel(size_, config.kernel_config));
+  kernels_[0]->SetConfig(config.kernel_config);
+  for (int i = 0; i < world_count_; ++i) {
+    smoothers_[i] = new Smoother(size_, config.smoother_config,
+                                 &thread_pool_);
+    smoothers_[i]->SetConfig(config.smoother_config);
+    rngs_[i].Seed(config.seed, i);
+  }
+  std::fill(state_.begin(), state_.end(), 0);
+  MakePlans();
+}
+
+Ensemble::~Ensemble() {
+  DestroyPlans();
+  for (size_t i = 0; i < kernels_.size(); ++i)
+    delete kernels_[i];
+  for (int i = 0; i < world_count_; ++i)
+    delete smoothers_[i];
+#ifdef USE_THREADS
+  ReleaseFftwThreads();
+#endif
+}
+
+void Ensemble::MakePlans() {
+  DestroyPlans();
+#ifdef USE_THREADS
+  fftw_plan_with_nthreads(thread_count_);
+#endif
+  // Like Simulation::MakePlans(), but with one transform per world; the
+  // inverse makes two per world, one for each kernel.
+  int n[2] = {size_.height(), size_.width()};
+  forward_plan_ = fftw_plan_many_dft_r2c(
+      2, n, world_count_, state_.data(), NULL, 1, area_, spectra_.data(),
+      NULL, 1, spectrum_count_, FFTW_ESTIMATE);
+  inverse_plan_ = fftw_plan_many_dft_c2r(
+      2, n, 2 * world_count_, products_.data(), NULL, 1, spectrum_count_,
+      convolutions_.data(), NULL, 1, area_, FFTW_ESTIMATE);
+  CHECK(forward_plan_);
+  CHECK(inverse_plan_);
+}
+
+void Ensemble::DestroyPlans() {
+  if (forward_plan_)
+    fftw_destroy_plan(forward_plan_);
+  if (inverse_plan_)
+    fftw_destroy_plan(inverse_plan_);
+  forward_plan_ = NULL;
+  inverse_plan_ = NULL;
+}
+
+const KernelConfig& Ensemble::kernel_config(int index) const {
+  return kernels_[world_kernels_[index]]->config();
+}
+
+const SmootherConfig& Ensemble::smoother_config(int index) const {
+  return smoothers_[index]->config();
+}
+
+void Ensemble::SetStatsEnabled(bool enabled) {
+  collect_stats_ = enabled;
+}
+
+void Ensemble::SetKernel(int index, const KernelConfig& config) {
+  world_kernels_[index] = FindKernel(config);
+  RemoveUnusedKernels();
+}
+
+void Ensemble::SetSmoother(int index, const SmootherConfig& config) {
+  smoothers_[index]->SetConfig(config);
+}
+
+int Ensemble::FindKernel(const KernelConfig& config) {
+  for (size_t i = 0; i < kernels_.size(); ++i) {
+    if (SameKernel(kernels_[i]->config(), config))
+      return static_cast<int>(i);
+  }
+  Kernel* kernel = new Kernel(size_, config);
+  kernel->SetConfig(config);
+  kernels_.push_back(kernel);
+  return static_cast<int>(kernels_.size()) - 1;
+}
+
+void Ensemble::RemoveUnusedKernels() {
+  std::vector<int> new_index(kernels_.size(), -1);
+  int kept = 0;
+  for (int i = 0; i < world_count_; ++i)
+    new_index[world_kernels_[i]] = 0;
+  for (size_t i = 0; i < kernels_.size(); ++i) {
+    if (new_index[i] < 0) {
+      delete kernels_[i];
+      continue;
+    }
+    new_index[i] = kept;
+    kernels_[kept++] = kernels_[i];
+  }
+  kernels_.resize(kept);
+  for (int i = 0; i < world_count_; ++i)
+    world_kernels_[i] = new_index[world_kernels_[i]];
+}
+
+void Ensemble::Clear(int index, real color) {
+  std::fill(state(index), state(index) + area_, color);
+}
+
+void Ensemble::Seed(int index, uint64_t seed) {
+  rngs_[index].Seed(seed);
+}
+
+void Ensemble::Splat(int index) {
+  std::vector<Capsule> capsules;
+  AddSplatCapsules(size_.width(), size_.height(),
+                   kernel_config(index).ring_radius, rngs_[index].Next(), 0,
+                   size_.height(), &capsules);
+  for (size_t i = 0; i < capsules.size(); ++i) {
+    FillCapsuleRows(state(index), size_.width(), size_.height(), capsules[i],
+                    capsules[i].color, 0, size_.height());
+  }
+}
+
+size_t Ensemble::CheckpointSize() const {
+  CheckpointHeader header;
+  InitCheckpointHeader(sizeof(real) == sizeof(float)
+                           ? CHECKPOINT_STATE_FLOAT32
+                           : CHECKPOINT_STATE_FLOAT64,
+                       size_, &header);
+  return ::CheckpointSize(header);
+}
+
+void Ensemble::SaveCheckpoint(int index, void* data) const {
+  CheckpointHeader* header = static_cast<CheckpointHeader*>(data);
+  InitCheckpointHeader(sizeof(real) == sizeof(float)
+                           ? CHECKPOINT_STATE_FLOAT32
+                           : CHECKPOINT_STATE_FLOAT64,
+                       size_, header);
+  const SmootherConfig& smoother = smoother_config(index);
+  header->steps = steps_;
+  header->time = times_[index];
+  header->dt = smoother.timestep.dt;
+  SetCheckpointKernel(kernel_config(index), header);
+  SetCheckpointSmoother(smoother, header);
+  for (int i = 0; i < 4; ++i)
+    header->rng_state[i] = rngs_[index].state()[i];
+  memcpy(CheckpointState(data), state(index), area_ * sizeof(real));
+}
+
+void Ensemble::Step() {
+  int task_count = std::max(1, thread_count_);
+
+  fftw_execute(forward_plan_);
+
+  MultiplyTask multiply;
+  multiply.ensemble = this;
+  multiply.task_count = task_count;
+  thread_pool_.Run(&multiply, task_count);
+
+  fftw_execute(inverse_plan_);
+
+  if (collect_stats_)
+    std::fill(task_stats_.begin(), task_stats_.end(), StepStats());
+  SmootherTask smoother;
+  smoother.ensemble = this;
+  smoother.stats = collect_stats_ ? &task_stats_[0] : NULL;
+  smoother.task_count = task_count;
+  thread_pool_.Run(&smoother, task_count);
+
+  for (int i = 0; i < world_count_; ++i) {
+    if (collect_stats_) {
+      step_stats_[i] = StepStats();
+      for (int task = 0; task < task_count; ++task)
+        step_stats_[i].Merge(task_stats_[task * world_count_ + i]);
+    }
+    times_[i] += smoothers_[i]->config().timestep.dt;
+  }
+  steps_++;
+}
+
+// products = spectrum * ring spectrum, then spectrum * disc spectrum, like
+// Simulation::Convolve(), but reading each world's spectrum once for both.
+void Ensemble::MultiplyRange(int begin, int end) {
+  while (begin < end) {
+    int world = begin / spectrum_count_;
+    int world_begin = world * spectrum_count_;
+    int world_end = std::min(end, world_begin + spectrum_count_);
+    const Kernel& kernel = *kernels_[world_kernels_[world]];
+    const fftw_complex* in = spectra_.data() + world_begin;
+    const fftw_complex* ring = kernel.krf().data();
+    const fftw_complex* disc = kernel.kdf().data();
+    fftw_complex* ring_out = products_.data() + world_begin;
+    fftw_complex* disc_out =
+        products_.data() + world_count_ * spectrum_count_ + world_begin;
+    for (int i = begin - world_begin; i < world_end - world_begin; ++i) {
+      real re = in[i][0];
+      real im = in[i][1];
+      ring_out[i][0] = re * ring[i][0] - im * ring[i][1];
+      ring_out[i][1] = re * ring[i][1] + im * ring[i][0];
+      disc_out[i][0] = re * disc[i][0] - im * disc[i][1];
+      disc_out[i][1] = re * disc[i][1] + im * disc[i][0];
+    }
+    begin = world_end;
+  }
+}
+
+void Ensemble::ApplySmootherRange(int begin, int end, StepStats* stats) {
+  while (begin < end) {
+    int world = begin / area_;
+    int world_begin = world * area_;
+    int world_end = std::min(end, world_begin + area_);
+    const real* an = convolutions_.data() + world_begin;
+    const real* am =
+        convolutions_.data() + world_count_ * area_ + world_begin;
+    smoothers_[world]->ApplyCells(an, am, state(world),
+                                  begin - world_begin,
+                                  world_end - world_begin,
+                                  stats ? &stats[world] : NULL);
+    begin = world_end;
+  }
+}
@@ -0,0 +1,147 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ENSEMBLE_H_
+#define ENSEMBLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <ppapi/cpp/size.h>
+
+#include "fft_allocation.h"
+#include "fftw.h"
+#include "kernel_config.h"
+#include "rng.h"
+#include "smoother_config.h"
+#include "step_stats.h"
+#include "thread_pool.h"
+
+class Kernel;
+class Smoother;
+
+struct EnsembleConfig {
+  EnsembleConfig(int thread_count, const pp::Size& size, int world_count)
+      : thread_count(thread_count),
+        size(size),
+        world_count(world_count),
+        seed(0) {}
+  int thread_count;
+  pp::Size size;
+  int world_count;
+  // World i draws its random numbers from stream i of this seed.
+  uint64_t seed;
+  // Every world starts with these; they can be changed per world.
+  KernelConfig kernel_config;
+  SmootherConfig smoother_config;
+};
+
+// Many independent worlds of the same size, stepped together. A Simulation
+// per world would make three small transforms per step each, and leave most
+// threads idle while it did; here the states are stored one after another,
+// so a step of every world is one batched forward transform, a multiply
+// pass, one batched inverse transform of all 2N products, and a smoother
+// pass. The passes are split between threads by cells, not by world, so
+// they keep every thread busy however few worlds there are.
+//
+// Every world has its own kernel and smoother config. Worlds with the same
+// kernel config share its spectra. Every world is stepped with the Euler
+// integrator, whatever its timestep's integrator is; the others convolve
+// several times per step, and would stall the whole batch.
+class Ensemble {
+ public:
+  explicit Ensemble(const EnsembleConfig& config);
+  ~Ensemble();
+
+  const pp::Size& size() const { return size_; }
+  int world_count() const { return world_count_; }
+  ThreadPool* thread_pool() { return &thread_pool_; }
+  // The state of world |index|: size().GetArea() values, row-major.
+  real* state(int index) { return state_.data() + index * area_; }
+  const real* state(int index) const {
+    return state_.data() + index * area_;
+  }
+  const KernelConfig& kernel_config(int index) const;
+  const SmootherConfig& smoother_config(int index) const;
+  // Only computed when stats are enabled.
+  const StepStats& step_stats(int index) const { return step_stats_[index]; }
+  bool stats_enabled() const { return collect_stats_; }
+  // Steps since the ensemble was made; every world has taken the same
+  // number.
+  int steps() const { return steps_; }
+
+  void SetStatsEnabled(bool enabled);
+  void SetKernel(int index, const KernelConfig& config);
+  void SetSmoother(int index, const SmootherConfig& config);
+  void Clear(int index, real color);
+  // Like Simulation::Seed(); a world seeded the same as a simulation splats
+  // the same circles.
+  void Seed(int index, uint64_t seed);
+  // Like Simulation::Splat(), with world |index|'s random numbers.
+  void Splat(int index);
+  // Writes world |index| as a checkpoint that a Simulation can load; see
+  // checkpoint.h.
+  size_t CheckpointSize() const;
+  void SaveCheckpoint(int index, void* data) const;
+
+  // Steps every world once.
+  void Step();
+
+ private:
+  struct MultiplyTask;
+  struct SmootherTask;
+  void MakePlans();
+  void DestroyPlans();
+  // Each of these updates [begin, end) of the worlds' values, counted over
+  // all of them, so a range may span several worlds.
+  void MultiplyRange(int begin, int end);
+  void ApplySmootherRange(int begin, int end, StepStats* stats);
+  // Returns the index in kernels_ of a kernel with |config|, making one if
+  // there is none.
+  int FindKernel(const KernelConfig& config);
+  void RemoveUnusedKernels();
+
+  pp::Size size_;
+  int world_count_;
+  int area_;
+  // The number of values in one world's spectrum.
+  int spectrum_count_;
+  ThreadPool thread_pool_;
+  int thread_count_;
+  // All of these hold the worlds one after another. products_ and
+  // convolutions_ hold every world's ring convolution, then every world's
+  // disc convolution.
+  AlignedReals state_;
+  AlignedComplexes spectra_;
+  AlignedComplexes products_;
+  AlignedReals convolutions_;
+  std::vector<Kernel*> kernels_;
+  // The index in kernels_ of each world's kernel.
+  std::vector<int> world_kernels_;
+  std::vector<Smoother*> smoothers_;
+  std::vector<Rng> rngs_;
+  std::vector<double> times_;
+  std::vector<StepStats> step_stats_;
+  // Each task's stats for each world, reused by every Step().
+  std::vector<StepStats> task_stats_;
+  bool collect_stats_;
+  int steps_;
+  fftw_plan forward_plan_;
+  fftw_plan inverse_plan_;
+
+  Ensemble(const Ensemble&);  // Undefined.
+  Ensemble& operator =(const Ensemble&);  // Undefined.
+};
+
+#endif  // ENSEMBLE_H_
@@ -0,0 +1,272 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "explorer.h"
+
+#include <algorithm>
+#include <math.h>
+
+#include "ensemble.h"
+
+namespace {
+
+// The width the app's kernel radii are chosen for.
+const real kAppWidth = 512;
+// randomize() picks radii up to these.
+const real kMaxRadius = 35;
+const real kMaxBlendRadius = 10;
+// Radii are drawn from at least this range, so small worlds can still fit a
+// disc of radius 1 inside a ring.
+const real kMinRadiusRange = 3;
+// Draws of a disc and ring before falling back to the smallest pair.
+const int kMaxRadiusTries = 100;
+
+// Mean value above which a world is saturated.
+const double kSaturatedDensity = 0.98;
+// Steps a world must stay saturated before the run stops, like
+// ActivityDetector's dead and static states.
+const int kSettleSteps = 8;
+// Relative change per step below which a world that is still changing is
+// considered static; it is only creeping.
+const double kMinMotion = 1e-4;
+// A moving world is classed as gliders if its density and mass variation
+// are below these.
+const double kMaxGliderDensity = 0.25;
+const double kMaxGliderVariation = 0.05;
+// The motion that earns a full score; faster is no more interesting.
+const double kFullScoreMotion = 0.05;
+
+// Uniform in [0, count).
+int RandomInt(Rng* rng, int count) {
+  return std::min(count - 1, static_cast<int>(rng->NextUnit() * count));
+}
+
+}  // namespace
+
+const char* GetExploreClassName(ExploreClass explore_class) {
+  switch (explore_class) {
+    case EXPLORE_DEAD: return "dead";
+    case EXPLORE_SATURATED: return "saturated";
+    case EXPLORE_STATIC: return "static";
+    case EXPLORE_PERIODIC: return "periodic";
+    case EXPLORE_CHAOTIC: return "chaotic";
+    case EXPLORE_GLIDERS: return "gliders";
+  }
+  return "unknown";
+}
+
+void RandomExploreParams(Rng* rng, int width, KernelConfig* kernel,
+                         SmootherConfig* smoother) {
+  real scale = width / kAppWidth;
+  real max_radius = std::max(kMaxRadius * scale, kMinRadiusRange);
+  kernel->disc_radius = 1;
+  kernel->ring_radius = 2;
+  for (int i = 0; i < kMaxRadiusTries; ++i) {
+    real disc_radius = rng->NextUnit() * max_radius;
+    real ring_radius = rng->NextUnit() * max_radius;
+    if (disc_radius >= 1 && ring_radius >= disc_radius + 1) {
+      kernel->disc_radius = disc_radius;
+      kernel->ring_radius = ring_radius;
+      break;
+    }
+  }
+  kernel->blend_radius = rng->NextUnit() * kMaxBlendRadius * scale;
+
+  smoother->timestep = TimestepConfig();
+  smoother->timestep.type = static_cast<Timestep>(RandomInt(rng, 5));
+  smoother->timestep.dt = rng->NextUnit();
+  smoother->b1 = rng->NextUnit();
+  smoother->d1 = rng->NextUnit();
+  smoother->b2 = rng->NextUnit();
+  smoother->d2 = rng->NextUnit();
+  smoother->mode = static_cast<SigmoidMode>(RandomInt(rng, 4));
+  smoother->sigmoid = static_cast<Sigmoid>(RandomInt(rng, 5));
+  smoother->mix = static_cast<Sigmoid>(RandomInt(rng, 5));
+  smoother->sn = rng->NextUnit();
+  smoother->sm = rng->NextUnit();
+}
+
+RunClassifier::RunClassifier(int warmup_steps)
+    : warmup_steps_(warmup_steps),
+      steps_(0),
+      saturated_steps_(0),
+      invalid_(false),
+      measured_steps_(0),
+      density_sum_(0),
+      density_squared_sum_(0),
+      motion_sum_(0),
+      last_density_(0),
+      last_motion_(0) {}
+
+double RunClassifier::density() const {
+  return measured_steps_ ? density_sum_ / measured_steps_ : last_density_;
+}
+
+double RunClassifier::mass_variation() const {
+  if (measured_steps_ == 0)
+    return 0;
+  double mean = density_sum_ / measured_steps_;
+  double variance = density_squared_sum_ / measured_steps_ - mean * mean;
+  return mean > 0 ? sqrt(std::max(0.0, variance)) / mean : 0;
+}
+
+double RunClassifier::motion() const {
+  return measured_steps_ ? motion_sum_ / measured_steps_ : last_motion_;
+}
+
+bool RunClassifier::Update(const StepStats& stats) {
+  steps_++;
+  if (stats.count == 0)
+    return false;
+
+  double density = stats.mass / stats.count;
+  // Some random rules blow up; there is nothing to see in them.
+  if (density != density) {
+    invalid_ = true;
+    return true;
+  }
+  double motion = stats.mass > 0 ? stats.change / stats.mass : 0;
+  last_density_ = density;
+  last_motion_ = motion;
+  saturated_steps_ = density > kSaturatedDensity ? saturated_steps_ + 1 : 0;
+  if (steps_ > warmup_steps_) {
+    measured_steps_++;
+    density_sum_ += density;
+    density_squared_sum_ += density * density;
+    motion_sum_ += motion;
+  }
+
+  Activity activity = activity_.Update(stats);
+  return activity != ACTIVITY_ACTIVE || saturated_steps_ >= kSettleSteps;
+}
+
+ExploreClass RunClassifier::Classify() const {
+  if (invalid_)
+    return EXPLORE_DEAD;
+  if (saturated_steps_ >= kSettleSteps)
+    return EXPLORE_SATURATED;
+  switch (activity_.activity()) {
+    case ACTIVITY_DEAD:
+      return EXPLORE_DEAD;
+    case ACTIVITY_STATIC:
+      return EXPLORE_STATIC;
+    case ACTIVITY_PERIODIC:
+      return EXPLORE_PERIODIC;
+    case ACTIVITY_ACTIVE:
+      break;
+  }
+  if (motion() < kMinMotion)
+    return EXPLORE_STATIC;
+  if (density() < kMaxGliderDensity &&
+      mass_variation() < kMaxGliderVariation)
+    return EXPLORE_GLIDERS;
+  return EXPLORE_CHAOTIC;
+}
+
+// Steady mass, motion and empty space each make a world more interesting
+// to watch; the score is their product. Periodic worlds only get half,
+// since they have nothing new to show after one period.
+double RunClassifier::Score() const {
+  ExploreClass explore_class = Classify();
+  if (explore_class == EXPLORE_DEAD || explore_class == EXPLORE_SATURATED ||
+      explore_class == EXPLORE_STATIC)
+    return 0;
+
+  double steadiness = 1 / (1 + 10 * mass_variation());
+  double movement = std::min(1.0, motion() / kFullScoreMotion);
+  double score = steadiness * movement * (1 - density());
+  if (explore_class == EXPLORE_PERIODIC)
+    score /= 2;
+  return score;
+}
+
+Explorer::Explorer(const ExplorerConfig& config)
+    : config_(config),
+      ensemble_(NULL),
+      next_index_(0) {
+  int slot_count = std::max(1, std::min(config.batch_size, config.run_count));
+  EnsembleConfig ensemble_config(config.thread_count, config.size,
+                                 slot_count);
+  ensemble_ = new Ensemble(ensemble_config);
+  ensemble_->SetStatsEnabled(true);
+  slots_.resize(slot_count);
+  for (int i = 0; i < slot_count; ++i)
+    StartRun(i);
+}
+
+Explorer::~Explorer() {
+  delete ensemble_;
+}
+
+bool Explorer::done() const {
+  return static_cast<int>(results_.size()) >= config_.run_count;
+}
+
+bool Explorer::Step() {
+  if (done())
+    return false;
+
+  ensemble_->Step();
+  for (size_t i = 0; i < slots_.size(); ++i) {
+    Slot& slot = slots_[i];
+    if (slot.index < 0)
+      continue;
+    bool settled = slot.classifier.Update(ensemble_->step_stats(i));
+    if (settled || slot.classifier.steps() >= config_.max_steps) {
+      FinishRun(i);
+      StartRun(i);
+    }
+  }
+  return !done();
+}
+
+// Slots left over once every run has started are cleared and ignored,
+// though the ensemble still steps them with the others.
+void Explorer::StartRun(int slot) {
+  Slot& s = slots_[slot];
+  ensemble_->Clear(slot, 0);
+  if (next_index_ >= config_.run_count) {
+    s.index = -1;
+    return;
+  }
+
+  s.index = next_index_++;
+  Rng rng(config_.seed, s.index);
+  KernelConfig kernel;
+  SmootherConfig smoother;
+  RandomExploreParams(&rng, config_.size.width(), &kernel, &smoother);
+  s.seed = rng.Next();
+  s.classifier = RunClassifier(config_.warmup_steps);
+
+  ensemble_->SetKernel(slot, kernel);
+  ensemble_->SetSmoother(slot, smoother);
+  ensemble_->Seed(slot, s.seed);
+  ensemble_->Splat(slot);
+}
+
+void Explorer::FinishRun(int slot) {
+  const Slot& s = slots_[slot];
+  ExploreResult result;
+  result.index = s.index;
+  result.kernel = ensemble_->kernel_config(slot);
+  result.smoother = ensemble_->smoother_config(slot);
+  result.seed = s.seed;
+  result.explore_class = s.classifier.Classify();
+  result.score = s.classifier.Score();
+  result.steps = s.classifier.steps();
+  result.density = s.classifier.density();
+  result.mass_variation = s.classifier.mass_variation();
+  result.motion = s.classifier.motion();
+  results_.push_back(result);
+}
@@ -0,0 +1,166 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EXPLORER_H_
+#define EXPLORER_H_
+
+#include <stdint.h>
+#include <vector>
+#include <ppapi/cpp/size.h>
+
+#include "activity.h"
+#include "kernel_config.h"
+#include "rng.h"
+#include "smoother_config.h"
+#include "step_stats.h"
+
+class Ensemble;
+
+enum ExploreClass {
+  // Nothing is left alive.
+  EXPLORE_DEAD,
+  // Nearly every cell is fully alive.
+  EXPLORE_SATURATED,
+  // The state stopped changing.
+  EXPLORE_STATIC,
+  // The state repeats; see ActivityDetector.
+  EXPLORE_PERIODIC,
+  // Still moving at the end, with the total mass swinging or most of the
+  // world covered.
+  EXPLORE_CHAOTIC,
+  // Still moving at the end, with a steady, sparse mass: usually a few
+  // objects travelling through empty space.
+  EXPLORE_GLIDERS
+};
+
+const char* GetExploreClassName(ExploreClass explore_class);
+
+// Samples the same ranges as randomize() in example.js, with the kernel
+// radii scaled from the app's 512-cell width to |width|, but never below 3.
+// Kernels whose disc is not inside the ring are resampled, since their ring
+// is empty; if none of 100 draws fits, a disc of 1 in a ring of 2 is used.
+void RandomExploreParams(Rng* rng, int width, KernelConfig* kernel,
+                         SmootherConfig* smoother);
+
+// Classifies one run from the StepStats of each of its steps, and decides
+// when it can stop early.
+class RunClassifier {
+ public:
+  // Steps before |warmup_steps| settle the splat, and are not measured.
+  explicit RunClassifier(int warmup_steps);
+
+  int steps() const { return steps_; }
+  // Means over the measured steps.
+  double density() const;
+  // The standard deviation of the mass, relative to its mean.
+  double mass_variation() const;
+  // The change per step, relative to the mass.
+  double motion() const;
+
+  // Returns true once the run's class can't change: it is dead, saturated,
+  // static or periodic.
+  bool Update(const StepStats& stats);
+  ExploreClass Classify() const;
+  // 0 for a run with nothing to see, up to 1 for one that keeps moving with
+  // a steady, sparse mass, which is what a person looks for.
+  double Score() const;
+
+ private:
+  ActivityDetector activity_;
+  int warmup_steps_;
+  int steps_;
+  int saturated_steps_;
+  bool invalid_;
+  // Sums over the measured steps.
+  int measured_steps_;
+  double density_sum_;
+  double density_squared_sum_;
+  double motion_sum_;
+  // The state of the last step, for runs that stop before they are
+  // measured.
+  double last_density_;
+  double last_motion_;
+};
+
+struct ExploreResult {
+  int index;
+  KernelConfig kernel;
+  SmootherConfig smoother;
+  // Seeding a simulation with this and splatting starts the same world.
+  uint64_t seed;
+  ExploreClass explore_class;
+  double score;
+  int steps;
+  double density;
+  double mass_variation;
+  double motion;
+};
+
+struct ExplorerConfig {
+  ExplorerConfig()
+      : thread_count(1),
+        size(128, 128),
+        run_count(1000),
+        batch_size(16),
+        warmup_steps(50),
+        max_steps(500),
+        seed(1) {}
+  int thread_count;
+  pp::Size size;
+  int run_count;
+  // Runs stepped together in one ensemble.
+  int batch_size;
+  int warmup_steps;
+  int max_steps;
+  // Run i's parameters and splat only depend on this and i.
+  uint64_t seed;
+};
+
+// Evaluates random parameter sets in an Ensemble. Each slot of the ensemble
+// runs one set; when it dies, settles or reaches max_steps, its result is
+// recorded and the slot starts the next set, so the batch stays full.
+class Explorer {
+ public:
+  explicit Explorer(const ExplorerConfig& config);
+  ~Explorer();
+
+  // In the order the runs finished.
+  const std::vector<ExploreResult>& results() const { return results_; }
+  bool done() const;
+
+  // Steps every running slot once. Returns false once every run is done.
+  bool Step();
+
+ private:
+  struct Slot {
+    Slot() : index(-1), classifier(0) {}
+    int index;
+    uint64_t seed;
+    RunClassifier classifier;
+  };
+
+  void StartRun(int slot);
+  void FinishRun(int slot);
+
+  ExplorerConfig config_;
+  Ensemble* ensemble_;
+  std::vector<Slot> slots_;
+  int next_index_;
+  std::vector<ExploreResult> results_;
+
+  Explorer(const Explorer&);  // Undefined.
+  Explorer& operator =(const Explorer&);  // Undefined.
+};
+
+#endif  // EXPLORER_H_
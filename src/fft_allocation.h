@@ -36,9 +36,11 @@ class FftAllocation {
     data_ = static_cast<T*>(fftw_malloc(sizeof(T) * count_));
   }
 
+  // The r2c transform of a row-major |size| buffer: |size.height()| rows of
+  // |size.width() / 2 + 1| values.
   FftAllocation(const pp::Size& size, ReduceSizeForComplex)
       : size_(size) {
-    count_ = size.width() * (size.height() / 2 + 1);
+    count_ = size.height() * (size.width() / 2 + 1);
     data_ = static_cast<T*>(fftw_malloc(sizeof(T) * count_));
   }
 
@@ -80,6 +82,7 @@ class FftAllocation {
   size_t count_;
 };
 
+typedef FftAllocation<uint16_t> AlignedUint16s;
 typedef FftAllocation<uint32_t> AlignedUint32;
 typedef FftAllocation<real> AlignedReals;
 typedef FftAllocation<float> AlignedFloats;
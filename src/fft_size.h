@@ -0,0 +1,45 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FFT_SIZE_H_
+#define FFT_SIZE_H_
+
+#include <limits.h>
+
+// FFTW is fastest for sizes whose prime factors are all small; a prime size
+// can be an order of magnitude slower than its neighbors.
+inline bool IsFastFftSize(int n) {
+  if (n < 1)
+    return false;
+  static const int kFactors[] = {2, 3, 5, 7};
+  for (int i = 0; i < 4; ++i) {
+    while (n % kFactors[i] == 0)
+      n /= kFactors[i];
+  }
+  return n == 1;
+}
+
+// Returns the fast size closest to |n|, preferring the larger one on a tie.
+inline int NearestFastFftSize(int n) {
+  if (n <= 1)
+    return 1;
+  for (int d = 0;; ++d) {
+    if (d <= INT_MAX - n && IsFastFftSize(n + d))
+      return n + d;
+    if (IsFastFftSize(n - d))
+      return n - d;
+  }
+}
+
+#endif  // FFT_SIZE_H_
@@ -23,6 +23,7 @@
 #define fftw_complex                   fftwf_complex
 #define fftw_destroy_plan              fftwf_destroy_plan
 #define fftw_execute                   fftwf_execute
+#define fftw_execute_dft_r2c           fftwf_execute_dft_r2c
 #define fftw_free                      fftwf_free
 #define fftw_import_wisdom_from_string fftwf_import_wisdom_from_string
 #define fftw_init_threads              fftwf_init_threads
@@ -30,6 +31,8 @@
 #define fftw_plan                      fftwf_plan
 #define fftw_plan_dft_c2r_2d           fftwf_plan_dft_c2r_2d
 #define fftw_plan_dft_r2c_2d           fftwf_plan_dft_r2c_2d
+#define fftw_plan_many_dft_c2r         fftwf_plan_many_dft_c2r
+#define fftw_plan_many_dft_r2c         fftwf_plan_many_dft_r2c
 #define fftw_plan_with_nthreads        fftwf_plan_with_nthreads
 
 #else
@@ -38,6 +41,7 @@
 #define fftw_complex                   fftw_complex
 #define fftw_destroy_plan              fftw_destroy_plan
 #define fftw_execute                   fftw_execute
+#define fftw_execute_dft_r2c           fftw_execute_dft_r2c
 #define fftw_free                      fftw_free
 #define fftw_import_wisdom_from_string fftw_import_wisdom_from_string
 #define fftw_init_threads              fftw_init_threads
@@ -45,6 +49,8 @@
 #define fftw_plan                      fftw_plan
 #define fftw_plan_dft_c2r_2d           fftw_plan_dft_c2r_2d
 #define fftw_plan_dft_r2c_2d           fftw_plan_dft_r2c_2d
+#define fftw_plan_many_dft_c2r         fftw_plan_many_dft_c2r
+#define fftw_plan_many_dft_r2c         fftw_plan_many_dft_r2c
 #define fftw_plan_with_nthreads        fftw_plan_with_nthreads
 
 #endif
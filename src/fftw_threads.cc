@@ -0,0 +1,37 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "fftw_threads.h"
+
+#include <assert.h>
+
+#include "check.h"
+#include "fftw.h"
+
+namespace {
+
+int user_count = 0;
+
+}  // namespace
+
+void AcquireFftwThreads() {
+  if (user_count++ == 0)
+    CHECK(fftw_init_threads());
+}
+
+void ReleaseFftwThreads() {
+  assert(user_count > 0);
+  if (--user_count == 0)
+    fftw_cleanup_threads();
+}
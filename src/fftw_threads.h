@@ -0,0 +1,29 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FFTW_THREADS_H_
+#define FFTW_THREADS_H_
+
+// FFTW's thread support is process-wide, and cleaning it up while any plan
+// made with it still exists is undefined. Simulations, ensembles and
+// multi-channel worlds may be alive at the same time, so each acquires it
+// when it is made and releases it when it is destroyed; it is only set up
+// by the first and torn down by the last. Call these from one thread.
+//
+// fftw_plan_with_nthreads() is process-wide too, so it must be set before
+// each plan is made.
+void AcquireFftwThreads();
+void ReleaseFftwThreads();
+
+#endif  // FFTW_THREADS_H_
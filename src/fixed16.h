@@ -0,0 +1,43 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FIXED16_H_
+#define FIXED16_H_
+
+#include <stdint.h>
+
+// The world state is always clamped to [0, 1], so it can be stored as
+// unsigned 16-bit fixed point: 0 maps to 0.0 and 65535 maps to 1.0.
+const int kFixed16Max = 65535;
+
+inline uint16_t PackFixed16(real x) {
+  if (x <= 0)
+    return 0;
+  if (x >= 1)
+    return kFixed16Max;
+  return static_cast<uint16_t>(x * kFixed16Max + 0.5);
+}
+
+inline real UnpackFixed16(uint16_t x) {
+  return x * (static_cast<real>(1) / kFixed16Max);
+}
+
+// Overloads so that templates can read and write either representation of the
+// state. The second argument of StoreState only selects the return type.
+inline real LoadState(real x) { return x; }
+inline real LoadState(uint16_t x) { return UnpackFixed16(x); }
+inline real StoreState(real x, const real*) { return x; }
+inline uint16_t StoreState(real x, const uint16_t*) { return PackFixed16(x); }
+
+#endif  // FIXED16_H_
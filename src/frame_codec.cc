@@ -0,0 +1,216 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "frame_codec.h"
+
+#include <algorithm>
+
+namespace {
+
+// Written in place of the Rice parameter for a block of zeros.
+const uint32_t kZeroBlock = 31;
+const int kParameterBits = 5;
+// Quotients this large are escaped, and the value is stored as is, so one
+// outlier can't cost thousands of bits.
+const uint32_t kMaxQuotient = 24;
+
+class BitWriter {
+ public:
+  explicit BitWriter(std::vector<uint8_t>* out) : out_(out), bits_(0),
+                                                  count_(0) {}
+
+  // |count| must be at most 32.
+  void Write(uint32_t value, int count) {
+    bits_ |= static_cast<uint64_t>(value) << count_;
+    count_ += count;
+    while (count_ >= 8) {
+      out_->push_back(static_cast<uint8_t>(bits_));
+      bits_ >>= 8;
+      count_ -= 8;
+    }
+  }
+
+  void Flush() {
+    if (count_ > 0)
+      out_->push_back(static_cast<uint8_t>(bits_));
+    bits_ = 0;
+    count_ = 0;
+  }
+
+ private:
+  std::vector<uint8_t>* out_;
+  uint64_t bits_;
+  int count_;
+};
+
+class BitReader {
+ public:
+  BitReader(const uint8_t* data, size_t size)
+      : data_(data), end_(data + size), bits_(0), count_(0),
+        overrun_(false) {}
+
+  // |count| must be at most 32.
+  uint32_t Read(int count) {
+    Fill();
+    uint64_t mask = (static_cast<uint64_t>(1) << count) - 1;
+    uint32_t value = static_cast<uint32_t>(bits_ & mask);
+    if (count > count_)
+      overrun_ = true;
+    bits_ >>= count;
+    count_ -= count;
+    return value;
+  }
+
+  // Reads ones up to and including the next zero, or |max| ones. |max| must
+  // be less than 32.
+  uint32_t ReadUnary(uint32_t max) {
+    Fill();
+    // Bits past the end of the data are zero, so this always terminates.
+    uint32_t ones = __builtin_ctzll(~bits_);
+    if (ones >= max) {
+      Read(max);
+      return max;
+    }
+    Read(ones + 1);
+    return ones;
+  }
+
+  bool overrun() const { return overrun_; }
+
+ private:
+  void Fill() {
+    while (count_ <= 56) {
+      if (data_ == end_) {
+        // Pad with zeros; reading them sets overrun_.
+        if (count_ < 0)
+          count_ = 0;
+        return;
+      }
+      bits_ |= static_cast<uint64_t>(*data_++) << count_;
+      count_ += 8;
+    }
+  }
+
+  const uint8_t* data_;
+  const uint8_t* end_;
+  uint64_t bits_;
+  int count_;
+  bool overrun_;
+};
+
+// Maps prediction errors, mod 2^16, to small values for small magnitudes:
+// 0, -1, 1, -2, ... become 0, 1, 2, 3, ...
+inline uint16_t ZigZag(uint16_t value, uint16_t prediction) {
+  int16_t error = static_cast<int16_t>(value - prediction);
+  return static_cast<uint16_t>((error << 1) ^ (error >> 15));
+}
+
+inline uint16_t UnZigZag(uint16_t code, uint16_t prediction) {
+  uint16_t error = static_cast<uint16_t>((code >> 1) ^ -(code & 1));
+  return static_cast<uint16_t>(prediction + error);
+}
+
+// Picks the Rice parameter for a block whose codes sum to |sum|: about
+// log2 of the mean code.
+uint32_t RiceParameter(uint32_t sum, int count) {
+  uint32_t k = 0;
+  while (k < 15 && (static_cast<uint32_t>(count) << (k + 1)) <= sum)
+    ++k;
+  return k;
+}
+
+}  // namespace
+
+void EncodeFrame(FrameType type, const uint16_t* frame,
+                 const uint16_t* previous, int count,
+                 std::vector<uint8_t>* out) {
+  BitWriter writer(out);
+  uint16_t codes[kCodecBlockSize];
+  uint16_t last = 0;
+  for (int begin = 0; begin < count; begin += kCodecBlockSize) {
+    int block_count = std::min(kCodecBlockSize, count - begin);
+    const uint16_t* values = frame + begin;
+    uint32_t sum = 0;
+    if (type == FRAME_TYPE_KEY) {
+      for (int i = 0; i < block_count; ++i) {
+        codes[i] = ZigZag(values[i], last);
+        last = values[i];
+        sum += codes[i];
+      }
+    } else {
+      const uint16_t* predictions = previous + begin;
+      for (int i = 0; i < block_count; ++i) {
+        codes[i] = ZigZag(values[i], predictions[i]);
+        sum += codes[i];
+      }
+    }
+
+    if (sum == 0) {
+      writer.Write(kZeroBlock, kParameterBits);
+      continue;
+    }
+
+    uint32_t k = RiceParameter(sum, block_count);
+    writer.Write(k, kParameterBits);
+    for (int i = 0; i < block_count; ++i) {
+      uint32_t quotient = codes[i] >> k;
+      if (quotient >= kMaxQuotient) {
+        writer.Write((1u << kMaxQuotient) - 1, kMaxQuotient);
+        writer.Write(codes[i], 16);
+      } else {
+        // |quotient| ones, then a zero.
+        writer.Write((1u << quotient) - 1, quotient + 1);
+        writer.Write(codes[i] & ((1u << k) - 1), k);
+      }
+    }
+  }
+  writer.Flush();
+}
+
+bool DecodeFrame(FrameType type, const uint8_t* data, size_t size,
+                 int count, uint16_t* frame) {
+  BitReader reader(data, size);
+  uint16_t last = 0;
+  for (int begin = 0; begin < count; begin += kCodecBlockSize) {
+    int block_count = std::min(kCodecBlockSize, count - begin);
+    uint16_t* values = frame + begin;
+    uint32_t k = reader.Read(kParameterBits);
+    if (k == kZeroBlock) {
+      if (type == FRAME_TYPE_KEY)
+        std::fill(values, values + block_count, last);
+      continue;
+    }
+    if (k > 15)
+      return false;
+
+    for (int i = 0; i < block_count; ++i) {
+      uint32_t quotient = reader.ReadUnary(kMaxQuotient);
+      uint16_t code;
+      if (quotient == kMaxQuotient)
+        code = static_cast<uint16_t>(reader.Read(16));
+      else
+        code = static_cast<uint16_t>((quotient << k) | reader.Read(k));
+
+      if (type == FRAME_TYPE_KEY) {
+        last = UnZigZag(code, last);
+        values[i] = last;
+      } else {
+        values[i] = UnZigZag(code, values[i]);
+      }
+    }
+    if (reader.overrun())
+      return false;
+  }
+  return !reader.overrun();
+}
@@ -0,0 +1,49 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FRAME_CODEC_H_
+#define FRAME_CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Lossless compression of 16-bit fixed point states (see fixed16.h), for
+// recordings.
+//
+// Each value is predicted, and the prediction error is Rice coded in blocks
+// of kCodecBlockSize values that share a Rice parameter. A keyframe predicts
+// each value from the one before it; a delta frame predicts it from the same
+// cell of the previous frame, so the parts of the world that don't change
+// cost 5 bits per block.
+const int kCodecBlockSize = 64;
+
+enum FrameType {
+  FRAME_TYPE_KEY,
+  FRAME_TYPE_DELTA
+};
+
+// Appends the encoding of |frame|, |count| values, to |out|. |previous| is
+// only used for delta frames.
+void EncodeFrame(FrameType type, const uint16_t* frame,
+                 const uint16_t* previous, int count,
+                 std::vector<uint8_t>* out);
+
+// Decodes |size| bytes into |frame|, |count| values. For delta frames,
+// |frame| must hold the previous frame, and is updated in place. Returns
+// false if the data is truncated or invalid.
+bool DecodeFrame(FrameType type, const uint8_t* data, size_t size,
+                 int count, uint16_t* frame);
+
+#endif  // FRAME_CODEC_H_
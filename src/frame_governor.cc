@@ -0,0 +1,146 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "frame_governor.h"
+
+#include <algorithm>
+
+namespace {
+
+const double kDefaultBudgetMs = 1000.0 / 60;
+const double kRenderScales[FrameGovernor::kRenderScaleCount] = {1, 0.75, 0.5};
+const double kGridScales[FrameGovernor::kGridScaleCount] = {1, 0.75, 0.5};
+// Weight of the newest frame in the moving averages.
+const double kAverageWeight = 0.1;
+// Frames to wait after a decision, or at startup, before the next one.
+const int kFramesPerDecision = 30;
+// Frames slower than budget * kLowerThreshold lower the quality. Quality is
+// only raised when the busy time (stepping and rendering) is below
+// budget * kRaiseThreshold; the frame time can't be used for this, since it
+// never drops below the display refresh interval.
+const double kLowerThreshold = 1.15;
+const double kRaiseThreshold = 0.5;
+
+}  // namespace
+
+FrameGovernor::FrameGovernor()
+    : budget_ms_(kDefaultBudgetMs),
+      max_steps_per_frame_(1),
+      max_filter_(RENDER_FILTER_NEAREST),
+      steps_per_frame_(1),
+      filter_(RENDER_FILTER_NEAREST),
+      render_scale_index_(0),
+      grid_resize_(false),
+      grid_scale_index_(0),
+      frame_ms_(0),
+      step_ms_(0),
+      render_ms_(0),
+      frames_(0),
+      reason_("") {
+}
+
+void FrameGovernor::SetBudget(double budget_ms) {
+  budget_ms_ = budget_ms;
+  frames_ = 0;
+}
+
+void FrameGovernor::SetLimits(int max_steps_per_frame,
+                              RenderFilter max_filter) {
+  max_steps_per_frame_ = std::max(1, max_steps_per_frame);
+  max_filter_ = max_filter;
+  steps_per_frame_ = std::min(steps_per_frame_, max_steps_per_frame_);
+  filter_ = std::min(filter_, max_filter_);
+  frames_ = 0;
+}
+
+void FrameGovernor::SetGridResize(bool allowed) {
+  grid_resize_ = allowed;
+  if (!allowed)
+    grid_scale_index_ = 0;
+  frames_ = 0;
+}
+
+double FrameGovernor::render_scale() const {
+  return kRenderScales[render_scale_index_];
+}
+
+double FrameGovernor::grid_scale() const {
+  return kGridScales[grid_scale_index_];
+}
+
+bool FrameGovernor::AddFrame(double frame_ms, double step_ms, int steps,
+                             double render_ms) {
+  double step_ms_per_step = steps > 0 ? step_ms / steps : step_ms_;
+  if (frames_ == 0 && frame_ms_ == 0) {
+    frame_ms_ = frame_ms;
+    step_ms_ = step_ms_per_step;
+    render_ms_ = render_ms;
+  } else {
+    frame_ms_ += kAverageWeight * (frame_ms - frame_ms_);
+    step_ms_ += kAverageWeight * (step_ms_per_step - step_ms_);
+    render_ms_ += kAverageWeight * (render_ms - render_ms_);
+  }
+
+  if (++frames_ < kFramesPerDecision)
+    return false;
+
+  bool changed = false;
+  double busy_ms = step_ms_ * steps_per_frame_ + render_ms_;
+  if (frame_ms_ > budget_ms_ * kLowerThreshold)
+    changed = Lower();
+  else if (busy_ms < budget_ms_ * kRaiseThreshold)
+    changed = Raise();
+
+  if (changed)
+    frames_ = 0;
+  return changed;
+}
+
+bool FrameGovernor::Lower() {
+  if (steps_per_frame_ > 1) {
+    steps_per_frame_--;
+    reason_ = "over budget: fewer steps per frame";
+  } else if (filter_ > RENDER_FILTER_NEAREST) {
+    filter_ = static_cast<RenderFilter>(filter_ - 1);
+    reason_ = "over budget: cheaper filter";
+  } else if (render_scale_index_ < kRenderScaleCount - 1) {
+    render_scale_index_++;
+    reason_ = "over budget: lower render resolution";
+  } else if (grid_resize_ && grid_scale_index_ < kGridScaleCount - 1) {
+    grid_scale_index_++;
+    reason_ = "over budget: smaller grid";
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool FrameGovernor::Raise() {
+  if (grid_scale_index_ > 0) {
+    grid_scale_index_--;
+    reason_ = "under budget: larger grid";
+  } else if (render_scale_index_ > 0) {
+    render_scale_index_--;
+    reason_ = "under budget: higher render resolution";
+  } else if (filter_ < max_filter_) {
+    filter_ = static_cast<RenderFilter>(filter_ + 1);
+    reason_ = "under budget: better filter";
+  } else if (steps_per_frame_ < max_steps_per_frame_) {
+    steps_per_frame_++;
+    reason_ = "under budget: more steps per frame";
+  } else {
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,79 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FRAME_GOVERNOR_H_
+#define FRAME_GOVERNOR_H_
+
+#include "renderer.h"
+
+// Picks the simulation steps per frame, render filter, render scale and
+// (optionally) grid scale that keep the frame time within a budget. Quality
+// is lowered in that order when frames are too slow, and raised in the
+// reverse order when there is room.
+// Only one setting changes per decision, and decisions are spaced out so the
+// averages can settle in between.
+class FrameGovernor {
+ public:
+  static const int kRenderScaleCount = 3;
+  static const int kGridScaleCount = 3;
+
+  FrameGovernor();
+
+  double budget_ms() const { return budget_ms_; }
+  void SetBudget(double budget_ms);
+  // The most steps per frame and the best filter the governor may choose.
+  void SetLimits(int max_steps_per_frame, RenderFilter max_filter);
+  // Allows shrinking the simulation grid; off by default, since it changes
+  // the simulation itself.
+  void SetGridResize(bool allowed);
+
+  // Records one displayed frame. |frame_ms| is the time since the previous
+  // frame started, |step_ms| the time spent on its |steps| simulation steps,
+  // and |render_ms| the time spent rendering it. Returns true if any setting
+  // changed; reason() then describes the change.
+  bool AddFrame(double frame_ms, double step_ms, int steps, double render_ms);
+
+  int steps_per_frame() const { return steps_per_frame_; }
+  RenderFilter filter() const { return filter_; }
+  // The fraction of the view's resolution to render at.
+  double render_scale() const;
+  // The fraction of the chosen grid size to simulate at.
+  double grid_scale() const;
+  const char* reason() const { return reason_; }
+
+  double average_frame_ms() const { return frame_ms_; }
+  double average_step_ms() const { return step_ms_; }
+  double average_render_ms() const { return render_ms_; }
+
+ private:
+  bool Lower();
+  bool Raise();
+
+  double budget_ms_;
+  int max_steps_per_frame_;
+  RenderFilter max_filter_;
+  int steps_per_frame_;
+  RenderFilter filter_;
+  int render_scale_index_;
+  bool grid_resize_;
+  int grid_scale_index_;
+  // Moving averages. step_ms_ is per step.
+  double frame_ms_;
+  double step_ms_;
+  double render_ms_;
+  int frames_;
+  const char* reason_;
+};
+
+#endif  // FRAME_GOVERNOR_H_
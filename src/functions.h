@@ -21,4 +21,8 @@ real func_hermite(real x, real a, real ea);
 real func_sin(real x, real a, real ea);
 real func_smooth(real x, real a, real ea);
 
+inline real clamp01(real x) {
+  return x > 1.0 ? 1.0 : x < 0.0 ? 0.0 : x;
+}
+
 #endif  // FUNCTIONS_H_
@@ -0,0 +1,774 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Runs the simulation without ppapi, on the host. Checkpoints are mmap'd, so
+// loading and saving them costs one copy of the state.
+//
+// Usage:
+//   headless [options] <in.checkpoint> <out.checkpoint> <steps>
+//     --threads N            Simulate with N threads.
+//     --record FILE          Record every step; see recorder.h.
+//     --precision BITS       Bits kept per recorded value, 8 to 16.
+//     --keyframe-interval N  Frames between recording keyframes.
+//     --export FILE          Render frames to FILE, or - for stdout; the
+//                            status lines then go to stderr.
+//     --format y4m|rgba      The export format; see video_writer.h.
+//     --export-size WxH      The export resolution; the grid size by default.
+//     --fps N                The frame rate written to the Y4M header.
+//     --frame-steps N        Steps between exported frames.
+//     --filter N             0, 1 or 2 for nearest, bilinear or bicubic.
+//   headless --play FILE     Decode a whole recording, and report its size
+//                            and decoding speed.
+//   headless [--threads N] --replay FILE
+//                            Repeat the work in a replay log (see
+//                            replay_log.h), check that every frame's hash
+//                            matches the logged one, and report the timing.
+//   headless [--threads N] --ensemble N <in.checkpoint> <steps>
+//                            Step N copies of a checkpoint as an ensemble
+//                            (see ensemble.h), then as N simulations, and
+//                            compare their speed and final hashes.
+//   headless [--threads N] --explore N RESULTS
+//                            Run N random rules (see explorer.h), and write
+//                            their classes and scores to RESULTS, a
+//                            tab-separated table, best first.
+//     --explore-size WxH     The world size; 128x128 by default.
+//     --explore-steps N      Steps before a run that hasn't settled stops.
+//     --batch N              Runs stepped together.
+//     --seed N               Picks the rules; the same seed, size and run
+//                            count give the same results.
+//   headless [--threads N] [--channel-size WxH] [--kernels K]
+//            --channels C <steps>
+//                            Step multi-channel worlds (see
+//                            multi_channel.h) of 1 to C channels, every
+//                            channel seeing every other through K kernels,
+//                            and report how the cost grows with C.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "checkpoint.h"
+#include "ensemble.h"
+#include "explorer.h"
+#include "multi_channel.h"
+#include "palette.h"
+#include "recorder.h"
+#include "recording_player.h"
+#include "renderer.h"
+#include "replay_log.h"
+#include "simulation.h"
+#include "simulation_config.h"
+#include "video_writer.h"
+#include "world.h"
+
+namespace {
+
+double NowMs() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+// A read-only mapping of a whole file.
+class MappedFile {
+ public:
+  MappedFile() : data_(MAP_FAILED), size_(0) {}
+
+  ~MappedFile() {
+    if (data_ != MAP_FAILED)
+      munmap(data_, size_);
+  }
+
+  bool Open(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+      return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      size_ = st.st_size;
+      data_ = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    return data_ != MAP_FAILED;
+  }
+
+  const void* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  void* data_;
+  size_t size_;
+
+  MappedFile(const MappedFile&);  // Undefined.
+  MappedFile& operator =(const MappedFile&);  // Undefined.
+};
+
+class FileRecordingSink : public RecordingSink {
+ public:
+  explicit FileRecordingSink(FILE* file) : file_(file), ok_(true) {}
+
+  // False once any write has failed; later writes are skipped.
+  bool ok() const { return ok_; }
+
+  virtual void Write(const void* data, size_t size) {
+    if (ok_)
+      ok_ = fwrite(data, 1, size, file_) == size;
+  }
+
+ private:
+  FILE* file_;
+  bool ok_;
+};
+
+bool WriteCheckpoint(const char* path, const Simulation& simulation,
+                     const CheckpointPalette& palette) {
+  size_t size = simulation.CheckpointSize();
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return false;
+
+  bool ok = false;
+  if (ftruncate(fd, size) == 0) {
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data != MAP_FAILED) {
+      simulation.SaveCheckpoint(data);
+      static_cast<CheckpointHeader*>(data)->palette = palette;
+      ok = munmap(data, size) == 0;
+    }
+  }
+  close(fd);
+  return ok;
+}
+
+// Fits the whole grid to the screen, keeping the aspect ratio and wrapping
+// in the longer dimension, like the app does.
+void FitRenderer(const pp::Size& buffer_size, const pp::Size& screen_size,
+                 Renderer* renderer) {
+  if (buffer_size.width() * screen_size.height() >
+      buffer_size.height() * screen_size.width()) {
+    renderer->SetScale(buffer_size, screen_size, buffer_size.width(),
+                       screen_size.width());
+  } else {
+    renderer->SetScale(buffer_size, screen_size, buffer_size.height(),
+                       screen_size.height());
+  }
+}
+
+void ExportFrame(Simulation* simulation, Renderer* renderer,
+                 const Palette& palette, VideoWriter* writer) {
+  uint32_t* pixels = writer->BeginFrame();
+  if (simulation->compact())
+    renderer->Render(simulation->display_buffer(), palette, pixels);
+  else
+    renderer->Render(simulation->buffer(), palette, pixels);
+  writer->EndFrame();
+}
+
+bool ParseSize(const char* s, pp::Size* size) {
+  int width;
+  int height;
+  if (sscanf(s, "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+    return false;
+  *size = pp::Size(width, height);
+  return true;
+}
+
+SimulationConfig MakeSimulationConfig(const CheckpointHeader& header,
+                                      int thread_count) {
+  SimulationConfig config(thread_count,
+                          pp::Size(header.width, header.height));
+  config.compact_state = header.state_format == CHECKPOINT_STATE_FIXED16;
+  config.kernel_config = GetCheckpointKernel(header);
+  config.smoother_config = GetCheckpointSmoother(header);
+  return config;
+}
+
+int Usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--threads N] [--record FILE] [--precision BITS] "
+          "[--keyframe-interval N] [--export FILE] [--format y4m|rgba] "
+          "[--export-size WxH] [--fps N] [--frame-steps N] [--filter N] "
+          "<in.checkpoint> <out.checkpoint> <steps>\n"
+          "       %s --play FILE\n"
+          "       %s [--threads N] --replay FILE\n"
+          "       %s [--threads N] --ensemble N <in.checkpoint> <steps>\n"
+          "       %s [--threads N] [--explore-size WxH] [--explore-steps N] "
+          "[--batch N] [--seed N] --explore N RESULTS\n"
+          "       %s [--threads N] [--channel-size WxH] [--kernels K] "
+          "--channels C <steps>\n",
+          program, program, program, program, program, program);
+  return 1;
+}
+
+int Play(const char* path) {
+  MappedFile file;
+  RecordingPlayer player;
+  if (!file.Open(path) || !player.Open(file.data(), file.size())) {
+    fprintf(stderr, "Unable to read recording %s.\n", path);
+    return 1;
+  }
+
+  double start_ms = NowMs();
+  int frame_count = player.frame_count();
+  for (int i = 0; i < frame_count; ++i) {
+    if (!player.Seek(i)) {
+      fprintf(stderr, "Frame %d is corrupt.\n", i);
+      return 1;
+    }
+  }
+  double elapsed_ms = NowMs() - start_ms;
+
+  printf("%dx%d: %d frames, %.2f bits/value, decoded in %.1fms "
+         "(%.2fms/frame)\n",
+         player.size().width(), player.size().height(), frame_count,
+         frame_count > 0 ? file.size() * 8.0 / frame_count /
+                               player.size().GetArea()
+                         : 0,
+         elapsed_ms, frame_count > 0 ? elapsed_ms / frame_count : 0);
+  return 0;
+}
+
+// Returns the |percentile|th of |values|, which are sorted.
+double Percentile(const std::vector<double>& values, int percentile) {
+  if (values.empty())
+    return 0;
+  return values[(values.size() - 1) * percentile / 100];
+}
+
+int Replay(const char* path, int thread_count) {
+  MappedFile file;
+  ReplayLogReader reader;
+  if (!file.Open(path) || !reader.Open(file.data(), file.size())) {
+    fprintf(stderr, "Unable to read replay log %s.\n", path);
+    return 1;
+  }
+
+  // The log starts with the world it was made from.
+  ReplayEventType type;
+  const void* payload;
+  size_t size;
+  const CheckpointHeader* header = NULL;
+  if (reader.Next(&type, &payload, &size) &&
+      type == REPLAY_EVENT_CHECKPOINT)
+    header = ReadCheckpointHeader(payload, size);
+  if (!header) {
+    fprintf(stderr, "%s does not start with a checkpoint.\n", path);
+    return 1;
+  }
+
+  Simulation simulation(MakeSimulationConfig(*header, thread_count));
+  simulation.SetStatsEnabled(true);
+  World world(&simulation);
+  world.Apply(type, payload, size);
+
+  std::vector<double> frame_ms;
+  double logged_ms = 0;
+  double step_ms = 0;
+  int step_count = 0;
+  int event_count = 1;
+  int mismatch_count = 0;
+  int first_mismatch = -1;
+  double frame_start_ms = NowMs();
+  double start_ms = frame_start_ms;
+  while (reader.Next(&type, &payload, &size)) {
+    double event_start_ms = NowMs();
+    if (!world.Apply(type, payload, size)) {
+      fprintf(stderr, "Event %d is malformed.\n", event_count);
+      return 1;
+    }
+    event_count++;
+    if (type == REPLAY_EVENT_STEP) {
+      step_ms += NowMs() - event_start_ms;
+      step_count++;
+    } else if (type == REPLAY_EVENT_FRAME) {
+      double now_ms = NowMs();
+      ReplayFrame frame;
+      memcpy(&frame, payload, sizeof(frame));
+      if (frame.hash != simulation.step_stats().hash) {
+        if (mismatch_count++ == 0)
+          first_mismatch = static_cast<int>(frame_ms.size());
+      }
+      frame_ms.push_back(now_ms - frame_start_ms);
+      logged_ms += frame.elapsed_ms;
+      frame_start_ms = now_ms;
+    }
+  }
+  double elapsed_ms = NowMs() - start_ms;
+
+  int frame_count = static_cast<int>(frame_ms.size());
+  printf("%d events, %d frames, %d steps in %.1fms (%.2fms/step)\n",
+         event_count, frame_count, step_count, elapsed_ms,
+         step_count > 0 ? step_ms / step_count : 0);
+  if (frame_count > 0) {
+    std::sort(frame_ms.begin(), frame_ms.end());
+    printf("frame ms: mean %.2f, median %.2f, p95 %.2f, max %.2f; "
+           "logged mean %.2f\n",
+           (frame_start_ms - start_ms) / frame_count,
+           Percentile(frame_ms, 50), Percentile(frame_ms, 95),
+           frame_ms.back(), logged_ms / frame_count);
+  }
+  if (mismatch_count > 0) {
+    printf("%d of %d frame hashes differ, the first at frame %d.\n",
+           mismatch_count, frame_count, first_mismatch);
+    return 1;
+  }
+  printf("All %d frame hashes match; final hash %08x.\n", frame_count,
+         simulation.step_stats().hash);
+  return 0;
+}
+
+// The checkpoint is loaded once per simulation, and copied into every world
+// of the ensemble. The ensemble always uses the Euler integrator, so the
+// hashes only match for checkpoints that do too.
+int RunEnsemble(const char* path, int steps, int world_count,
+                int thread_count) {
+  MappedFile in;
+  if (!in.Open(path)) {
+    fprintf(stderr, "Unable to read %s.\n", path);
+    return 1;
+  }
+  const CheckpointHeader* header =
+      ReadCheckpointHeader(in.data(), in.size());
+  if (!header) {
+    fprintf(stderr, "%s is not a valid checkpoint.\n", path);
+    return 1;
+  }
+
+  SimulationConfig simulation_config =
+      MakeSimulationConfig(*header, thread_count);
+  simulation_config.compact_state = false;
+  std::vector<Simulation*> simulations(world_count);
+  for (int i = 0; i < world_count; ++i) {
+    simulations[i] = new Simulation(simulation_config);
+    simulations[i]->SetStatsEnabled(true);
+    simulations[i]->LoadCheckpoint(in.data(), in.size());
+  }
+
+  EnsembleConfig config(thread_count, simulation_config.size, world_count);
+  config.kernel_config = simulation_config.kernel_config;
+  config.smoother_config = simulation_config.smoother_config;
+  Ensemble ensemble(config);
+  ensemble.SetStatsEnabled(true);
+  for (int i = 0; i < world_count; ++i) {
+    memcpy(ensemble.state(i), simulations[i]->buffer().data(),
+           simulations[i]->buffer().byte_size());
+  }
+
+  double start_ms = NowMs();
+  for (int i = 0; i < steps; ++i)
+    ensemble.Step();
+  double ensemble_ms = NowMs() - start_ms;
+
+  start_ms = NowMs();
+  for (int i = 0; i < steps; ++i) {
+    for (int j = 0; j < world_count; ++j)
+      simulations[j]->Step();
+  }
+  double simulations_ms = NowMs() - start_ms;
+
+  int mismatch_count = 0;
+  for (int i = 0; i < world_count; ++i) {
+    if (ensemble.step_stats(i).hash != simulations[i]->step_stats().hash)
+      mismatch_count++;
+    delete simulations[i];
+  }
+
+  int world_steps = world_count * steps;
+  printf("%d worlds of %dx%d, %d steps each\n", world_count, header->width,
+         header->height, steps);
+  printf("ensemble:    %.1fms (%.0f world steps/s)\n", ensemble_ms,
+         world_steps * 1000 / std::max(ensemble_ms, 1e-3));
+  printf("simulations: %.1fms (%.0f world steps/s); the ensemble is "
+         "%.2fx as fast\n", simulations_ms,
+         world_steps * 1000 / std::max(simulations_ms, 1e-3),
+         simulations_ms / std::max(ensemble_ms, 1e-3));
+  // Batched transforms may round differently, and chaotic worlds amplify
+  // that, so this is reported rather than treated as an error.
+  if (mismatch_count > 0)
+    printf("%d of %d final hashes differ.\n", mismatch_count, world_count);
+  else
+    printf("All %d final hashes match.\n", world_count);
+  return 0;
+}
+
+bool HigherScore(const ExploreResult& a, const ExploreResult& b) {
+  if (a.score != b.score)
+    return a.score > b.score;
+  return a.index < b.index;
+}
+
+bool WriteExploreResults(const char* path,
+                         std::vector<ExploreResult> results) {
+  FILE* file = fopen(path, "w");
+  if (!file)
+    return false;
+
+  std::sort(results.begin(), results.end(), HigherScore);
+  fprintf(file, "index\tclass\tscore\tsteps\tdensity\tmass_variation\t"
+          "motion\tdisc_radius\tring_radius\tblend_radius\ttimestep\tdt\t"
+          "b1\td1\tb2\td2\tmode\tsigmoid\tmix\tsn\tsm\tseed\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const ExploreResult& r = results[i];
+    const SmootherConfig& s = r.smoother;
+    fprintf(file, "%d\t%s\t%.4f\t%d\t%.4f\t%.4f\t%.4f\t%.3f\t%.3f\t%.3f\t"
+            "%d\t%.4f\t%.4f\t%.4f\t%.4f\t%.4f\t%d\t%d\t%d\t%.4f\t%.4f\t"
+            "%llu\n",
+            r.index, GetExploreClassName(r.explore_class), r.score, r.steps,
+            r.density, r.mass_variation, r.motion, r.kernel.disc_radius,
+            r.kernel.ring_radius, r.kernel.blend_radius, s.timestep.type,
+            s.timestep.dt, s.b1, s.d1, s.b2, s.d2, s.mode, s.sigmoid, s.mix,
+            s.sn, s.sm, static_cast<unsigned long long>(r.seed));
+  }
+  return fclose(file) == 0;
+}
+
+int Explore(const ExplorerConfig& config, const char* results_path) {
+  Explorer explorer(config);
+  size_t reported = 0;
+  double start_ms = NowMs();
+  while (explorer.Step()) {
+    // Progress goes to stderr, about every 1% of the runs.
+    size_t finished = explorer.results().size();
+    if (finished - reported >=
+        std::max<size_t>(1, config.run_count / 100)) {
+      fprintf(stderr, "\r%d/%d runs", static_cast<int>(finished),
+              config.run_count);
+      reported = finished;
+    }
+  }
+  double elapsed_ms = NowMs() - start_ms;
+  fprintf(stderr, "\n");
+
+  const std::vector<ExploreResult>& results = explorer.results();
+  int counts[EXPLORE_GLIDERS + 1] = {0};
+  int step_count = 0;
+  for (size_t i = 0; i < results.size(); ++i) {
+    counts[results[i].explore_class]++;
+    step_count += results[i].steps;
+  }
+  printf("%d runs of %dx%d, %d steps in %.1fs (%.1f runs/s)\n",
+         config.run_count, config.size.width(), config.size.height(),
+         step_count, elapsed_ms / 1000,
+         config.run_count * 1000 / std::max(elapsed_ms, 1e-3));
+  for (int i = 0; i <= EXPLORE_GLIDERS; ++i) {
+    printf("%s: %d\n", GetExploreClassName(static_cast<ExploreClass>(i)),
+           counts[i]);
+  }
+
+  if (!WriteExploreResults(results_path, results)) {
+    fprintf(stderr, "Unable to write %s.\n", results_path);
+    return 1;
+  }
+  return 0;
+}
+
+// A rule where every channel sees every channel through every kernel, with
+// random weights, so each step makes all C * K inputs. The kernels are
+// Gaussian shells of growing radius, scaled with the width.
+MultiChannelConfig MakeChannelBenchmark(int thread_count,
+                                        const pp::Size& size,
+                                        int channel_count,
+                                        int kernel_count) {
+  MultiChannelConfig config(thread_count, size, channel_count);
+  real radius = size.width() / 20.0;
+  for (int k = 0; k < kernel_count; ++k) {
+    KernelProfile profile;
+    KernelShell shell;
+    shell.type = KERNEL_SHELL_GAUSSIAN;
+    shell.radius = radius * (k + 1) / kernel_count;
+    shell.width = radius / 4;
+    profile.shells.push_back(shell);
+    profile.growth.weight = 1.0 / kernel_count;
+    config.kernel_set.profiles.push_back(profile);
+  }
+
+  // Each input's weights add up to 1, so it stays in [0, 1].
+  Rng rng(1);
+  config.weights.resize(channel_count * channel_count * kernel_count);
+  for (int d = 0; d < channel_count; ++d) {
+    for (int k = 0; k < kernel_count; ++k) {
+      real sum = 0;
+      for (int c = 0; c < channel_count; ++c) {
+        real& weight = config.weights[(d * channel_count + c) *
+                                      kernel_count + k];
+        weight = 0.1 + rng.NextUnit();
+        sum += weight;
+      }
+      for (int c = 0; c < channel_count; ++c)
+        config.weights[(d * channel_count + c) * kernel_count + k] /= sum;
+    }
+  }
+  return config;
+}
+
+int RunChannels(int max_channels, int kernel_count, int steps,
+                const pp::Size& size, int thread_count) {
+  double one_channel_ms = 0;
+  for (int c = 1; c <= max_channels; ++c) {
+    MultiChannelSimulation simulation(
+        MakeChannelBenchmark(thread_count, size, c, kernel_count));
+    for (int i = 0; i < c; ++i)
+      simulation.Splat(i);
+
+    double start_ms = NowMs();
+    for (int i = 0; i < steps; ++i)
+      simulation.Step();
+    double step_ms = (NowMs() - start_ms) / steps;
+    if (c == 1)
+      one_channel_ms = step_ms;
+
+    printf("%d channels: %d + %d transforms, %.2fms/step, %.2fms/channel "
+           "(%.2fx one channel)\n", c, c, simulation.input_count(),
+           step_ms, step_ms / c, step_ms / std::max(one_channel_ms, 1e-3));
+  }
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int thread_count = 1;
+  const char* record_path = NULL;
+  int precision = 16;
+  int keyframe_interval = 60;
+  const char* replay_path = NULL;
+  int ensemble_count = 0;
+  const char* explore_path = NULL;
+  ExplorerConfig explorer_config;
+  int channel_count = 0;
+  int kernel_count = 3;
+  pp::Size channel_size(256, 256);
+  const char* export_path = NULL;
+  VideoFormat export_format = VIDEO_FORMAT_Y4M;
+  pp::Size export_size;
+  int fps = 30;
+  int frame_steps = 1;
+  int filter = RENDER_FILTER_NEAREST;
+  const char* paths[3];
+  int path_count = 0;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--play" && has_value) {
+      return Play(argv[i + 1]);
+    } else if (arg == "--replay" && has_value) {
+      replay_path = argv[++i];
+    } else if (arg == "--ensemble" && has_value) {
+      ensemble_count = atoi(argv[++i]);
+    } else if (arg == "--explore" && i + 2 < argc) {
+      explorer_config.run_count = atoi(argv[++i]);
+      explore_path = argv[++i];
+    } else if (arg == "--explore-size" && has_value) {
+      if (!ParseSize(argv[++i], &explorer_config.size))
+        return Usage(argv[0]);
+    } else if (arg == "--explore-steps" && has_value) {
+      explorer_config.max_steps = atoi(argv[++i]);
+    } else if (arg == "--batch" && has_value) {
+      explorer_config.batch_size = atoi(argv[++i]);
+    } else if (arg == "--seed" && has_value) {
+      explorer_config.seed = strtoull(argv[++i], NULL, 10);
+    } else if (arg == "--channels" && has_value) {
+      channel_count = atoi(argv[++i]);
+    } else if (arg == "--kernels" && has_value) {
+      kernel_count = atoi(argv[++i]);
+    } else if (arg == "--channel-size" && has_value) {
+      if (!ParseSize(argv[++i], &channel_size))
+        return Usage(argv[0]);
+    } else if (arg == "--threads" && has_value) {
+      thread_count = atoi(argv[++i]);
+    } else if (arg == "--record" && has_value) {
+      record_path = argv[++i];
+    } else if (arg == "--precision" && has_value) {
+      precision = atoi(argv[++i]);
+    } else if (arg == "--keyframe-interval" && has_value) {
+      keyframe_interval = atoi(argv[++i]);
+    } else if (arg == "--export" && has_value) {
+      export_path = argv[++i];
+    } else if (arg == "--format" && has_value) {
+      std::string format = argv[++i];
+      if (format == "y4m")
+        export_format = VIDEO_FORMAT_Y4M;
+      else if (format == "rgba")
+        export_format = VIDEO_FORMAT_RGBA;
+      else
+        return Usage(argv[0]);
+    } else if (arg == "--export-size" && has_value) {
+      if (!ParseSize(argv[++i], &export_size))
+        return Usage(argv[0]);
+    } else if (arg == "--fps" && has_value) {
+      fps = atoi(argv[++i]);
+    } else if (arg == "--frame-steps" && has_value) {
+      frame_steps = atoi(argv[++i]);
+    } else if (arg == "--filter" && has_value) {
+      filter = atoi(argv[++i]);
+    } else if (arg[0] != '-' && path_count < 3) {
+      paths[path_count++] = argv[i];
+    } else {
+      return Usage(argv[0]);
+    }
+  }
+  if (replay_path && thread_count >= 1)
+    return Replay(replay_path, thread_count);
+  if (explore_path) {
+    explorer_config.thread_count = thread_count;
+    if (thread_count < 1 || explorer_config.run_count < 1 ||
+        explorer_config.batch_size < 1 || explorer_config.max_steps < 1)
+      return Usage(argv[0]);
+    return Explore(explorer_config, explore_path);
+  }
+  if (channel_count > 0) {
+    int steps = path_count == 1 ? atoi(paths[0]) : 0;
+    if (channel_count > kMaxChannels || kernel_count < 1 ||
+        kernel_count > kMaxKernelSetSize || steps < 1 || thread_count < 1)
+      return Usage(argv[0]);
+    return RunChannels(channel_count, kernel_count, steps, channel_size,
+                       thread_count);
+  }
+  if (ensemble_count > 0 && path_count == 2 && thread_count >= 1)
+    return RunEnsemble(paths[0], atoi(paths[1]), ensemble_count,
+                       thread_count);
+  if (path_count < 3 || thread_count < 1 || fps < 1 || frame_steps < 1 ||
+      filter < RENDER_FILTER_NEAREST || filter > RENDER_FILTER_BICUBIC)
+    return Usage(argv[0]);
+
+  // Keep stdout clean when the video is piped through it.
+  bool export_to_stdout = export_path && std::string(export_path) == "-";
+  FILE* log = export_to_stdout ? stderr : stdout;
+
+  const char* in_path = paths[0];
+  const char* out_path = paths[1];
+  int steps = atoi(paths[2]);
+
+  MappedFile in;
+  if (!in.Open(in_path)) {
+    fprintf(stderr, "Unable to read %s.\n", in_path);
+    return 1;
+  }
+  const CheckpointHeader* header =
+      ReadCheckpointHeader(in.data(), in.size());
+  if (!header) {
+    fprintf(stderr, "%s is not a valid checkpoint.\n", in_path);
+    return 1;
+  }
+
+  Simulation simulation(MakeSimulationConfig(*header, thread_count));
+  simulation.SetStatsEnabled(true);
+  if (!simulation.LoadCheckpoint(in.data(), in.size())) {
+    fprintf(stderr, "Unable to load %s.\n", in_path);
+    return 1;
+  }
+
+  FILE* record_file = NULL;
+  FileRecordingSink* record_sink = NULL;
+  Recorder* recorder = NULL;
+  if (record_path) {
+    record_file = fopen(record_path, "wb");
+    if (!record_file) {
+      fprintf(stderr, "Unable to write %s.\n", record_path);
+      return 1;
+    }
+    record_sink = new FileRecordingSink(record_file);
+    recorder = new Recorder(simulation.size(), precision, keyframe_interval,
+                            record_sink);
+  }
+
+  FILE* export_file = NULL;
+  Palette* palette = NULL;
+  Renderer* renderer = NULL;
+  VideoWriter* writer = NULL;
+  if (export_path) {
+    if (export_size.IsEmpty())
+      export_size = simulation.size();
+    if (export_format == VIDEO_FORMAT_Y4M &&
+        (export_size.width() % 2 || export_size.height() % 2)) {
+      fprintf(stderr, "The Y4M export size must be even.\n");
+      return 1;
+    }
+    export_file = export_to_stdout ? stdout : fopen(export_path, "wb");
+    if (!export_file) {
+      fprintf(stderr, "Unable to write %s.\n", export_path);
+      return 1;
+    }
+    palette = new Palette(GetCheckpointPalette(*header), COLOR_FORMAT_RGBA);
+    renderer = new Renderer(simulation.thread_pool());
+    renderer->SetFilter(static_cast<RenderFilter>(filter));
+    FitRenderer(simulation.size(), export_size, renderer);
+    writer = new VideoWriter(export_file, export_format, export_size, fps);
+    ExportFrame(&simulation, renderer, *palette, writer);
+  }
+
+  double start_ms = NowMs();
+  for (int i = 0; i < steps; ++i) {
+    simulation.Step();
+    if (recorder)
+      recorder->AddFrame(simulation.display_buffer().data());
+    if (writer && (i + 1) % frame_steps == 0)
+      ExportFrame(&simulation, renderer, *palette, writer);
+  }
+  double elapsed_ms = NowMs() - start_ms;
+
+  fprintf(log, "%dx%d: %d steps in %.1fms (%.2fms/step), hash %08x\n",
+          header->width, header->height, steps, elapsed_ms,
+          steps > 0 ? elapsed_ms / steps : 0,
+          simulation.step_stats().hash);
+
+  if (recorder) {
+    recorder->Finish();
+    bool ok = record_sink->ok();
+    fprintf(log, "Recorded %d frames; waited %.1fms for the encoder.\n",
+            recorder->frame_count(), recorder->wait_ms());
+    delete recorder;
+    delete record_sink;
+    ok = fclose(record_file) == 0 && ok;
+    if (!ok) {
+      fprintf(stderr, "Unable to write %s.\n", record_path);
+      return 1;
+    }
+  }
+
+  if (writer) {
+    writer->Finish();
+    bool ok = writer->ok();
+    fprintf(log, "Exported %d %dx%d frames; waited %.1fms for the writer.\n",
+            writer->frame_count(), export_size.width(), export_size.height(),
+            writer->wait_ms());
+    delete writer;
+    delete renderer;
+    delete palette;
+    if (!export_to_stdout)
+      ok = fclose(export_file) == 0 && ok;
+    else
+      ok = fflush(export_file) == 0 && ok;
+    if (!ok) {
+      fprintf(stderr, "Unable to write %s.\n", export_path);
+      return 1;
+    }
+  }
+
+  if (!WriteCheckpoint(out_path, simulation, header->palette)) {
+    fprintf(stderr, "Unable to write %s.\n", out_path);
+    return 1;
+  }
+  return 0;
+}
@@ -23,8 +23,9 @@
 namespace {
 
 void FFT(const pp::Size& size, AlignedReals& in, AlignedComplexes* out) {
+  // The buffers are row-major, so rows are the slowest-varying dimension.
   fftw_plan plan = fftw_plan_dft_r2c_2d(
-      size.width(), size.height(), in.data(), out->data(), FFTW_ESTIMATE);
+      size.height(), size.width(), in.data(), out->data(), FFTW_ESTIMATE);
   fftw_execute(plan);
   fftw_destroy_plan(plan);
 }
@@ -0,0 +1,150 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "kernel_set.h"
+
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
+#include "check.h"
+#include "fftw.h"
+#include "functions.h"
+
+namespace {
+
+// Gaussian shells are cut off this many widths from their radius.
+const real kGaussianExtent = 4;
+
+real ShellValue(const KernelShell& shell, real l) {
+  switch (shell.type) {
+    default:
+    case KERNEL_SHELL_RING: {
+      real half_width = shell.width / 2;
+      return shell.weight * func_linear(l, shell.radius - half_width, 1) *
+             (1 - func_linear(l, shell.radius + half_width, 1));
+    }
+    case KERNEL_SHELL_GAUSSIAN: {
+      if (shell.width <= 0)
+        return 0;
+      real x = (l - shell.radius) / shell.width;
+      return shell.weight * exp(-x * x / 2);
+    }
+  }
+}
+
+// The distance beyond which every shell of |profile| is zero.
+real ProfileExtent(const KernelProfile& profile) {
+  real extent = 0;
+  for (size_t i = 0; i < profile.shells.size(); ++i) {
+    const KernelShell& shell = profile.shells[i];
+    if (shell.type == KERNEL_SHELL_GAUSSIAN)
+      extent = std::max(extent, shell.radius + kGaussianExtent * shell.width);
+    else
+      extent = std::max(extent, shell.radius + shell.width / 2 + 1);
+  }
+  return extent;
+}
+
+// Writes |profile| to |out|, a world-sized buffer, centred on the origin and
+// wrapped around the edges like Kernel's. Returns the sum of its values.
+real DrawProfile(const KernelProfile& profile, const pp::Size& size,
+                 real* out) {
+  int width = size.width();
+  int height = size.height();
+  int extent = static_cast<int>(ceil(ProfileExtent(profile)));
+  real sum = 0;
+  std::fill(out, out + size.GetArea(), 0);
+  for (int iy = 0; iy < height; ++iy) {
+    int y = (iy < height / 2) ? iy : iy - height;
+    if (y < -extent || y > extent)
+      continue;
+    for (int ix = 0; ix < width; ++ix) {
+      int x = (ix < width / 2) ? ix : ix - width;
+      if (x < -extent || x > extent)
+        continue;
+      real l = sqrt(static_cast<real>(x * x + y * y));
+      real value = 0;
+      for (size_t i = 0; i < profile.shells.size(); ++i)
+        value += ShellValue(profile.shells[i], l);
+      out[iy * width + ix] = value;
+      sum += value;
+    }
+  }
+  return sum;
+}
+
+}  // namespace
+
+KernelSet::KernelSet(const pp::Size& size)
+    : size_(size),
+      radius_(0),
+      spectra_(pp::Size()) {
+}
+
+void KernelSet::SetSize(const pp::Size& size) {
+  size_ = size;
+  MakeKernels();
+}
+
+void KernelSet::SetConfig(const KernelSetConfig& config) {
+  config_ = config;
+  MakeKernels();
+}
+
+void KernelSet::SetSizeAndConfig(const pp::Size& size,
+                                 const KernelSetConfig& config) {
+  size_ = size;
+  config_ = config;
+  MakeKernels();
+}
+
+void KernelSet::MakeKernels() {
+  int kernel_count = count();
+  pp::Size all_size(size_.width(), size_.height() * kernel_count);
+  AlignedComplexes(all_size, ReduceSizeForComplex()).swap(spectra_);
+  radius_ = 0;
+  for (int k = 0; k < kernel_count; ++k)
+    radius_ = std::max(radius_, ProfileExtent(config_.profiles[k]));
+  if (kernel_count == 0)
+    return;
+
+  int area = size_.GetArea();
+  int spectrum_count = size_.height() * (size_.width() / 2 + 1);
+  AlignedReals kernels(all_size);
+  std::vector<real> sums(kernel_count);
+  for (int k = 0; k < kernel_count; ++k) {
+    sums[k] = DrawProfile(config_.profiles[k], size_,
+                          kernels.data() + k * area);
+  }
+
+  // Like Kernel's transforms, but all of the kernels in one plan.
+  int n[2] = {size_.height(), size_.width()};
+  fftw_plan plan = fftw_plan_many_dft_r2c(
+      2, n, kernel_count, kernels.data(), NULL, 1, area, spectra_.data(),
+      NULL, 1, spectrum_count, FFTW_ESTIMATE);
+  CHECK(plan);
+  fftw_execute(plan);
+  fftw_destroy_plan(plan);
+
+  // An empty kernel stays all zero, rather than dividing by zero.
+  for (int k = 0; k < kernel_count; ++k) {
+    real scale = sums[k] != 0 ? 1 / sums[k] : 0;
+    fftw_complex* spectrum = spectra_.data() + k * spectrum_count;
+    for (int i = 0; i < spectrum_count; ++i) {
+      spectrum[i][0] *= scale;
+      spectrum[i][1] *= scale;
+    }
+  }
+}
@@ -0,0 +1,57 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KERNEL_SET_H_
+#define KERNEL_SET_H_
+
+#include <ppapi/cpp/size.h>
+
+#include "fft_allocation.h"
+#include "kernel_set_config.h"
+
+// The spectra of any number of radial kernels, for Lenia-style rules that
+// combine several neighbourhoods instead of Kernel's disc and ring. They are
+// computed once per config or size, with a single batched transform.
+class KernelSet {
+ public:
+  explicit KernelSet(const pp::Size& size);
+
+  const pp::Size& size() const { return size_; }
+  const KernelSetConfig& config() const { return config_; }
+  int count() const { return static_cast<int>(config_.profiles.size()); }
+  // The distance beyond which every kernel is zero.
+  real radius() const { return radius_; }
+  // The spectrum of each kernel, one after another, scaled so the kernel
+  // adds up to 1. Each has size().height() * (size().width() / 2 + 1)
+  // values, laid out like Kernel::krf().
+  const AlignedComplexes& spectra() const { return spectra_; }
+
+  void SetSize(const pp::Size& size);
+  void SetConfig(const KernelSetConfig& config);
+  // Like SetSize() and then SetConfig(), but makes the kernels only once.
+  void SetSizeAndConfig(const pp::Size& size, const KernelSetConfig& config);
+
+ private:
+  void MakeKernels();
+
+  pp::Size size_;
+  KernelSetConfig config_;
+  real radius_;
+  AlignedComplexes spectra_;
+
+  KernelSet(const KernelSet&);  // undefined
+  KernelSet& operator =(const KernelSet&);  // undefined
+};
+
+#endif  // KERNEL_SET_H_
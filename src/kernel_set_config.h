@@ -0,0 +1,57 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KERNEL_SET_CONFIG_H_
+#define KERNEL_SET_CONFIG_H_
+
+#include <vector>
+
+#include "smoother_config.h"
+
+// Limits on what a kernel set may hold, for configs that come from outside:
+// every kernel costs a transform and two world-sized buffers.
+const int kMaxKernelSetSize = 16;
+const int kMaxKernelShells = 16;
+
+enum KernelShellType {
+  // Cells whose distance from the centre is within width / 2 of |radius|,
+  // with edges blended over one cell.
+  KERNEL_SHELL_RING,
+  // exp(-((r - radius) / width)^2 / 2) at distance r.
+  KERNEL_SHELL_GAUSSIAN
+};
+
+struct KernelShell {
+  KernelShell()
+      : type(KERNEL_SHELL_RING), radius(0), width(1), weight(1) {}
+
+  KernelShellType type;
+  real radius;
+  real width;
+  real weight;
+};
+
+// One kernel of a set: the weighted sum of its shells, normalized so that
+// its values add up to 1, and the growth function of its convolution.
+struct KernelProfile {
+  std::vector<KernelShell> shells;
+  GrowthConfig growth;
+};
+
+// An empty set means the simulation uses its disc and ring Kernel.
+struct KernelSetConfig {
+  std::vector<KernelProfile> profiles;
+};
+
+#endif  // KERNEL_SET_CONFIG_H_
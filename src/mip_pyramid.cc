@@ -0,0 +1,104 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mip_pyramid.h"
+
+#include "fixed16.h"
+
+namespace {
+
+uint16_t Average(real a, real b, real c, real d) {
+  return PackFixed16((a + b + c + d) * static_cast<real>(0.25));
+}
+
+uint16_t Average(uint16_t a, uint16_t b, uint16_t c, uint16_t d) {
+  return static_cast<uint16_t>((a + b + c + d + 2) >> 2);
+}
+
+// Odd rows and columns at the end of |src| are dropped.
+template <typename T>
+void Downsample(const FftAllocation<T>& src, AlignedUint16s* dst) {
+  int src_width = src.size().width();
+  int width = dst->size().width();
+  int height = dst->size().height();
+  for (int y = 0; y < height; ++y) {
+    const T* row0 = src.data() + 2 * y * src_width;
+    const T* row1 = row0 + src_width;
+    uint16_t* out = dst->data() + y * width;
+    for (int x = 0; x < width; ++x) {
+      out[x] = Average(row0[2 * x], row0[2 * x + 1],
+                       row1[2 * x], row1[2 * x + 1]);
+    }
+  }
+}
+
+}  // namespace
+
+MipPyramid::MipPyramid()
+    : valid_levels_(0) {
+}
+
+MipPyramid::~MipPyramid() {
+  for (size_t i = 0; i < levels_.size(); ++i)
+    delete levels_[i];
+}
+
+// static
+int MipPyramid::MaxLevel(const pp::Size& size) {
+  int level = 0;
+  while ((size.width() >> (level + 1)) > 0 &&
+         (size.height() >> (level + 1)) > 0)
+    ++level;
+  return level;
+}
+
+// static
+pp::Size MipPyramid::LevelSize(const pp::Size& size, int level) {
+  return pp::Size(size.width() >> level, size.height() >> level);
+}
+
+const AlignedUint16s& MipPyramid::GetLevel(const AlignedReals& state,
+                                           int level) {
+  return GetLevelT(state, level);
+}
+
+const AlignedUint16s& MipPyramid::GetLevel(const AlignedUint16s& state,
+                                           int level) {
+  return GetLevelT(state, level);
+}
+
+template <typename T>
+const AlignedUint16s& MipPyramid::GetLevelT(const FftAllocation<T>& state,
+                                            int level) {
+  if (state.size() != size_) {
+    for (size_t i = 0; i < levels_.size(); ++i)
+      delete levels_[i];
+    levels_.clear();
+    size_ = state.size();
+    valid_levels_ = 0;
+  }
+
+  while (static_cast<int>(levels_.size()) < level) {
+    int new_level = levels_.size() + 1;
+    levels_.push_back(new AlignedUint16s(LevelSize(size_, new_level)));
+  }
+
+  if (valid_levels_ == 0) {
+    Downsample(state, levels_[0]);
+    valid_levels_ = 1;
+  }
+  for (; valid_levels_ < level; ++valid_levels_)
+    Downsample(*levels_[valid_levels_ - 1], levels_[valid_levels_]);
+  return *levels_[level - 1];
+}
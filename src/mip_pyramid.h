@@ -0,0 +1,62 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MIP_PYRAMID_H_
+#define MIP_PYRAMID_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include <ppapi/cpp/size.h>
+
+#include "fft_allocation.h"
+
+// Successively halved copies of the state, each value the average of a 2x2
+// block of the level below, stored as 16-bit fixed point. Level 0 is the
+// state itself. Levels are only built when they are asked for, and are kept
+// until the state changes. Every step changes the whole state, so rendering
+// a zoomed-out view after a step rebuilds the levels from the full state:
+// one read of every cell, plus a third as much again for the levels above
+// level 1. Only frames that don't step, such as while paused, reuse them.
+class MipPyramid {
+ public:
+  MipPyramid();
+  ~MipPyramid();
+
+  static int MaxLevel(const pp::Size& size);
+  static pp::Size LevelSize(const pp::Size& size, int level);
+
+  // Call whenever the state changes.
+  void Invalidate() { valid_levels_ = 0; }
+
+  // Returns |level|, which must be in [1, MaxLevel(state.size())], building
+  // it and any out of date levels below it from |state|.
+  const AlignedUint16s& GetLevel(const AlignedReals& state, int level);
+  const AlignedUint16s& GetLevel(const AlignedUint16s& state, int level);
+
+ private:
+  template <typename T>
+  const AlignedUint16s& GetLevelT(const FftAllocation<T>& state, int level);
+
+  // levels_[i] is level i + 1.
+  std::vector<AlignedUint16s*> levels_;
+  pp::Size size_;
+  // The number of levels, starting from level 1, that match the state.
+  int valid_levels_;
+
+  MipPyramid(const MipPyramid&);  // Undefined.
+  MipPyramid& operator =(const MipPyramid&);  // Undefined.
+};
+
+#endif  // MIP_PYRAMID_H_
@@ -0,0 +1,300 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "multi_channel.h"
+
+#include <algorithm>
+#include <assert.h>
+
+#include "check.h"
+#include "fftw_threads.h"
+#include "rasterizer.h"
+#include "smoother.h"
+
+namespace {
+
+// How far past 1 the weights of an input may add up to, from rounding.
+const real kMaxWeightSumError = 1e-4;
+
+}  // namespace
+
+struct MultiChannelSimulation::MultiplyTask {
+  void Run(int task) {
+    int count = simulation->spectrum_count_;
+    simulation->MultiplyRange(
+        count * static_cast<int64_t>(task) / task_count,
+        count * static_cast<int64_t>(task + 1) / task_count);
+  }
+
+  MultiChannelSimulation* simulation;
+  int task_count;
+};
+
+struct MultiChannelSimulation::GrowthTask {
+  void Run(int task) {
+    int count = simulation->channel_count_ * simulation->area_;
+    simulation->ApplyGrowthRange(
+        count * static_cast<int64_t>(task) / task_count,
+        count * static_cast<int64_t>(task + 1) / task_count,
+        stats ? &stats[task * simulation->channel_count_] : NULL);
+  }
+
+  MultiChannelSimulation* simulation;
+  // channel_count_ stats per task.
+  StepStats* stats;
+  int task_count;
+};
+
+MultiChannelSimulation::MultiChannelSimulation(
+    const MultiChannelConfig& config)
+    : size_(config.size),
+      channel_count_(config.channel_count),
+      area_(config.size.GetArea()),
+      spectrum_count_(config.size.height() * (config.size.width() / 2 + 1)),
+      thread_pool_(config.thread_count),
+      thread_count_(config.thread_count),
+      kernel_set_(config.size),
+      dt_(config.dt),
+      channel_inputs_(channel_count_ + 1),
+      state_(pp::Size(size_.width(), size_.height() * channel_count_)),
+      spectra_(pp::Size(size_.width(), size_.height() * channel_count_),
+               ReduceSizeForComplex()),
+      products_(pp::Size()),
+      convolutions_(pp::Size()),
+      smoothers_(channel_count_),
+      rngs_(channel_count_),
+      step_stats_(channel_count_),
+      task_stats_(std::max(1, thread_count_) * channel_count_),
+      collect_stats_(false),
+      steps_(0),
+      time_(0),
+      forward_plan_(NULL),
+      inverse_plan_(NULL) {
+  assert(channel_count_ >= 1 && channel_count_ <= kMaxChannels);
+  // The smoothers only apply growth functions, so their config is only
+  // there to carry dt; see SetDt().
+  for (int i = 0; i < channel_count_; ++i) {
+    smoothers_[i] = new Smoother(size_, SmootherConfig(), &thread_pool_);
+    rngs_[i].Seed(config.seed, i);
+  }
+  SetDt(dt_);
+  std::fill(state_.begin(), state_.end(), 0);
+#ifdef USE_THREADS
+  AcquireFftwThreads();
+#endif
+  kernel_set_.SetConfig(config.kernel_set);
+  weights_ = config.weights;
+  UpdateInputs();
+  MakePlans();
+}
+
+MultiChannelSimulation::~MultiChannelSimulation() {
+  DestroyPlans();
+  for (int i = 0; i < channel_count_; ++i)
+    delete smoothers_[i];
+#ifdef USE_THREADS
+  ReleaseFftwThreads();
+#endif
+}
+
+void MultiChannelSimulation::MakePlans() {
+  DestroyPlans();
+#ifdef USE_THREADS
+  fftw_plan_with_nthreads(thread_count_);
+#endif
+  int n[2] = {size_.height(), size_.width()};
+  forward_plan_ = fftw_plan_many_dft_r2c(
+      2, n, channel_count_, state_.data(), NULL, 1, area_, spectra_.data(),
+      NULL, 1, spectrum_count_, FFTW_ESTIMATE);
+  CHECK(forward_plan_);
+  if (input_count() > 0) {
+    inverse_plan_ = fftw_plan_many_dft_c2r(
+        2, n, input_count(), products_.data(), NULL, 1, spectrum_count_,
+        convolutions_.data(), NULL, 1, area_, FFTW_ESTIMATE);
+    CHECK(inverse_plan_);
+  }
+}
+
+void MultiChannelSimulation::DestroyPlans() {
+  if (forward_plan_)
+    fftw_destroy_plan(forward_plan_);
+  if (inverse_plan_)
+    fftw_destroy_plan(inverse_plan_);
+  forward_plan_ = NULL;
+  inverse_plan_ = NULL;
+}
+
+void MultiChannelSimulation::UpdateInputs() {
+  int kernel_count = kernel_set_.count();
+  assert(weights_.empty() ||
+         static_cast<int>(weights_.size()) ==
+             channel_count_ * channel_count_ * kernel_count);
+
+  input_kernels_.clear();
+  input_weights_.clear();
+  std::vector<GrowthConfig> growth;
+  for (int c = 0; c < channel_count_; ++c) {
+    channel_inputs_[c] = input_count();
+    growth.clear();
+    for (int k = 0; k < kernel_count; ++k) {
+      std::vector<real> weights(channel_count_, 0);
+      bool used = false;
+      real sum = 0;
+      for (int s = 0; s < channel_count_; ++s) {
+        if (weights_.empty())
+          weights[s] = s == c ? 1 : 0;
+        else
+          weights[s] = weights_[(c * channel_count_ + s) * kernel_count + k];
+        assert(weights[s] >= 0);
+        used = used || weights[s] != 0;
+        sum += weights[s];
+      }
+      assert(sum <= 1 + kMaxWeightSumError);
+      if (!used)
+        continue;
+      input_kernels_.push_back(k);
+      input_weights_.insert(input_weights_.end(), weights.begin(),
+                            weights.end());
+      growth.push_back(kernel_set_.config().profiles[k].growth);
+    }
+    smoothers_[c]->SetGrowth(growth);
+  }
+  channel_inputs_[channel_count_] = input_count();
+
+  pp::Size inputs_size(size_.width(), size_.height() * input_count());
+  if (convolutions_.size() != inputs_size) {
+    AlignedComplexes(inputs_size, ReduceSizeForComplex()).swap(products_);
+    AlignedReals(inputs_size).swap(convolutions_);
+  }
+}
+
+void MultiChannelSimulation::SetStatsEnabled(bool enabled) {
+  collect_stats_ = enabled;
+}
+
+void MultiChannelSimulation::SetKernelSet(const KernelSetConfig& config,
+                                          const std::vector<real>& weights) {
+  kernel_set_.SetConfig(config);
+  weights_ = weights;
+  UpdateInputs();
+  MakePlans();
+}
+
+void MultiChannelSimulation::SetDt(real dt) {
+  dt_ = dt;
+  SmootherConfig smoother_config;
+  smoother_config.timestep.dt = dt_;
+  for (int i = 0; i < channel_count_; ++i)
+    smoothers_[i]->SetConfig(smoother_config);
+}
+
+void MultiChannelSimulation::Clear(int index, real color) {
+  std::fill(state(index), state(index) + area_, color);
+}
+
+void MultiChannelSimulation::Seed(uint64_t seed) {
+  for (int i = 0; i < channel_count_; ++i)
+    rngs_[i].Seed(seed, i);
+}
+
+void MultiChannelSimulation::Splat(int index) {
+  std::vector<Capsule> capsules;
+  AddSplatCapsules(size_.width(), size_.height(), kernel_set_.radius(),
+                   rngs_[index].Next(), 0, size_.height(), &capsules);
+  for (size_t i = 0; i < capsules.size(); ++i) {
+    FillCapsuleRows(state(index), size_.width(), size_.height(), capsules[i],
+                    capsules[i].color, 0, size_.height());
+  }
+}
+
+void MultiChannelSimulation::Step() {
+  int task_count = std::max(1, thread_count_);
+
+  fftw_execute(forward_plan_);
+
+  if (inverse_plan_) {
+    MultiplyTask multiply;
+    multiply.simulation = this;
+    multiply.task_count = task_count;
+    thread_pool_.Run(&multiply, task_count);
+
+    fftw_execute(inverse_plan_);
+  }
+
+  if (collect_stats_)
+    std::fill(task_stats_.begin(), task_stats_.end(), StepStats());
+  GrowthTask growth;
+  growth.simulation = this;
+  growth.stats = collect_stats_ ? &task_stats_[0] : NULL;
+  growth.task_count = task_count;
+  thread_pool_.Run(&growth, task_count);
+
+  if (collect_stats_) {
+    for (int i = 0; i < channel_count_; ++i) {
+      step_stats_[i] = StepStats();
+      for (int task = 0; task < task_count; ++task)
+        step_stats_[i].Merge(task_stats_[task * channel_count_ + i]);
+    }
+  }
+  time_ += dt_;
+  steps_++;
+}
+
+// Each channel's spectrum value is read once, and each kernel's once per
+// input that uses it; every input is then the weighted sum of the channels
+// times its kernel.
+void MultiChannelSimulation::MultiplyRange(int begin, int end) {
+  int input_count = this->input_count();
+  const fftw_complex* channels = spectra_.data();
+  const fftw_complex* kernels = kernel_set_.spectra().data();
+  fftw_complex* out = products_.data();
+  real re[kMaxChannels];
+  real im[kMaxChannels];
+  for (int i = begin; i < end; ++i) {
+    for (int c = 0; c < channel_count_; ++c) {
+      re[c] = channels[c * spectrum_count_ + i][0];
+      im[c] = channels[c * spectrum_count_ + i][1];
+    }
+    for (int j = 0; j < input_count; ++j) {
+      const real* weights = &input_weights_[j * channel_count_];
+      real mix_re = 0;
+      real mix_im = 0;
+      for (int c = 0; c < channel_count_; ++c) {
+        mix_re += weights[c] * re[c];
+        mix_im += weights[c] * im[c];
+      }
+      const fftw_complex& kernel =
+          kernels[input_kernels_[j] * spectrum_count_ + i];
+      fftw_complex& product = out[j * spectrum_count_ + i];
+      product[0] = mix_re * kernel[0] - mix_im * kernel[1];
+      product[1] = mix_re * kernel[1] + mix_im * kernel[0];
+    }
+  }
+}
+
+void MultiChannelSimulation::ApplyGrowthRange(int begin, int end,
+                                              StepStats* stats) {
+  while (begin < end) {
+    int channel = begin / area_;
+    int channel_begin = channel * area_;
+    int channel_end = std::min(end, channel_begin + area_);
+    const real* inputs =
+        convolutions_.data() + channel_inputs_[channel] * area_;
+    smoothers_[channel]->ApplyCells(inputs, NULL, state(channel),
+                                    begin - channel_begin,
+                                    channel_end - channel_begin,
+                                    stats ? &stats[channel] : NULL);
+    begin = channel_end;
+  }
+}
@@ -0,0 +1,159 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MULTI_CHANNEL_H_
+#define MULTI_CHANNEL_H_
+
+#include <stdint.h>
+#include <vector>
+#include <ppapi/cpp/size.h>
+
+#include "fft_allocation.h"
+#include "fftw.h"
+#include "kernel_set.h"
+#include "rng.h"
+#include "step_stats.h"
+#include "thread_pool.h"
+
+class Smoother;
+
+const int kMaxChannels = 8;
+
+struct MultiChannelConfig {
+  MultiChannelConfig(int thread_count, const pp::Size& size,
+                     int channel_count)
+      : thread_count(thread_count),
+        size(size),
+        channel_count(channel_count),
+        dt(0.1),
+        seed(0) {}
+  int thread_count;
+  pp::Size size;
+  // At most kMaxChannels.
+  int channel_count;
+  real dt;
+  // Channel i draws its random numbers from stream i of this seed.
+  uint64_t seed;
+  // Every channel may use every kernel; see weights.
+  KernelSetConfig kernel_set;
+  // The input of kernel k for channel d is the kernel's convolution with
+  // the sum over channels s of weights[(d * channel_count + s) *
+  // kernel_count + k] times channel s. Channel d only grows by kernel k if
+  // one of those weights is nonzero. Empty means each channel sees only
+  // itself, through every kernel. The weights must not be negative, and the
+  // weights of each input must add up to at most 1, so the input stays in
+  // [0, 1] like the channels; the growth functions are only defined there.
+  std::vector<real> weights;
+};
+
+// A world of several interacting channels, or species, each with its own
+// state, sharing a set of Lenia-style kernels (see KernelSet). Convolution
+// is linear, so the weighted sum of channels each kernel sees is formed in
+// the Fourier domain: a step is one batched forward transform of the C
+// channels, one pass that makes every channel's input spectrum for every
+// kernel it uses, one batched inverse transform of those, and a growth pass
+// (see Smoother::ApplyGrowth()). That is C forward transforms and at most
+// C * K inverse ones, where convolving every channel with every kernel for
+// every other channel would take C * C * K.
+class MultiChannelSimulation {
+ public:
+  explicit MultiChannelSimulation(const MultiChannelConfig& config);
+  ~MultiChannelSimulation();
+
+  const pp::Size& size() const { return size_; }
+  int channel_count() const { return channel_count_; }
+  const KernelSet& kernel_set() const { return kernel_set_; }
+  const std::vector<real>& weights() const { return weights_; }
+  // The number of (channel, kernel) inputs, and so of inverse transforms,
+  // per step.
+  int input_count() const { return static_cast<int>(input_kernels_.size()); }
+  ThreadPool* thread_pool() { return &thread_pool_; }
+  // The state of channel |index|: size().GetArea() values, row-major.
+  real* state(int index) { return state_.data() + index * area_; }
+  const real* state(int index) const {
+    return state_.data() + index * area_;
+  }
+  // Only computed when stats are enabled.
+  const StepStats& step_stats(int index) const { return step_stats_[index]; }
+  bool stats_enabled() const { return collect_stats_; }
+  int steps() const { return steps_; }
+  double time() const { return time_; }
+
+  void SetStatsEnabled(bool enabled);
+  // |weights| is laid out like MultiChannelConfig::weights.
+  void SetKernelSet(const KernelSetConfig& config,
+                    const std::vector<real>& weights);
+  void SetDt(real dt);
+  void Clear(int index, real color);
+  void Seed(uint64_t seed);
+  // Like Simulation::Splat(), with circles about the size of the kernels,
+  // drawn with channel |index|'s random numbers.
+  void Splat(int index);
+
+  void Step();
+
+ private:
+  struct MultiplyTask;
+  struct GrowthTask;
+  void MakePlans();
+  void DestroyPlans();
+  // Finds the (channel, kernel) pairs with a nonzero weight, and sizes the
+  // buffers and smoothers for them.
+  void UpdateInputs();
+  // Updates values [begin, end) of every input's spectrum.
+  void MultiplyRange(int begin, int end);
+  // Updates [begin, end) of the channels' values, counted over all of
+  // them, so a range may span several channels.
+  void ApplyGrowthRange(int begin, int end, StepStats* stats);
+
+  pp::Size size_;
+  int channel_count_;
+  int area_;
+  // The number of values in one channel's spectrum.
+  int spectrum_count_;
+  ThreadPool thread_pool_;
+  int thread_count_;
+  KernelSet kernel_set_;
+  std::vector<real> weights_;
+  real dt_;
+  // The inputs, sorted by channel. Input i is kernel input_kernels_[i]
+  // convolved with the channels weighted by input_weights_[i *
+  // channel_count_ ...]. Channel c's inputs start at channel_inputs_[c].
+  std::vector<int> input_kernels_;
+  std::vector<real> input_weights_;
+  std::vector<int> channel_inputs_;
+  // All of these hold the channels or inputs one after another.
+  AlignedReals state_;
+  AlignedComplexes spectra_;
+  AlignedComplexes products_;
+  AlignedReals convolutions_;
+  // One per channel, with the growth functions of its inputs' kernels.
+  std::vector<Smoother*> smoothers_;
+  std::vector<Rng> rngs_;
+  std::vector<StepStats> step_stats_;
+  // Each task's stats for each channel, reused by every Step().
+  std::vector<StepStats> task_stats_;
+  bool collect_stats_;
+  int steps_;
+  double time_;
+  fftw_plan forward_plan_;
+  // NULL when there are no inputs.
+  fftw_plan inverse_plan_;
+
+  MultiChannelSimulation(const MultiChannelSimulation&);  // Undefined.
+  MultiChannelSimulation& operator =(
+      const MultiChannelSimulation&);  // Undefined.
+};
+
+#endif  // MULTI_CHANNEL_H_
@@ -16,9 +16,6 @@
 #include <algorithm>
 #include <math.h>
 
-#include <ppapi/c/ppb_image_data.h>
-#include <ppapi/cpp/image_data.h>
-
 namespace {
 
 const uint32_t kBlack = 0xff000000;
@@ -33,16 +30,16 @@ void Uint32ToRGB(uint32_t c, uint8_t* r, uint8_t* g, uint8_t* b) {
   *b = (c >> 0) & 0xff;
 }
 
+// Colors are 0xAARRGGBB until the lookup table is converted to the output
+// format; see ConvertToFormat().
 uint32_t RGBToUint32(uint8_t r, uint8_t g, uint8_t b) {
-  static PP_ImageDataFormat format = pp::ImageData::GetNativeImageDataFormat();
-  if (format == PP_IMAGEDATAFORMAT_BGRA_PREMUL) {
-    return 0xff000000 | (r << 16) | (g << 8) | b;
-  } else if (format == PP_IMAGEDATAFORMAT_RGBA_PREMUL) {
-    return 0xff000000 | (b << 16) | (g << 8) | r;
-  } else {
-    assert(0);
-    return 0xff000000;
-  }
+  return 0xff000000 | (r << 16) | (g << 8) | b;
+}
+
+uint32_t ConvertToFormat(uint32_t c, ColorFormat format) {
+  if (format == COLOR_FORMAT_BGRA)
+    return c;
+  return (c & 0xff00ff00) | ((c >> 16) & 0xff) | ((c & 0xff) << 16);
 }
 
 template <typename T>
@@ -129,10 +126,11 @@ real GradientPaletteGenerator::GetMaxStopPos() const {
 }
 
 template <size_t size>
-void MakeLookupTable(const PaletteGenerator& generator,
+void MakeLookupTable(const PaletteGenerator& generator, ColorFormat format,
                      uint32_t (*color_map)[size]) {
   for (size_t i = 0; i < size; ++i) {
-    (*color_map)[i] = generator.GetColor(static_cast<real>(i) / size);
+    (*color_map)[i] = ConvertToFormat(
+        generator.GetColor(static_cast<real>(i) / size), format);
   }
 }
 
@@ -147,7 +145,8 @@ PaletteConfig::PaletteConfig()
     : repeating(false) {
 }
 
-Palette::Palette(const PaletteConfig& config) {
+Palette::Palette(const PaletteConfig& config, ColorFormat format)
+    : format_(format) {
   SetConfig(config);
 }
 
@@ -157,7 +156,23 @@ uint32_t Palette::GetColor(real value) const {
   return value_color_map_[index];
 }
 
+uint32_t Palette::GetColor(uint16_t value) const {
+  return value_color_map_[(value * kColorMapSize) >> 16];
+}
+
+void Palette::GetColors(const real* values, int count,
+                        uint32_t* colors) const {
+  for (int i = 0; i < count; ++i)
+    colors[i] = GetColor(values[i]);
+}
+
+void Palette::GetColors(const uint16_t* values, int count,
+                        uint32_t* colors) const {
+  for (int i = 0; i < count; ++i)
+    colors[i] = value_color_map_[(values[i] * kColorMapSize) >> 16];
+}
+
 void Palette::SetConfig(const PaletteConfig& config) {
   MakeLookupTable(GradientPaletteGenerator(config.stops, config.repeating),
-                  &value_color_map_);
+                  format_, &value_color_map_);
 }
@@ -27,6 +27,14 @@ struct ColorStop {
 };
 typedef std::vector<ColorStop> ColorStops;
 
+// The order of a color's bytes in memory.
+enum ColorFormat {
+  // pp::ImageData's PP_IMAGEDATAFORMAT_BGRA_PREMUL.
+  COLOR_FORMAT_BGRA,
+  // PP_IMAGEDATAFORMAT_RGBA_PREMUL.
+  COLOR_FORMAT_RGBA
+};
+
 struct PaletteConfig {
   PaletteConfig();
 
@@ -36,13 +44,19 @@ struct PaletteConfig {
 
 class Palette {
  public:
-  explicit Palette(const PaletteConfig& config);
+  Palette(const PaletteConfig& config, ColorFormat format);
   uint32_t GetColor(real value) const;
+  // |value| is 16-bit fixed point; see fixed16.h.
+  uint32_t GetColor(uint16_t value) const;
+  // Converts |count| values to colors at once.
+  void GetColors(const real* values, int count, uint32_t* colors) const;
+  void GetColors(const uint16_t* values, int count, uint32_t* colors) const;
 
   void SetConfig(const PaletteConfig& config);
 
  private:
   static const size_t kColorMapSize = 512;
+  ColorFormat format_;
   uint32_t value_color_map_[kColorMapSize];
 };
 
@@ -0,0 +1,141 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "rasterizer.h"
+
+#include <math.h>
+
+#include "rng.h"
+
+namespace {
+
+// An open interval of x; empty when lo >= hi.
+struct Interval {
+  Interval(double lo, double hi) : lo(lo), hi(hi) {}
+  bool empty() const { return lo >= hi; }
+
+  double lo;
+  double hi;
+};
+
+// The x where the disc about (cx, cy) crosses row |y|.
+Interval DiscSpan(double cx, double cy, double radius, double y) {
+  double dy = y - cy;
+  double h2 = radius * radius - dy * dy;
+  if (h2 <= 0)
+    return Interval(0, 0);
+  double h = sqrt(h2);
+  return Interval(cx - h, cx + h);
+}
+
+// Narrows |interval| to the x where lo < a * x + b < hi.
+void Clip(double a, double b, double lo, double hi, Interval* interval) {
+  if (a == 0) {
+    if (b <= lo || b >= hi)
+      interval->hi = interval->lo;
+    return;
+  }
+  double x0 = (lo - b) / a;
+  double x1 = (hi - b) / a;
+  if (a < 0)
+    std::swap(x0, x1);
+  interval->lo = std::max(interval->lo, x0);
+  interval->hi = std::min(interval->hi, x1);
+}
+
+// The x where the rectangle swept by the segment's normal crosses row |y|:
+// the points that project onto the segment and are less than the radius
+// from it.
+Interval BandSpan(const Capsule& c, double y) {
+  double dx = c.x1 - c.x0;
+  double dy = c.y1 - c.y0;
+  double length2 = dx * dx + dy * dy;
+  Interval span(-HUGE_VAL, HUGE_VAL);
+  if (length2 == 0)
+    return Interval(0, 0);
+  double ry = y - c.y0;
+  // Along the segment: 0 < (x - x0) * dx + ry * dy < length2.
+  Clip(dx, ry * dy - c.x0 * dx, 0, length2, &span);
+  // Across it: |(x - x0) * dy - ry * dx| < radius * length.
+  double across = c.radius * sqrt(length2);
+  Clip(dy, -ry * dx - c.x0 * dy, -across, across, &span);
+  return span;
+}
+
+}  // namespace
+
+void CapsuleRows(const Capsule& capsule, int* top, int* bottom) {
+  real y_min = std::min(capsule.y0, capsule.y1) - capsule.radius;
+  real y_max = std::max(capsule.y0, capsule.y1) + capsule.radius;
+  // Cells on the edge are not filled, so floor + 1 and ceil are the first
+  // and one past the last rows that could be.
+  *top = static_cast<int>(floor(y_min)) + 1;
+  *bottom = static_cast<int>(ceil(y_max));
+}
+
+bool CapsuleRowSpan(const Capsule& capsule, int y, int* left, int* right) {
+  // The capsule is convex, so its crossing with the row is one interval:
+  // the hull of the crossings of the end discs and the band between them.
+  Interval pieces[3] = {
+    DiscSpan(capsule.x0, capsule.y0, capsule.radius, y),
+    DiscSpan(capsule.x1, capsule.y1, capsule.radius, y),
+    BandSpan(capsule, y),
+  };
+  Interval span(HUGE_VAL, -HUGE_VAL);
+  for (int i = 0; i < 3; ++i) {
+    if (pieces[i].empty())
+      continue;
+    span.lo = std::min(span.lo, pieces[i].lo);
+    span.hi = std::max(span.hi, pieces[i].hi);
+  }
+  if (span.empty())
+    return false;
+
+  // The cells strictly inside (lo, hi).
+  *left = static_cast<int>(floor(span.lo)) + 1;
+  *right = static_cast<int>(ceil(span.hi));
+  return *left < *right;
+}
+
+// The world is divided into tiles about as wide as the ring kernel, and each
+// tile gets one circle, placed with the tile's own random stream. A band of
+// rows only needs the circles of the tiles that can reach it, so they are
+// regenerated per band rather than shared.
+void AddSplatCapsules(int width, int height, real ring_radius, uint64_t seed,
+                      int begin, int end, std::vector<Capsule>* capsules) {
+  real tile_size = std::max(static_cast<real>(1), 2 * ring_radius);
+  int tiles_x = std::max(1, static_cast<int>(width / tile_size));
+  int tiles_y = std::max(1, static_cast<int>(height / tile_size));
+  real tile_width = static_cast<real>(width) / tiles_x;
+  real tile_height = static_cast<real>(height) / tiles_y;
+
+  int reach = static_cast<int>(ceil(ring_radius / tile_height));
+  int first = static_cast<int>(begin / tile_height) - reach;
+  int last = static_cast<int>((end - 1) / tile_height) + reach;
+  if (last - first + 1 >= tiles_y) {
+    first = 0;
+    last = tiles_y - 1;
+  }
+
+  for (int ty = first; ty <= last; ++ty) {
+    int tile_y = (ty % tiles_y + tiles_y) % tiles_y;
+    for (int tile_x = 0; tile_x < tiles_x; ++tile_x) {
+      Rng rng(seed, tile_y * tiles_x + tile_x);
+      real x = (tile_x + rng.NextUnit()) * tile_width;
+      real y = (tile_y + rng.NextUnit()) * tile_height;
+      real r = ring_radius * (rng.NextUnit() * 0.5 + 0.5);
+      capsules->push_back(Capsule(x, y, r, 1.0));
+    }
+  }
+}
@@ -0,0 +1,94 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RASTERIZER_H_
+#define RASTERIZER_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include "functions.h"
+
+// A disc of |radius| swept from (x0, y0) to (x1, y1), filled with |color|.
+// A single brush dab has both ends at the same point. Coordinates are in
+// cells, and may be outside the world; they wrap around when drawn.
+struct Capsule {
+  Capsule() : x0(0), y0(0), x1(0), y1(0), radius(0), color(0) {}
+  Capsule(real x, real y, real radius, real color)
+      : x0(x), y0(y), x1(x), y1(y), radius(radius), color(color) {}
+  Capsule(real x0, real y0, real x1, real y1, real radius, real color)
+      : x0(x0), y0(y0), x1(x1), y1(y1), radius(radius), color(color) {}
+
+  real x0;
+  real y0;
+  real x1;
+  real y1;
+  real radius;
+  real color;
+};
+
+// The rows the capsule touches are [*top, *bottom), unwrapped.
+void CapsuleRows(const Capsule& capsule, int* top, int* bottom);
+
+// Cells are filled when their coordinates are less than the radius from the
+// capsule's segment. The cells of row |y| (unwrapped) that are filled are
+// [*left, *right), also unwrapped. Returns false if there are none.
+bool CapsuleRowSpan(const Capsule& capsule, int y, int* left, int* right);
+
+// Adds the circles of a splat with |seed| over a |width| x |height| world
+// that can reach rows [begin, end). They are up to |ring_radius| in radius,
+// and only depend on the seed, so any split of the rows between threads
+// draws the same world.
+void AddSplatCapsules(int width, int height, real ring_radius, uint64_t seed,
+                      int begin, int end, std::vector<Capsule>* capsules);
+
+// Fills [left, right) of a row of |width| cells, wrapping around its ends,
+// with at most two contiguous fills.
+template <typename T>
+void FillWrappedSpan(T* row, int width, int left, int right, T value) {
+  if (right - left >= width) {
+    std::fill(row, row + width, value);
+    return;
+  }
+  int begin = (left % width + width) % width;
+  int end = begin + (right - left);
+  if (end <= width) {
+    std::fill(row + begin, row + end, value);
+  } else {
+    std::fill(row + begin, row + width, value);
+    std::fill(row, row + end - width, value);
+  }
+}
+
+// Draws the rows of |capsule| that wrap to [begin, end) into |data|, a
+// |width| x |height| row-major buffer. Each row is one span, found once.
+template <typename T>
+void FillCapsuleRows(T* data, int width, int height, const Capsule& capsule,
+                     T value, int begin, int end) {
+  int top;
+  int bottom;
+  CapsuleRows(capsule, &top, &bottom);
+  for (int j = top; j < bottom; ++j) {
+    int y = (j % height + height) % height;
+    if (y < begin || y >= end)
+      continue;
+    int left;
+    int right;
+    if (CapsuleRowSpan(capsule, j, &left, &right))
+      FillWrappedSpan(data + y * width, width, left, right, value);
+  }
+}
+
+#endif  // RASTERIZER_H_
@@ -0,0 +1,199 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "recorder.h"
+
+#include <string.h>
+#include <sys/time.h>
+#include <algorithm>
+
+#include "frame_codec.h"
+
+namespace {
+
+double NowMs() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+}  // namespace
+
+void MemoryRecordingSink::Write(const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  data_.insert(data_.end(), bytes, bytes + size);
+}
+
+Recorder::Recorder(const pp::Size& size, int precision,
+                   int keyframe_interval, RecordingSink* sink)
+    : size_(size),
+      precision_(std::max(8, std::min(16, precision))),
+      keyframe_interval_(std::max(1, keyframe_interval)),
+      sink_(sink),
+      frame_count_(0),
+      wait_ms_(0),
+      finished_(false),
+      head_(0),
+      queued_(0),
+      previous_(size.GetArea()),
+      frames_written_(0),
+      offset_(0) {
+  for (int i = 0; i < kQueueSize; ++i)
+    slots_[i].resize(size.GetArea());
+
+  RecordingHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = kRecordingMagic;
+  header.version = kRecordingVersion;
+  header.width = size.width();
+  header.height = size.height();
+  header.precision = precision_;
+  header.keyframe_interval = keyframe_interval_;
+  Write(&header, sizeof(header));
+
+#ifdef USE_THREADS
+  finishing_ = false;
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&frame_cond_, NULL);
+  pthread_cond_init(&space_cond_, NULL);
+  pthread_create(&thread_, NULL, &Recorder::WorkerMain, this);
+#endif
+}
+
+Recorder::~Recorder() {
+  Finish();
+#ifdef USE_THREADS
+  pthread_cond_destroy(&space_cond_);
+  pthread_cond_destroy(&frame_cond_);
+  pthread_mutex_destroy(&mutex_);
+#endif
+}
+
+void Recorder::AddFrame(const uint16_t* frame) {
+  if (finished_)
+    return;
+
+#ifdef USE_THREADS
+  // The slot after the queued frames is not touched by the worker until it
+  // is queued, so it can be filled without holding the lock.
+  pthread_mutex_lock(&mutex_);
+  if (queued_ == kQueueSize) {
+    double start_ms = NowMs();
+    while (queued_ == kQueueSize)
+      pthread_cond_wait(&space_cond_, &mutex_);
+    wait_ms_ += NowMs() - start_ms;
+  }
+  std::vector<uint16_t>& slot = slots_[(head_ + queued_) % kQueueSize];
+  pthread_mutex_unlock(&mutex_);
+#else
+  std::vector<uint16_t>& slot = slots_[0];
+#endif
+
+  int count = size_.GetArea();
+  for (int i = 0; i < count; ++i)
+    slot[i] = QuantizeRecording(frame[i], precision_);
+  frame_count_++;
+
+#ifdef USE_THREADS
+  pthread_mutex_lock(&mutex_);
+  queued_++;
+  pthread_cond_signal(&frame_cond_);
+  pthread_mutex_unlock(&mutex_);
+#else
+  EncodeFrame(slot);
+#endif
+}
+
+void Recorder::Finish() {
+  if (finished_)
+    return;
+  finished_ = true;
+
+#ifdef USE_THREADS
+  pthread_mutex_lock(&mutex_);
+  finishing_ = true;
+  pthread_cond_signal(&frame_cond_);
+  pthread_mutex_unlock(&mutex_);
+  pthread_join(thread_, NULL);
+#endif
+
+  RecordingFooter footer;
+  memset(&footer, 0, sizeof(footer));
+  footer.index_offset = offset_;
+  footer.keyframe_count = index_.size();
+  footer.frame_count = frames_written_;
+  footer.magic = kRecordingIndexMagic;
+  if (!index_.empty())
+    Write(&index_[0], index_.size() * sizeof(RecordingIndexEntry));
+  Write(&footer, sizeof(footer));
+}
+
+void Recorder::EncodeFrame(const std::vector<uint16_t>& frame) {
+  FrameType type = frames_written_ % keyframe_interval_ == 0
+                       ? FRAME_TYPE_KEY
+                       : FRAME_TYPE_DELTA;
+  if (type == FRAME_TYPE_KEY) {
+    RecordingIndexEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.frame = frames_written_;
+    entry.offset = offset_;
+    index_.push_back(entry);
+  }
+
+  encoded_.clear();
+  ::EncodeFrame(type, &frame[0], &previous_[0], frame.size(), &encoded_);
+  RecordingFrameHeader header;
+  header.type = type;
+  header.size = encoded_.size();
+  Write(&header, sizeof(header));
+  Write(&encoded_[0], encoded_.size());
+
+  previous_ = frame;
+  frames_written_++;
+}
+
+void Recorder::Write(const void* data, size_t size) {
+  sink_->Write(data, size);
+  offset_ += size;
+}
+
+#ifdef USE_THREADS
+
+// static
+void* Recorder::WorkerMain(void* arg) {
+  static_cast<Recorder*>(arg)->RunWorker();
+  return NULL;
+}
+
+void Recorder::RunWorker() {
+  pthread_mutex_lock(&mutex_);
+  for (;;) {
+    while (queued_ == 0 && !finishing_)
+      pthread_cond_wait(&frame_cond_, &mutex_);
+    if (queued_ == 0)
+      break;
+
+    // The producer only writes slots that are not queued.
+    const std::vector<uint16_t>& slot = slots_[head_];
+    pthread_mutex_unlock(&mutex_);
+    EncodeFrame(slot);
+    pthread_mutex_lock(&mutex_);
+    head_ = (head_ + 1) % kQueueSize;
+    queued_--;
+    pthread_cond_signal(&space_cond_);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+#endif  // USE_THREADS
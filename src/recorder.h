@@ -0,0 +1,112 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RECORDER_H_
+#define RECORDER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <ppapi/cpp/size.h>
+
+#ifdef USE_THREADS
+#include <pthread.h>
+#endif
+
+#include "recording_format.h"
+
+// Where a Recorder writes the recording; see recording_format.h.
+class RecordingSink {
+ public:
+  virtual ~RecordingSink() {}
+  // Called on the recorder's thread, in order.
+  virtual void Write(const void* data, size_t size) = 0;
+};
+
+class MemoryRecordingSink : public RecordingSink {
+ public:
+  virtual void Write(const void* data, size_t size);
+  const std::vector<uint8_t>& data() const { return data_; }
+
+ private:
+  std::vector<uint8_t> data_;
+};
+
+// Records a stream of 16-bit fixed point states. Each frame is quantized and
+// copied into a bounded queue, then compressed and written on a background
+// thread, so recording costs the simulation one pass over the state per
+// frame. Without USE_THREADS, frames are compressed as they are added.
+class Recorder {
+ public:
+  // Frames that may wait to be compressed before AddFrame() blocks.
+  static const int kQueueSize = 4;
+
+  // |sink| must outlive the recorder. |precision| is the number of bits
+  // kept per value, from 8 to 16; 16 is lossless. Every
+  // |keyframe_interval|th frame can be decoded on its own.
+  Recorder(const pp::Size& size, int precision, int keyframe_interval,
+           RecordingSink* sink);
+  ~Recorder();
+
+  const pp::Size& size() const { return size_; }
+  int frame_count() const { return frame_count_; }
+  // Time AddFrame() has spent waiting for room in the queue.
+  double wait_ms() const { return wait_ms_; }
+
+  void AddFrame(const uint16_t* frame);
+  // Waits for the queued frames, then writes the index. Called by the
+  // destructor if needed; no frames may be added afterward.
+  void Finish();
+
+ private:
+  void EncodeFrame(const std::vector<uint16_t>& frame);
+  void Write(const void* data, size_t size);
+#ifdef USE_THREADS
+  static void* WorkerMain(void* arg);
+  void RunWorker();
+#endif
+
+  pp::Size size_;
+  int precision_;
+  int keyframe_interval_;
+  RecordingSink* sink_;
+  int frame_count_;
+  double wait_ms_;
+  bool finished_;
+
+  // Frames waiting to be compressed are slots_[head_], ... in order.
+  std::vector<uint16_t> slots_[kQueueSize];
+  int head_;
+  int queued_;
+
+  // Only used by the thread that compresses frames.
+  std::vector<uint16_t> previous_;
+  std::vector<uint8_t> encoded_;
+  int frames_written_;
+  uint64_t offset_;
+  std::vector<RecordingIndexEntry> index_;
+
+#ifdef USE_THREADS
+  pthread_t thread_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t frame_cond_;
+  pthread_cond_t space_cond_;
+  bool finishing_;
+#endif
+
+  Recorder(const Recorder&);  // Undefined.
+  Recorder& operator =(const Recorder&);  // Undefined.
+};
+
+#endif  // RECORDER_H_
@@ -0,0 +1,71 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RECORDING_FORMAT_H_
+#define RECORDING_FORMAT_H_
+
+#include <stdint.h>
+
+// A recording is a RecordingHeader, then each frame as a RecordingFrameHeader
+// followed by its encoding (see frame_codec.h), then an index of keyframes
+// and a RecordingFooter. A recording that was cut off has no index, but can
+// still be played by scanning the frames. Fields are in host byte order;
+// readers reject a recording of the other byte order by its magic.
+const uint32_t kRecordingMagic = 0x43524d53;  // "SMRC"
+const uint32_t kRecordingIndexMagic = 0x49524d53;  // "SMRI"
+const uint32_t kRecordingVersion = 1;
+
+struct RecordingHeader {
+  uint32_t magic;
+  uint32_t version;
+  int32_t width;
+  int32_t height;
+  // Values are stored with this many bits, from 8 to 16; see
+  // QuantizeRecording().
+  uint32_t precision;
+  uint32_t keyframe_interval;
+};
+
+struct RecordingFrameHeader {
+  uint32_t type;  // A FrameType.
+  uint32_t size;  // Of the encoding that follows.
+};
+
+struct RecordingIndexEntry {
+  uint32_t frame;
+  uint32_t reserved;
+  uint64_t offset;  // Of the RecordingFrameHeader.
+};
+
+struct RecordingFooter {
+  uint64_t index_offset;
+  uint32_t keyframe_count;
+  uint32_t frame_count;
+  uint32_t magic;
+  uint32_t reserved;
+};
+
+// The recorded values keep the top |precision| bits; the lower bits are
+// restored by repeating the top ones, so 0 and 1 are still exact.
+inline uint16_t QuantizeRecording(uint16_t value, int precision) {
+  return value >> (16 - precision);
+}
+
+inline uint16_t DequantizeRecording(uint16_t value, int precision) {
+  int shift = 16 - precision;
+  return static_cast<uint16_t>((value << shift) |
+                               (value >> (precision - shift)));
+}
+
+#endif  // RECORDING_FORMAT_H_
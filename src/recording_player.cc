@@ -0,0 +1,183 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "recording_player.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include "frame_codec.h"
+
+RecordingPlayer::RecordingPlayer()
+    : data_(NULL),
+      frames_end_(0),
+      precision_(16),
+      frame_count_(0),
+      current_(-1),
+      next_offset_(0),
+      frame_(pp::Size()) {
+}
+
+bool RecordingPlayer::Open(const void* data, size_t size) {
+  RecordingHeader header;
+  if (size < sizeof(header))
+    return false;
+  memcpy(&header, data, sizeof(header));
+  if (header.magic != kRecordingMagic ||
+      header.version != kRecordingVersion || header.width <= 0 ||
+      header.height <= 0 || header.precision < 8 || header.precision > 16)
+    return false;
+
+  data_ = static_cast<const uint8_t*>(data);
+  size_ = pp::Size(header.width, header.height);
+  precision_ = header.precision;
+  current_ = -1;
+  next_offset_ = 0;
+  values_.assign(size_.GetArea(), 0);
+  AlignedUint16s(size_).swap(frame_);
+
+  // Without a valid index, the recording was cut off; play the frames that
+  // were written completely.
+  RecordingFooter footer;
+  if (size >= sizeof(header) + sizeof(footer)) {
+    memcpy(&footer, data_ + size - sizeof(footer), sizeof(footer));
+    if (ReadIndex(footer, size))
+      return true;
+  }
+  frames_end_ = size;
+  ScanFrames();
+  return true;
+}
+
+bool RecordingPlayer::ReadIndex(const RecordingFooter& footer, size_t size) {
+  if (footer.magic != kRecordingIndexMagic ||
+      footer.index_offset < sizeof(RecordingHeader) ||
+      footer.index_offset > size - sizeof(footer))
+    return false;
+  uint64_t index_size = footer.keyframe_count *
+                        static_cast<uint64_t>(sizeof(RecordingIndexEntry));
+  if (footer.index_offset + index_size + sizeof(footer) != size)
+    return false;
+  // Every frame has at least a header, which also bounds the count.
+  uint64_t frames_size = footer.index_offset - sizeof(RecordingHeader);
+  if (footer.frame_count * static_cast<uint64_t>(sizeof(RecordingFrameHeader))
+      > frames_size)
+    return false;
+  if ((footer.frame_count == 0) != (footer.keyframe_count == 0))
+    return false;
+
+  // Keyframes are in order, and the first is frame 0, so every frame can be
+  // reached from one.
+  keyframes_.clear();
+  keyframe_offsets_.clear();
+  const uint8_t* p = data_ + footer.index_offset;
+  for (uint32_t i = 0; i < footer.keyframe_count; ++i) {
+    RecordingIndexEntry entry;
+    memcpy(&entry, p + i * sizeof(entry), sizeof(entry));
+    bool in_order =
+        i == 0 ? entry.frame == 0 && entry.offset == sizeof(RecordingHeader)
+               : entry.frame > static_cast<uint32_t>(keyframes_.back()) &&
+                     entry.offset > keyframe_offsets_.back();
+    if (!in_order || entry.frame >= footer.frame_count ||
+        entry.offset >= footer.index_offset) {
+      keyframes_.clear();
+      keyframe_offsets_.clear();
+      return false;
+    }
+    keyframes_.push_back(entry.frame);
+    keyframe_offsets_.push_back(entry.offset);
+  }
+
+  frames_end_ = footer.index_offset;
+  frame_count_ = footer.frame_count;
+  return true;
+}
+
+void RecordingPlayer::ScanFrames() {
+  keyframes_.clear();
+  keyframe_offsets_.clear();
+  frame_count_ = 0;
+
+  // Frame headers give the size of each frame, so this doesn't decode
+  // anything.
+  uint64_t offset = sizeof(RecordingHeader);
+  RecordingFrameHeader frame_header;
+  while (offset + sizeof(frame_header) <= frames_end_) {
+    memcpy(&frame_header, data_ + offset, sizeof(frame_header));
+    uint64_t next = offset + sizeof(frame_header) + frame_header.size;
+    if (next > frames_end_)
+      break;
+    if (frame_header.type == FRAME_TYPE_KEY) {
+      keyframes_.push_back(frame_count_);
+      keyframe_offsets_.push_back(offset);
+    } else if (frame_header.type != FRAME_TYPE_DELTA) {
+      break;
+    }
+    frame_count_++;
+    offset = next;
+  }
+
+  // Every frame must be reachable from a keyframe.
+  if (frame_count_ > 0 && (keyframes_.empty() || keyframes_[0] != 0)) {
+    frame_count_ = 0;
+    keyframes_.clear();
+    keyframe_offsets_.clear();
+  }
+}
+
+bool RecordingPlayer::Seek(int index) {
+  if (index < 0 || index >= frame_count())
+    return false;
+  if (index == current_)
+    return true;
+
+  int key = std::upper_bound(keyframes_.begin(), keyframes_.end(), index) -
+            keyframes_.begin() - 1;
+  int next = keyframes_[key];
+  uint64_t offset = keyframe_offsets_[key];
+  if (current_ >= next && current_ < index) {
+    next = current_ + 1;
+    offset = next_offset_;
+  }
+  for (; next <= index; ++next) {
+    offset = Decode(offset, next == keyframes_[key]);
+    if (offset == 0) {
+      current_ = -1;
+      return false;
+    }
+    current_ = next;
+    next_offset_ = offset;
+  }
+
+  for (size_t i = 0; i < values_.size(); ++i)
+    frame_[i] = DequantizeRecording(values_[i], precision_);
+  return true;
+}
+
+uint64_t RecordingPlayer::Decode(uint64_t offset, bool keyframe) {
+  RecordingFrameHeader header;
+  if (offset + sizeof(header) > frames_end_)
+    return 0;
+  memcpy(&header, data_ + offset, sizeof(header));
+  uint64_t next = offset + sizeof(header) + header.size;
+  if (next > frames_end_ ||
+      (header.type != FRAME_TYPE_KEY &&
+       (keyframe || header.type != FRAME_TYPE_DELTA)))
+    return 0;
+  if (!DecodeFrame(static_cast<FrameType>(header.type),
+                   data_ + offset + sizeof(header), header.size,
+                   values_.size(), &values_[0]))
+    return 0;
+  return next;
+}
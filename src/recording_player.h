@@ -0,0 +1,79 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RECORDING_PLAYER_H_
+#define RECORDING_PLAYER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <ppapi/cpp/size.h>
+
+#include "fft_allocation.h"
+#include "recording_format.h"
+
+// Plays back a recording made by Recorder, in any order. Seeking decodes
+// forward from the nearest keyframe at or before the frame, or from the
+// current frame if that is closer, so playing in order decodes each frame
+// once. The keyframes come from the recording's index, so opening doesn't
+// read the frames.
+class RecordingPlayer {
+ public:
+  RecordingPlayer();
+
+  // |data| is not copied, so it may be mmap'd; it must outlive the player.
+  // Returns false if it is not a recording.
+  bool Open(const void* data, size_t size);
+
+  const pp::Size& size() const { return size_; }
+  int frame_count() const { return frame_count_; }
+  int current_frame() const { return current_; }
+  // The current frame, as 16-bit fixed point.
+  const AlignedUint16s& frame() const { return frame_; }
+
+  // Returns false if |index| is out of range or the frame is corrupt.
+  bool Seek(int index);
+
+ private:
+  // Reads the keyframe index described by |footer|, at the end of the |size|
+  // bytes. Returns false if it doesn't fit the recording.
+  bool ReadIndex(const RecordingFooter& footer, size_t size);
+  // Finds the keyframes by walking the frame headers, for a recording that
+  // was cut off before its index was written.
+  void ScanFrames();
+  // Decodes the frame at |offset| into values_, which must hold the frame
+  // before it unless it is a keyframe. Returns the offset of the next frame,
+  // or 0 if the frame is corrupt or isn't a keyframe when |keyframe| is set.
+  uint64_t Decode(uint64_t offset, bool keyframe);
+
+  const uint8_t* data_;
+  // Where the frames end: at the index, or at the end of a recording that
+  // was cut off.
+  uint64_t frames_end_;
+  pp::Size size_;
+  int precision_;
+  int frame_count_;
+  // The number of each keyframe, and the offset of its RecordingFrameHeader.
+  // Other frames are found by decoding forward from these.
+  std::vector<int> keyframes_;
+  std::vector<uint64_t> keyframe_offsets_;
+  int current_;
+  // The offset of the frame after current_.
+  uint64_t next_offset_;
+  // The quantized values of the current frame, and their dequantized copy.
+  std::vector<uint16_t> values_;
+  AlignedUint16s frame_;
+};
+
+#endif  // RECORDING_PLAYER_H_
@@ -0,0 +1,353 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "renderer.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#include "fixed16.h"
+#include "functions.h"
+#include "mip_pyramid.h"
+#include "palette.h"
+#include "thread_pool.h"
+
+namespace {
+
+void ExpandRow(const uint32_t* colors, const int* column_map, int width,
+               uint32_t* dst) {
+  int x = 0;
+  for (; x + 4 <= width; x += 4) {
+    uint32_t c0 = colors[column_map[x + 0]];
+    uint32_t c1 = colors[column_map[x + 1]];
+    uint32_t c2 = colors[column_map[x + 2]];
+    uint32_t c3 = colors[column_map[x + 3]];
+    dst[x + 0] = c0;
+    dst[x + 1] = c1;
+    dst[x + 2] = c2;
+    dst[x + 3] = c3;
+  }
+  for (; x < width; ++x)
+    dst[x] = colors[column_map[x]];
+}
+
+int Wrap(int x, int count) {
+  return (x % count + count) % count;
+}
+
+// Screen pixel |s| covers the source from |origin| + |s| * |step| to
+// |origin| + (|s| + 1) * |step|. Fills |map| with the source index of each
+// pixel's center.
+void ComputeMap(int screen_count, int buffer_count, double origin,
+                double step, std::vector<int>* map) {
+  map->resize(screen_count);
+  for (int s = 0; s < screen_count; ++s) {
+    double pos = origin + (s + 0.5) * step;
+    (*map)[s] = Wrap(static_cast<int>(floor(pos)), buffer_count);
+  }
+}
+
+// Computes |taps| source indexes and weights for each of |screen_count|
+// pixels, mapped as above. The indexes wrap, since the world is a torus.
+void ComputeTaps(int screen_count, int buffer_count, double origin,
+                 double step, int taps, std::vector<int>* indexes,
+                 std::vector<real>* weights) {
+  indexes->resize(screen_count * taps);
+  weights->resize(screen_count * taps);
+  for (int s = 0; s < screen_count; ++s) {
+    double pos = origin + (s + 0.5) * step - 0.5;
+    int i0 = static_cast<int>(floor(pos));
+    real t = pos - i0;
+    int* index = &(*indexes)[s * taps];
+    real* weight = &(*weights)[s * taps];
+    if (taps == 2) {
+      weight[0] = 1 - t;
+      weight[1] = t;
+    } else {
+      i0 -= 1;
+      weight[0] = ((-0.5 * t + 1) * t - 0.5) * t;
+      weight[1] = (1.5 * t - 2.5) * t * t + 1;
+      weight[2] = ((-1.5 * t + 2) * t + 0.5) * t;
+      weight[3] = (0.5 * t - 0.5) * t * t;
+    }
+    for (int k = 0; k < taps; ++k)
+      index[k] = Wrap(i0 + k, buffer_count);
+  }
+}
+
+}  // namespace
+
+template <typename T>
+struct Renderer::RenderTask {
+  void Run(int task) {
+    int height = renderer->screen_size_.height();
+    int begin = height * task / task_count;
+    int end = height * (task + 1) / task_count;
+    int buffer_width = renderer->buffer_size_.width();
+    if (renderer->filter_ == RENDER_FILTER_NEAREST) {
+      uint32_t* row_colors = &renderer->row_colors_[task * buffer_width];
+      renderer->RenderRows(*buffer, *palette, begin, end, row_colors, pixels);
+    } else {
+      int width = renderer->screen_size_.width();
+      real* values = &renderer->row_values_[task * (buffer_width + width)];
+      renderer->RenderRowsFiltered(*buffer, *palette, begin, end, values,
+                                   pixels);
+    }
+  }
+
+  Renderer* renderer;
+  const FftAllocation<T>* buffer;
+  const Palette* palette;
+  uint32_t* pixels;
+  int task_count;
+};
+
+Renderer::Renderer(ThreadPool* thread_pool)
+    : thread_pool_(thread_pool),
+      filter_(RENDER_FILTER_NEAREST),
+      scale_numer_(1),
+      scale_denom_(1),
+      viewport_(false),
+      center_x_(0),
+      center_y_(0),
+      zoom_(1),
+      mip_level_(0),
+      taps_(0) {
+}
+
+void Renderer::SetFilter(RenderFilter filter) {
+  filter_ = filter;
+  UpdateMaps();
+}
+
+void Renderer::SetScale(const pp::Size& buffer_size,
+                        const pp::Size& screen_size,
+                        int scale_numer, int scale_denom) {
+  buffer_size_ = buffer_size;
+  screen_size_ = screen_size;
+  scale_numer_ = scale_numer;
+  scale_denom_ = scale_denom;
+  viewport_ = false;
+  mip_level_ = 0;
+  UpdateMaps();
+}
+
+void Renderer::SetViewport(const pp::Size& buffer_size,
+                           const pp::Size& screen_size,
+                           double center_x, double center_y, double zoom) {
+  // Use the smallest level that still has at least one cell per pixel.
+  int max_level = MipPyramid::MaxLevel(buffer_size);
+  int level = 0;
+  while (level < max_level && zoom * (2 << level) <= 1)
+    ++level;
+
+  buffer_size_ = MipPyramid::LevelSize(buffer_size, level);
+  screen_size_ = screen_size;
+  viewport_ = true;
+  center_x_ = center_x;
+  center_y_ = center_y;
+  zoom_ = zoom;
+  mip_level_ = level;
+  UpdateMaps();
+}
+
+void Renderer::UpdateMaps() {
+  int screen_width = screen_size_.width();
+  int screen_height = screen_size_.height();
+  int buffer_width = buffer_size_.width();
+  int buffer_height = buffer_size_.height();
+  int scale_numer = scale_numer_;
+  int scale_denom = scale_denom_;
+  if (buffer_width == 0 || buffer_height == 0)
+    return;
+
+  double origin_x = 0;
+  double origin_y = 0;
+  double step = static_cast<double>(scale_numer) / scale_denom;
+  if (viewport_) {
+    double level_scale = 1 << mip_level_;
+    origin_x = (center_x_ - screen_width / (2 * zoom_)) / level_scale;
+    origin_y = (center_y_ - screen_height / (2 * zoom_)) / level_scale;
+    step = 1 / (zoom_ * level_scale);
+  }
+
+  if (filter_ != RENDER_FILTER_NEAREST) {
+    taps_ = filter_ == RENDER_FILTER_BILINEAR ? 2 : 4;
+    ComputeTaps(screen_width, buffer_width, origin_x, step, taps_,
+                &column_taps_, &column_weights_);
+    ComputeTaps(screen_height, buffer_height, origin_y, step, taps_,
+                &row_taps_, &row_weights_);
+    return;
+  }
+
+  if (viewport_) {
+    ComputeMap(screen_width, buffer_width, origin_x, step, &column_map_);
+    ComputeMap(screen_height, buffer_height, origin_y, step, &row_map_);
+    return;
+  }
+
+  column_map_.resize(screen_width);
+  row_map_.resize(screen_height);
+
+  // These follow the same stepping as the old per-pixel loop. x_accum is not
+  // reset when a row wraps, so the last columns before a wrap can step past
+  // the end of the row; the old loop then read the start of the next row
+  // (or past the end of the buffer, on the last row). Those columns now
+  // repeat the row's last cell instead; every other column is unchanged.
+  int no_wrap_width =
+      std::max(1, buffer_width * scale_denom / scale_numer);
+  int x_accum = 0;
+  int sx = 0;
+  while (sx < screen_width) {
+    int no_wrap_count = std::min(screen_width - sx, no_wrap_width);
+    int bx = 0;
+    for (int x = 0; x < no_wrap_count; ++x) {
+      column_map_[sx++] = std::min(bx, buffer_width - 1);
+      x_accum += scale_numer;
+      while (x_accum >= scale_denom) {
+        x_accum -= scale_denom;
+        ++bx;
+      }
+    }
+  }
+
+  int y_accum = 0;
+  int by = 0;
+  for (int sy = 0; sy < screen_height; ++sy) {
+    row_map_[sy] = by;
+    y_accum += scale_numer;
+    while (y_accum >= scale_denom) {
+      y_accum -= scale_denom;
+      if (++by == buffer_height)
+        by = 0;
+    }
+  }
+}
+
+void Renderer::Render(const AlignedReals& buffer, const Palette& palette,
+                      uint32_t* pixels) {
+  RenderT(buffer, palette, pixels);
+}
+
+void Renderer::Render(const AlignedUint16s& buffer, const Palette& palette,
+                      uint32_t* pixels) {
+  RenderT(buffer, palette, pixels);
+}
+
+template <typename T>
+void Renderer::RenderT(const FftAllocation<T>& buffer, const Palette& palette,
+                       uint32_t* pixels) {
+  if (buffer.size() != buffer_size_) {
+    // The buffer was resized without a new SetScale() or SetViewport(). Keep
+    // the same view, but map it on to the new size rather than show the
+    // last frame's pixels.
+    if (viewport_) {
+      buffer_size_ = buffer.size();
+      UpdateMaps();
+    } else {
+      SetScale(buffer.size(), screen_size_, scale_numer_, scale_denom_);
+    }
+  }
+
+  int screen_width = screen_size_.width();
+  int screen_height = screen_size_.height();
+  int buffer_width = buffer_size_.width();
+  if (screen_width == 0 || screen_height == 0 || buffer_width == 0)
+    return;
+
+  // Every band gets at least one row.
+  int task_count =
+      std::min(screen_height, std::max(1, thread_pool_->thread_count()));
+  if (filter_ == RENDER_FILTER_NEAREST)
+    row_colors_.resize(task_count * buffer_width);
+  else
+    row_values_.resize(task_count * (buffer_width + screen_width));
+
+  RenderTask<T> task;
+  task.renderer = this;
+  task.buffer = &buffer;
+  task.palette = &palette;
+  task.pixels = pixels;
+  task.task_count = task_count;
+  thread_pool_->Run(&task, task_count);
+}
+
+template <typename T>
+void Renderer::RenderRows(const FftAllocation<T>& buffer,
+                          const Palette& palette, int begin, int end,
+                          uint32_t* row_colors, uint32_t* pixels) const {
+  int screen_width = screen_size_.width();
+  int buffer_width = buffer_size_.width();
+  const int* column_map = &column_map_[0];
+  uint32_t* dst = pixels + begin * screen_width;
+  // The bands don't share anything, so each starts by converting its first
+  // source row.
+  int last_by = -1;
+  for (int sy = begin; sy < end; ++sy, dst += screen_width) {
+    int by = row_map_[sy];
+    if (by == last_by) {
+      // Rows are usually repeated when scaling up; copy the previous one.
+      memcpy(dst, dst - screen_width, screen_width * sizeof(uint32_t));
+      continue;
+    }
+
+    palette.GetColors(buffer.data() + by * buffer_width, buffer_width,
+                      row_colors);
+    ExpandRow(row_colors, column_map, screen_width, dst);
+    last_by = by;
+  }
+}
+
+template <typename T>
+void Renderer::RenderRowsFiltered(const FftAllocation<T>& buffer,
+                                  const Palette& palette, int begin, int end,
+                                  real* values, uint32_t* pixels) const {
+  int screen_width = screen_size_.width();
+  int buffer_width = buffer_size_.width();
+  int taps = taps_;
+  real* column = values;
+  real* row = values + buffer_width;
+  const int* column_taps = &column_taps_[0];
+  const real* column_weights = &column_weights_[0];
+  uint32_t* dst = pixels + begin * screen_width;
+  for (int sy = begin; sy < end; ++sy, dst += screen_width) {
+    // Filter vertically first, over the whole source row; these loops are
+    // contiguous, so the compiler can vectorize them.
+    const int* row_taps = &row_taps_[sy * taps];
+    const real* row_weights = &row_weights_[sy * taps];
+    const T* src = buffer.data() + row_taps[0] * buffer_width;
+    real w = row_weights[0];
+    for (int x = 0; x < buffer_width; ++x)
+      column[x] = w * LoadState(src[x]);
+    for (int k = 1; k < taps; ++k) {
+      src = buffer.data() + row_taps[k] * buffer_width;
+      w = row_weights[k];
+      for (int x = 0; x < buffer_width; ++x)
+        column[x] += w * LoadState(src[x]);
+    }
+
+    // Then horizontally, for each screen pixel. Bicubic filtering overshoots,
+    // so the result is clamped before the palette lookup.
+    for (int x = 0; x < screen_width; ++x) {
+      const int* index = &column_taps[x * taps];
+      const real* weight = &column_weights[x * taps];
+      real value = 0;
+      for (int k = 0; k < taps; ++k)
+        value += weight[k] * column[index[k]];
+      row[x] = clamp01(value);
+    }
+    palette.GetColors(row, screen_width, dst);
+  }
+}
@@ -0,0 +1,119 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RENDERER_H_
+#define RENDERER_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include <ppapi/cpp/size.h>
+
+#include "fft_allocation.h"
+
+class Palette;
+class ThreadPool;
+
+enum RenderFilter {
+  RENDER_FILTER_NEAREST,
+  RENDER_FILTER_BILINEAR,
+  // Catmull-Rom.
+  RENDER_FILTER_BICUBIC
+};
+
+// Scales the simulation state to the screen, tiling it in the longer
+// dimension. The source column and row of every screen pixel are computed
+// once, in SetScale(), so Render() only converts each needed source row to
+// colors and then copies them out. The screen rows are split into bands that
+// are rendered in parallel on |thread_pool|.
+//
+// The filtered modes interpolate the state before the palette lookup, so the
+// colors blend as they would in a larger simulation. The source taps and
+// weights of every screen row and column are also computed in SetScale().
+class Renderer {
+ public:
+  explicit Renderer(ThreadPool* thread_pool);
+
+  RenderFilter filter() const { return filter_; }
+  void SetFilter(RenderFilter filter);
+
+  // The screen is |scale_denom| / |scale_numer| times larger than the buffer.
+  // Must be called again whenever any of these change.
+  void SetScale(const pp::Size& buffer_size, const pp::Size& screen_size,
+                int scale_numer, int scale_denom);
+
+  // Instead of fitting the whole buffer to the screen, shows the buffer
+  // centered on (|center_x|, |center_y|), at |zoom| screen pixels per cell.
+  // When zoomed out, the view is rendered from mip_level() of the buffer's
+  // MipPyramid instead of the buffer itself. SetScale() turns this off.
+  void SetViewport(const pp::Size& buffer_size, const pp::Size& screen_size,
+                   double center_x, double center_y, double zoom);
+  int mip_level() const { return mip_level_; }
+
+  // |buffer| must be mip_level() of the buffer. |pixels| must hold
+  // screen_size.width() * screen_size.height() values.
+  void Render(const AlignedReals& buffer, const Palette& palette,
+              uint32_t* pixels);
+  void Render(const AlignedUint16s& buffer, const Palette& palette,
+              uint32_t* pixels);
+
+ private:
+  template <typename T>
+  struct RenderTask;
+
+  void UpdateMaps();
+  template <typename T>
+  void RenderT(const FftAllocation<T>& buffer, const Palette& palette,
+               uint32_t* pixels);
+  // Renders screen rows [begin, end). |row_colors| holds one source row.
+  template <typename T>
+  void RenderRows(const FftAllocation<T>& buffer, const Palette& palette,
+                  int begin, int end, uint32_t* row_colors,
+                  uint32_t* pixels) const;
+  // Same as above, for the filtered modes. |values| holds one source row and
+  // one screen row.
+  template <typename T>
+  void RenderRowsFiltered(const FftAllocation<T>& buffer,
+                          const Palette& palette, int begin, int end,
+                          real* values, uint32_t* pixels) const;
+
+  ThreadPool* thread_pool_;
+  RenderFilter filter_;
+  // The size of the buffer that is rendered; with a viewport, this is the
+  // size of its mip level.
+  pp::Size buffer_size_;
+  pp::Size screen_size_;
+  int scale_numer_;
+  int scale_denom_;
+  bool viewport_;
+  double center_x_;
+  double center_y_;
+  double zoom_;
+  int mip_level_;
+  // The source x of each screen column, and the source y of each screen row.
+  std::vector<int> column_map_;
+  std::vector<int> row_map_;
+  // For the filtered modes, |taps_| source indexes and weights for each screen
+  // column and row.
+  int taps_;
+  std::vector<int> column_taps_;
+  std::vector<real> column_weights_;
+  std::vector<int> row_taps_;
+  std::vector<real> row_weights_;
+  // Scratch for each band.
+  std::vector<uint32_t> row_colors_;
+  std::vector<real> row_values_;
+};
+
+#endif  // RENDERER_H_
@@ -0,0 +1,217 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "replay_log.h"
+
+#include <string.h>
+#include <algorithm>
+
+namespace {
+
+const size_t kEventAlignment = 8;
+
+size_t AlignEventSize(size_t size) {
+  return (size + kEventAlignment - 1) & ~(kEventAlignment - 1);
+}
+
+template <typename T>
+void AppendPayload(const T& value, std::vector<uint8_t>* payload) {
+  size_t offset = payload->size();
+  payload->resize(offset + sizeof(value));
+  memcpy(&(*payload)[offset], &value, sizeof(value));
+}
+
+// Copies the T at |*offset| of |data| and moves past it.
+template <typename T>
+bool ReadPayload(const uint8_t* data, size_t size, size_t* offset,
+                 T* value) {
+  if (size - *offset < sizeof(T))
+    return false;
+  memcpy(value, data + *offset, sizeof(T));
+  *offset += sizeof(T);
+  return true;
+}
+
+}  // namespace
+
+ReplayKernel MakeReplayKernel(const KernelConfig& config) {
+  ReplayKernel kernel;
+  kernel.disc_radius = config.disc_radius;
+  kernel.ring_radius = config.ring_radius;
+  kernel.blend_radius = config.blend_radius;
+  return kernel;
+}
+
+KernelConfig GetReplayKernel(const ReplayKernel& kernel) {
+  KernelConfig config;
+  config.disc_radius = kernel.disc_radius;
+  config.ring_radius = kernel.ring_radius;
+  config.blend_radius = kernel.blend_radius;
+  return config;
+}
+
+ReplaySmoother MakeReplaySmoother(const SmootherConfig& config) {
+  ReplaySmoother smoother;
+  memset(&smoother, 0, sizeof(smoother));
+  smoother.timestep_type = config.timestep.type;
+  smoother.integrator = config.timestep.integrator;
+  smoother.timestep_dt = config.timestep.dt;
+  smoother.dt_min = config.timestep.dt_min;
+  smoother.dt_max = config.timestep.dt_max;
+  smoother.tolerance = config.timestep.tolerance;
+  smoother.b1 = config.b1;
+  smoother.d1 = config.d1;
+  smoother.b2 = config.b2;
+  smoother.d2 = config.d2;
+  smoother.sigmoid_mode = config.mode;
+  smoother.sigmoid = config.sigmoid;
+  smoother.mix = config.mix;
+  smoother.sn = config.sn;
+  smoother.sm = config.sm;
+  return smoother;
+}
+
+SmootherConfig GetReplaySmoother(const ReplaySmoother& smoother) {
+  SmootherConfig config;
+  config.timestep.type = static_cast<Timestep>(smoother.timestep_type);
+  config.timestep.integrator = static_cast<Integrator>(smoother.integrator);
+  config.timestep.dt = smoother.timestep_dt;
+  config.timestep.dt_min = smoother.dt_min;
+  config.timestep.dt_max = smoother.dt_max;
+  config.timestep.tolerance = smoother.tolerance;
+  config.b1 = smoother.b1;
+  config.d1 = smoother.d1;
+  config.b2 = smoother.b2;
+  config.d2 = smoother.d2;
+  config.mode = static_cast<SigmoidMode>(smoother.sigmoid_mode);
+  config.sigmoid = static_cast<Sigmoid>(smoother.sigmoid);
+  config.mix = static_cast<Sigmoid>(smoother.mix);
+  config.sn = smoother.sn;
+  config.sm = smoother.sm;
+  return config;
+}
+
+void MakeReplayKernelSet(const KernelSetConfig& config,
+                         std::vector<uint8_t>* payload) {
+  payload->clear();
+  for (size_t i = 0; i < config.profiles.size(); ++i) {
+    const KernelProfile& profile = config.profiles[i];
+    ReplayKernelProfile event;
+    memset(&event, 0, sizeof(event));
+    event.shell_count = static_cast<uint32_t>(profile.shells.size());
+    event.mu = profile.growth.mu;
+    event.sigma = profile.growth.sigma;
+    event.weight = profile.growth.weight;
+    AppendPayload(event, payload);
+    for (size_t j = 0; j < profile.shells.size(); ++j) {
+      const KernelShell& shell = profile.shells[j];
+      ReplayKernelShell shell_event;
+      memset(&shell_event, 0, sizeof(shell_event));
+      shell_event.type = shell.type;
+      shell_event.radius = shell.radius;
+      shell_event.width = shell.width;
+      shell_event.weight = shell.weight;
+      AppendPayload(shell_event, payload);
+    }
+  }
+}
+
+bool GetReplayKernelSet(const void* payload, size_t size,
+                        KernelSetConfig* config) {
+  const uint8_t* data = static_cast<const uint8_t*>(payload);
+  size_t offset = 0;
+  config->profiles.clear();
+  while (offset < size) {
+    ReplayKernelProfile event;
+    if (!ReadPayload(data, size, &offset, &event) ||
+        event.shell_count > static_cast<uint32_t>(kMaxKernelShells) ||
+        config->profiles.size() >= static_cast<size_t>(kMaxKernelSetSize))
+      return false;
+
+    KernelProfile profile;
+    profile.growth.mu = event.mu;
+    profile.growth.sigma = event.sigma;
+    profile.growth.weight = event.weight;
+    for (uint32_t i = 0; i < event.shell_count; ++i) {
+      ReplayKernelShell shell_event;
+      if (!ReadPayload(data, size, &offset, &shell_event) ||
+          shell_event.type < KERNEL_SHELL_RING ||
+          shell_event.type > KERNEL_SHELL_GAUSSIAN)
+        return false;
+      KernelShell shell;
+      shell.type = static_cast<KernelShellType>(shell_event.type);
+      shell.radius = shell_event.radius;
+      shell.width = shell_event.width;
+      shell.weight = shell_event.weight;
+      profile.shells.push_back(shell);
+    }
+    config->profiles.push_back(profile);
+  }
+  return true;
+}
+
+ReplayLogWriter::ReplayLogWriter() {
+  ReplayLogHeader header;
+  header.magic = kReplayLogMagic;
+  header.version = kReplayLogVersion;
+  data_.resize(sizeof(header));
+  memcpy(&data_[0], &header, sizeof(header));
+}
+
+void ReplayLogWriter::AddEvent(ReplayEventType type, const void* payload,
+                               size_t size) {
+  ReplayEventHeader header;
+  header.type = type;
+  header.size = static_cast<uint32_t>(size);
+  size_t offset = data_.size();
+  // Padding is zeroed by resize().
+  data_.resize(offset + sizeof(header) + AlignEventSize(size));
+  memcpy(&data_[offset], &header, sizeof(header));
+  if (size > 0)
+    memcpy(&data_[offset + sizeof(header)], payload, size);
+}
+
+ReplayLogReader::ReplayLogReader() : data_(NULL), size_(0), offset_(0) {}
+
+bool ReplayLogReader::Open(const void* data, size_t size) {
+  ReplayLogHeader header;
+  if (size < sizeof(header))
+    return false;
+  memcpy(&header, data, sizeof(header));
+  if (header.magic != kReplayLogMagic || header.version != kReplayLogVersion)
+    return false;
+
+  data_ = static_cast<const uint8_t*>(data);
+  size_ = size;
+  offset_ = sizeof(header);
+  return true;
+}
+
+bool ReplayLogReader::Next(ReplayEventType* type, const void** payload,
+                           size_t* size) {
+  ReplayEventHeader header;
+  if (size_ - offset_ < sizeof(header))
+    return false;
+  memcpy(&header, data_ + offset_, sizeof(header));
+  if (header.type >= NUM_REPLAY_EVENTS ||
+      size_ - offset_ - sizeof(header) < header.size)
+    return false;
+
+  *type = static_cast<ReplayEventType>(header.type);
+  *payload = data_ + offset_ + sizeof(header);
+  *size = header.size;
+  offset_ = std::min(size_,
+                     offset_ + sizeof(header) + AlignEventSize(header.size));
+  return true;
+}
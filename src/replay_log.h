@@ -0,0 +1,212 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REPLAY_LOG_H_
+#define REPLAY_LOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "kernel_config.h"
+#include "kernel_set_config.h"
+#include "smoother_config.h"
+
+// A replay log is a ReplayLogHeader, then a ReplayEventHeader for every
+// change made to a simulation, each followed by its payload and padded to a
+// multiple of 8 bytes. The first event is always a checkpoint of the world
+// when logging started, so replaying the events in order repeats exactly
+// the same work. Fields are in host byte order; readers reject a log of the
+// other byte order by its magic.
+const uint32_t kReplayLogMagic = 0x4c524d53;  // "SMRL"
+const uint32_t kReplayLogVersion = 4;
+
+enum ReplayEventType {
+  // A checkpoint; see checkpoint.h.
+  REPLAY_EVENT_CHECKPOINT,
+  REPLAY_EVENT_CLEAR,  // ReplayClear.
+  REPLAY_EVENT_SET_SIZE,  // ReplaySize.
+  REPLAY_EVENT_SET_KERNEL,  // ReplayKernel.
+  REPLAY_EVENT_SET_SMOOTHER,  // ReplaySmoother.
+  REPLAY_EVENT_SET_OPTION,  // ReplayOption.
+  // Splats with the simulation's random numbers; no payload.
+  REPLAY_EVENT_SPLAT,
+  REPLAY_EVENT_CIRCLE,  // ReplayCircle.
+  // One simulation step; no payload.
+  REPLAY_EVENT_STEP,
+  // The end of a displayed frame; ReplayFrame.
+  REPLAY_EVENT_FRAME,
+  REPLAY_EVENT_SEED,  // ReplaySeed.
+  REPLAY_EVENT_SET_NOISE,  // ReplayNoise.
+  // A batch of brush strokes; an array of ReplayCapsule.
+  REPLAY_EVENT_CAPSULES,
+  // A kernel set: a ReplayKernelProfile per kernel, each followed by its
+  // shells as ReplayKernelShells. Empty to go back to the disc and ring.
+  REPLAY_EVENT_SET_KERNEL_SET,
+  NUM_REPLAY_EVENTS
+};
+
+enum ReplayOptionType {
+  REPLAY_OPTION_COMPACT,
+  REPLAY_OPTION_FUSED_DISPLAY,
+  REPLAY_OPTION_ACTIVITY_DETECTION
+};
+
+struct ReplayLogHeader {
+  uint32_t magic;
+  uint32_t version;
+};
+
+struct ReplayEventHeader {
+  uint32_t type;  // A ReplayEventType.
+  uint32_t size;  // Of the payload, without padding.
+};
+
+struct ReplayClear {
+  double color;
+};
+
+struct ReplaySize {
+  int32_t width;
+  int32_t height;
+  // Nonzero for Simulation::Resize(), zero for Simulation::SetSize().
+  int32_t resample;
+  int32_t scale_kernel;
+};
+
+struct ReplayKernel {
+  double disc_radius;
+  double ring_radius;
+  double blend_radius;
+};
+
+struct ReplaySmoother {
+  int32_t timestep_type;
+  int32_t integrator;
+  double timestep_dt;
+  double dt_min;
+  double dt_max;
+  double tolerance;
+  double b1;
+  double d1;
+  double b2;
+  double d2;
+  int32_t sigmoid_mode;
+  int32_t sigmoid;
+  int32_t mix;
+  int32_t reserved;
+  double sn;
+  double sm;
+};
+
+struct ReplayOption {
+  uint32_t option;  // A ReplayOptionType.
+  int32_t value;
+};
+
+struct ReplaySeed {
+  uint64_t seed;
+};
+
+struct ReplayNoise {
+  double amount;
+};
+
+struct ReplayCircle {
+  double x;
+  double y;
+  double radius;
+  double color;
+};
+
+struct ReplayCapsule {
+  double x0;
+  double y0;
+  double x1;
+  double y1;
+  double radius;
+  double color;
+};
+
+struct ReplayKernelProfile {
+  uint32_t shell_count;
+  int32_t reserved;
+  double mu;
+  double sigma;
+  double weight;
+};
+
+struct ReplayKernelShell {
+  int32_t type;  // A KernelShellType.
+  int32_t reserved;
+  double radius;
+  double width;
+  double weight;
+};
+
+struct ReplayFrame {
+  // Steps since the previous frame.
+  uint32_t steps;
+  // StepStats::hash after the last step, to check that a replay matches.
+  uint32_t hash;
+  // How long the frame's events took when they were logged.
+  double elapsed_ms;
+};
+
+ReplayKernel MakeReplayKernel(const KernelConfig& config);
+KernelConfig GetReplayKernel(const ReplayKernel& kernel);
+ReplaySmoother MakeReplaySmoother(const SmootherConfig& config);
+SmootherConfig GetReplaySmoother(const ReplaySmoother& smoother);
+void MakeReplayKernelSet(const KernelSetConfig& config,
+                         std::vector<uint8_t>* payload);
+// Returns false if |payload| is malformed or over the limits in
+// kernel_set_config.h.
+bool GetReplayKernelSet(const void* payload, size_t size,
+                        KernelSetConfig* config);
+
+class ReplayLogWriter {
+ public:
+  ReplayLogWriter();
+
+  const std::vector<uint8_t>& data() const { return data_; }
+
+  void AddEvent(ReplayEventType type, const void* payload, size_t size);
+  template <typename T>
+  void AddEvent(ReplayEventType type, const T& payload) {
+    AddEvent(type, &payload, sizeof(payload));
+  }
+
+ private:
+  std::vector<uint8_t> data_;
+};
+
+// Reads the events of a log in order. The payloads point into the log.
+class ReplayLogReader {
+ public:
+  ReplayLogReader();
+
+  // |data| is not copied, so it may be mmap'd; it must outlive the reader
+  // and be aligned to 8 bytes. Returns false if it is not a replay log.
+  bool Open(const void* data, size_t size);
+
+  // Returns false at the end of the log, or if the next event was cut off.
+  bool Next(ReplayEventType* type, const void** payload, size_t* size);
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+  size_t offset_;
+};
+
+#endif  // REPLAY_LOG_H_
@@ -0,0 +1,115 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RNG_H_
+#define RNG_H_
+
+#include <stdint.h>
+
+#include "functions.h"
+
+const uint64_t kGoldenGamma = 0x9e3779b97f4a7c15ULL;
+
+// The SplitMix64 finalizer: a bijection that scrambles every input bit into
+// every output bit.
+inline uint64_t MixBits(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+// Maps the top 24 bits of |x| to [0, 1). float holds every result exactly,
+// so it never rounds up to 1.
+inline real BitsToUnit(uint64_t x) {
+  return static_cast<real>(static_cast<int32_t>(x >> 40) *
+                           (1.0 / 16777216.0));
+}
+
+// A counter-based generator: the |counter|th value of the stream |key|,
+// uniform in [0, 1). Any value can be computed without the ones before it,
+// so threads can split a stream between them however they like.
+inline real CounterToUnit(uint64_t key, uint64_t counter) {
+  return BitsToUnit(MixBits(key + counter * kGoldenGamma));
+}
+
+// xoshiro256** (Blackman and Vigna). Each generator owns its state, unlike
+// rand(), so threads can draw from their own without locking, and a run can
+// be repeated from its seed.
+class Rng {
+ public:
+  explicit Rng(uint64_t seed = 0, uint64_t stream = 0) {
+    Seed(seed, stream);
+  }
+
+  // Every (seed, stream) pair starts an unrelated sequence, so work split
+  // into numbered pieces can give each piece its own stream. The state is
+  // filled with SplitMix64, so it is never all zero.
+  void Seed(uint64_t seed, uint64_t stream = 0) {
+    uint64_t x = seed ^ MixBits(stream + kGoldenGamma);
+    for (int i = 0; i < 4; ++i)
+      state_[i] = MixBits(x += kGoldenGamma);
+  }
+
+  uint64_t Next() {
+    uint64_t result = Rotate(state_[1] * 5, 7) * 9;
+    uint64_t t = state_[1] << 17;
+    state_[2] ^= state_[0];
+    state_[3] ^= state_[1];
+    state_[1] ^= state_[2];
+    state_[0] ^= state_[3];
+    state_[2] ^= t;
+    state_[3] = Rotate(state_[3], 45);
+    return result;
+  }
+
+  // Uniform in [0, 1).
+  real NextUnit() { return BitsToUnit(Next()); }
+
+  const uint64_t* state() const { return state_; }
+  // An all-zero state would only ever return zero, so it is ignored.
+  void SetState(const uint64_t state[4]) {
+    if ((state[0] | state[1] | state[2] | state[3]) == 0)
+      return;
+    for (int i = 0; i < 4; ++i)
+      state_[i] = state[i];
+  }
+
+ private:
+  static uint64_t Rotate(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+  }
+
+  uint64_t state_[4];
+};
+
+// Uniform noise in [-amount, amount], added to each new value of a step and
+// clamped. The noise of a cell depends only on |key| and the cell's index,
+// so it is the same however the state is split between threads.
+struct StepNoise {
+  StepNoise(real amount, uint64_t key) : amount(amount), key(key) {}
+
+  real Add(int index, real value) const {
+    return clamp01(value + amount * (2 * CounterToUnit(key, index) - 1));
+  }
+
+  real amount;
+  uint64_t key;
+};
+
+// Used when no noise is wanted; the calls compile away.
+struct NullStepNoise {
+  real Add(int, real value) const { return value; }
+};
+
+#endif  // RNG_H_
@@ -16,14 +16,32 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <limits>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+#include <vector>
 
+#include "check.h"
+#include "checkpoint.h"
+#include "fftw_threads.h"
+#include "fixed16.h"
+#include "functions.h"
 #include "timer.h"
 #include "wisdom.h"
 
 namespace {
 
+// Longest cycle that is cached for replay. A 512x512 cycle of this length
+// takes 8MB.
+const int kMaxCachedPeriod = 16;
+// An adaptive step that is rejected this many times is taken at dt_min, so
+// a step costs a bounded number of convolutions.
+const int kMaxRejectedSteps = 32;
+// While replaying a cycle, every this many steps a real step is taken
+// instead, and the replay stops if its hash isn't the recorded one.
+const int kCycleCheckSteps = 64;
+
 void MultiplyComplex(const AlignedComplexes& in1,
                      const AlignedComplexes& in2,
                      AlignedComplexes* out) {
@@ -40,40 +58,192 @@ void MultiplyComplex(const AlignedComplexes& in1,
   }
 }
 
-real RND(real x) {
-  return x * (real)rand()/((real)RAND_MAX + 1);
+// Checkpoint states may have been saved with a different precision.
+real ReadValue(float x) { return x; }
+real ReadValue(double x) { return x; }
+real ReadValue(uint16_t x) { return UnpackFixed16(x); }
+
+// Converts |count| values of any checkpoint state format to real or fixed16.
+template <typename T, typename S>
+void ConvertState(const S* in, int count, T* out) {
+  for (int i = 0; i < count; ++i)
+    out[i] = StoreState(ReadValue(in[i]), out);
 }
 
-}  // namespace
+template <typename T>
+void ReadState(const void* in, uint32_t format, FftAllocation<T>* out) {
+  int count = out->count();
+  switch (format) {
+    case CHECKPOINT_STATE_FLOAT32:
+      ConvertState(static_cast<const float*>(in), count, out->data());
+      break;
+    case CHECKPOINT_STATE_FLOAT64:
+      ConvertState(static_cast<const double*>(in), count, out->data());
+      break;
+    case CHECKPOINT_STATE_FIXED16:
+      ConvertState(static_cast<const uint16_t*>(in), count, out->data());
+      break;
+  }
+}
+
+void UnpackState(const AlignedUint16s& in, AlignedReals* out) {
+  int count = in.count();
+  assert(count == out->count());
+
+  const uint16_t* src = in.data();
+  real* dst = out->data();
+  for (int i = 0; i < count; ++i)
+    dst[i] = UnpackFixed16(src[i]);
+}
+
+// out = clamp01(a + h * k)
+template <typename T, typename U, typename S>
+void AddScaled(const FftAllocation<T>& a, real h, const AlignedReals& k,
+               FftAllocation<U>* out, S* stats) {
+  int count = a.count();
+  const T* ap = a.data();
+  const real* kp = k.data();
+  U* outp = out->data();
+  for (int i = 0; i < count; ++i) {
+    real old_value = LoadState(ap[i]);
+    real value = clamp01(old_value + h * kp[i]);
+    outp[i] = StoreState(value, outp);
+    stats->Add(i, old_value, value);
+  }
+}
+
+// stage = clamp01(a + h * k), sum += w * k
+template <typename T>
+void RungeKuttaStage(const FftAllocation<T>& a, real h, real w,
+                     const AlignedReals& k, AlignedReals* stage,
+                     AlignedReals* sum) {
+  int count = a.count();
+  const T* ap = a.data();
+  const real* kp = k.data();
+  real* stagep = stage->data();
+  real* sump = sum->data();
+  for (int i = 0; i < count; ++i) {
+    stagep[i] = clamp01(LoadState(ap[i]) + h * kp[i]);
+    sump[i] += w * kp[i];
+  }
+}
+
+// a = clamp01(a + h * (sum + k))
+template <typename T>
+void RungeKuttaFinish(real h, const AlignedReals& sum, const AlignedReals& k,
+                      FftAllocation<T>* a, StepStats* stats) {
+  int count = a->count();
+  const real* sump = sum.data();
+  const real* kp = k.data();
+  T* ap = a->data();
+  for (int i = 0; i < count; ++i) {
+    real old_value = LoadState(ap[i]);
+    real value = clamp01(old_value + h * (sump[i] + kp[i]));
+    ap[i] = StoreState(value, ap);
+    stats->Add(i, old_value, value);
+  }
+}
+
+// Copies the frequencies that both sizes can represent from |in| to |out|,
+// scaled by |scale|, and zeroes the rest. Nyquist frequencies are dropped,
+// since they have no unique counterpart at the other size. Both are r2c
+// transforms; see MakePlans() for their layout.
+void ResampleSpectrum(const AlignedComplexes& in, const pp::Size& in_size,
+                      AlignedComplexes* out, const pp::Size& out_size,
+                      real scale) {
+  int in_stride = in_size.width() / 2 + 1;
+  int out_stride = out_size.width() / 2 + 1;
+  int limit0 = (std::min(in_size.height(), out_size.height()) - 1) / 2;
+  int limit1 = (std::min(in_size.width(), out_size.width()) - 1) / 2;
+  for (int j0 = 0; j0 < out_size.height(); ++j0) {
+    int f = j0 <= out_size.height() / 2 ? j0 : j0 - out_size.height();
+    int k0 = f >= 0 ? f : f + in_size.height();
+    fftw_complex* dst = out->data() + j0 * out_stride;
+    for (int j1 = 0; j1 < out_stride; ++j1) {
+      if (abs(f) > limit0 || j1 > limit1) {
+        dst[j1][0] = 0;
+        dst[j1][1] = 0;
+      } else {
+        const fftw_complex& src = in[k0 * in_stride + j1];
+        dst[j1][0] = src[0] * scale;
+        dst[j1][1] = src[1] * scale;
+      }
+    }
+  }
+}
+
+real MaxAbsDifference(const AlignedReals& in1, const AlignedReals& in2) {
+  int count = in1.count();
+  assert(count == in2.count());
+
+  const real* p1 = in1.data();
+  const real* p2 = in2.data();
+  real result = 0;
+  for (int i = 0; i < count; ++i) {
+    real difference = fabs(p1[i] - p2[i]);
+    if (difference > result)
+      result = difference;
+    else if (difference != difference)
+      return difference;  // NaN; std::max would drop it.
+  }
+  return result;
+}
+
+template <typename T>
+void AddNoise(const StepNoise& noise, FftAllocation<T>* state) {
+  int count = state->count();
+  T* p = state->data();
+  for (int i = 0; i < count; ++i)
+    p[i] = StoreState(noise.Add(i, LoadState(p[i])), p);
+}
 
-#define CHECK(x) \
-  do { \
-    int CHECK_result = (int)x; \
-    if (!CHECK_result) { \
-      printf("%s failed.\n", #x); \
-      exit(1); \
-    } \
-  } while(0)
+}  // namespace
 
 Simulation::Simulation(const SimulationConfig& config)
   : size_(config.size),
+    thread_pool_(config.thread_count),
     kernel_(config.size, config.kernel_config),
-    smoother_(config.size, config.smoother_config),
+    smoother_(config.size, config.smoother_config, &thread_pool_),
+    kernel_set_(config.size),
+    base_kernel_config_(config.kernel_config),
+    base_kernel_size_(config.size),
+    base_kernel_set_size_(config.size),
 #ifdef USE_THREADS
     thread_count_(config.thread_count),
 #endif
-    aa_(config.size),
+    compact_(config.compact_state),
+    aa_(compact_ ? pp::Size() : config.size),
+    packed_(compact_ ? config.size : pp::Size()),
     an_(config.size),
     am_(config.size),
     aaf_(config.size, ReduceSizeForComplex()),
     tempf_(config.size, ReduceSizeForComplex()),
+    kernel_set_products_(pp::Size()),
+    kernel_set_convolutions_(pp::Size()),
+    fused_display_(false),
+    display_(pp::Size()),
+    display_valid_(false),
+    rk_stage_(pp::Size()),
+    rk_rate_(pp::Size()),
+    rk_sum_(pp::Size()),
+    adaptive_dt_(config.smoother_config.timestep.dt),
+    detect_activity_(config.detect_activity),
+    collect_stats_(false),
+    rng_(config.seed),
+    noise_(0),
+    cycle_(pp::Size()),
+    cycle_period_(0),
+    cycle_frames_(0),
+    cycle_replaying_(false),
+    cycle_replay_steps_(0),
     aa_plan_(NULL),
     an_plan_(NULL),
-    am_plan_(NULL) {
+    am_plan_(NULL),
+    kernel_set_plan_(NULL) {
 #ifdef USE_THREADS
-  CHECK(fftw_init_threads());
-  fftw_plan_with_nthreads(thread_count_);
+  AcquireFftwThreads();
 #endif
+  UpdateScratch();
   // I haven't made any ARM wisdom yet; it requires building sel_ldr_arm, and
   // running fftw-wisdom under QEMU.
 #if defined(USE_WISDOM) && !defined(__arm__)
@@ -86,15 +256,37 @@ Simulation::Simulation(const SimulationConfig& config)
 
 void Simulation::MakePlans() {
   DestroyPlans();
-  aa_plan_ = fftw_plan_dft_r2c_2d(size_.width(), size_.height(),
-                                  aa_.data(), aaf_.data(), FFTW_ESTIMATE);
-  an_plan_ = fftw_plan_dft_c2r_2d(size_.width(), size_.height(),
+#ifdef USE_THREADS
+  fftw_plan_with_nthreads(thread_count_);
+#endif
+  // In compact mode the state is expanded into am_ before the forward
+  // transform; am_ is not needed again until the last inverse transform.
+  real* aa_input = compact_ ? am_.data() : aa_.data();
+  // The state is row-major, so the height is FFTW's first (slowest-varying)
+  // dimension, and the spectra have height * (width / 2 + 1) values.
+  aa_plan_ = fftw_plan_dft_r2c_2d(size_.height(), size_.width(),
+                                  aa_input, aaf_.data(), FFTW_ESTIMATE);
+  an_plan_ = fftw_plan_dft_c2r_2d(size_.height(), size_.width(),
                                   tempf_.data(), an_.data(), FFTW_ESTIMATE);
-  am_plan_ = fftw_plan_dft_c2r_2d(size_.width(), size_.height(),
+  am_plan_ = fftw_plan_dft_c2r_2d(size_.height(), size_.width(),
                                   tempf_.data(), am_.data(), FFTW_ESTIMATE);
   CHECK(aa_plan_);
   CHECK(an_plan_);
   CHECK(am_plan_);
+
+  // All of the kernel set's inverse transforms are one plan, so FFTW can
+  // share its work between them, and threads get one large job instead of
+  // several small ones.
+  kernel_set_plan_ = NULL;
+  int kernel_count = kernel_set_.count();
+  if (kernel_count > 0) {
+    int n[2] = {size_.height(), size_.width()};
+    kernel_set_plan_ = fftw_plan_many_dft_c2r(
+        2, n, kernel_count, kernel_set_products_.data(), NULL, 1,
+        aaf_.count(), kernel_set_convolutions_.data(), NULL, 1,
+        size_.GetArea(), FFTW_ESTIMATE);
+    CHECK(kernel_set_plan_);
+  }
 }
 
 void Simulation::DestroyPlans() {
@@ -104,123 +296,691 @@ void Simulation::DestroyPlans() {
     fftw_destroy_plan(an_plan_);
   if (am_plan_)
     fftw_destroy_plan(am_plan_);
+  if (kernel_set_plan_)
+    fftw_destroy_plan(kernel_set_plan_);
 }
 
 Simulation::~Simulation() {
   DestroyPlans();
 #ifdef USE_THREADS
-  fftw_cleanup_threads();
+  ReleaseFftwThreads();
 #endif
 }
 
 #ifdef USE_THREADS
 void Simulation::SetThreadCount(int thread_count) {
   thread_count_ = thread_count;
-  fftw_plan_with_nthreads(thread_count_);
+  thread_pool_.SetThreadCount(thread_count);
   MakePlans();
 }
 #endif
 
 void Simulation::SetSize(const pp::Size& size) {
+  SetSizeAndKernelSet(size, kernel_set_.config());
+  base_kernel_config_ = kernel_.config();
+  base_kernel_size_ = size;
+  base_kernel_set_config_ = kernel_set_.config();
+  base_kernel_set_size_ = size;
+}
+
+void Simulation::SetSizeAndKernelSet(const pp::Size& size,
+                                     const KernelSetConfig& kernel_set_config) {
   size_ = size;
-  AlignedReals(size).swap(aa_);
+  AlignedReals(compact_ ? pp::Size() : size).swap(aa_);
+  AlignedUint16s(compact_ ? size : pp::Size()).swap(packed_);
   AlignedReals(size).swap(an_);
   AlignedReals(size).swap(am_);
   AlignedComplexes(size, ReduceSizeForComplex()).swap(aaf_);
   AlignedComplexes(size, ReduceSizeForComplex()).swap(tempf_);
+  AlignedUint16s(pp::Size()).swap(display_);
+  display_valid_ = false;
   kernel_.SetSize(size);
+  kernel_set_.SetSizeAndConfig(size, kernel_set_config);
   smoother_.SetSize(size);
+  UpdateScratch();
+  UpdateKernelSetBuffers();
   MakePlans();
+  ResetActivity();
+}
+
+void Simulation::Resize(const pp::Size& size, bool scale_kernel) {
+  // The state may have been drawn on since the last step, so aaf_ can't be
+  // reused as is; this is one forward transform with the existing plan.
+  if (compact_) {
+    UnpackState(packed_, &am_);
+    fftw_execute_dft_r2c(aa_plan_, am_.data(), aaf_.data());
+  } else {
+    fftw_execute_dft_r2c(aa_plan_, aa_.data(), aaf_.data());
+  }
+
+  // The inverse transform is unnormalized, so divide by the old size to get
+  // the same values back.
+  AlignedComplexes spectrum(size, ReduceSizeForComplex());
+  ResampleSpectrum(aaf_, size_, &spectrum, size,
+                   static_cast<real>(1) / size_.GetArea());
+  // The kernels are radial, so scale them by the geometric mean of the two
+  // axes. The kernel set's spectra are made once, at the new size and radii.
+  KernelSetConfig set_config = kernel_set_.config();
+  if (scale_kernel) {
+    real scale = sqrt(static_cast<real>(size.GetArea()) /
+                      base_kernel_set_size_.GetArea());
+    set_config = base_kernel_set_config_;
+    for (size_t i = 0; i < set_config.profiles.size(); ++i) {
+      std::vector<KernelShell>& shells = set_config.profiles[i].shells;
+      for (size_t j = 0; j < shells.size(); ++j) {
+        shells[j].radius *= scale;
+        shells[j].width *= scale;
+      }
+    }
+  }
+  SetSizeAndKernelSet(size, set_config);
+
+  real* out = compact_ ? am_.data() : aa_.data();
+  fftw_plan plan = fftw_plan_dft_c2r_2d(size_.height(), size_.width(),
+                                        spectrum.data(), out, FFTW_ESTIMATE);
+  CHECK(plan);
+  fftw_execute(plan);
+  fftw_destroy_plan(plan);
+
+  // Truncating the spectrum rings a little near sharp edges.
+  if (compact_) {
+    std::transform(am_.begin(), am_.end(), packed_.begin(), PackFixed16);
+  } else {
+    for (real* p = aa_.begin(); p != aa_.end(); ++p)
+      *p = clamp01(*p);
+  }
+
+  if (scale_kernel) {
+    real kernel_scale = sqrt(static_cast<real>(size.GetArea()) /
+                             base_kernel_size_.GetArea());
+    KernelConfig config = base_kernel_config_;
+    config.disc_radius *= kernel_scale;
+    config.ring_radius *= kernel_scale;
+    config.blend_radius *= kernel_scale;
+    kernel_.SetConfig(config);
+  } else {
+    base_kernel_config_ = kernel_.config();
+    base_kernel_size_ = size;
+    base_kernel_set_config_ = kernel_set_.config();
+    base_kernel_set_size_ = size;
+  }
+}
+
+size_t Simulation::CheckpointSize() const {
+  CheckpointHeader header;
+  InitCheckpointHeader(CheckpointFormat(), size_, &header);
+  return ::CheckpointSize(header);
+}
+
+CheckpointStateFormat Simulation::CheckpointFormat() const {
+  if (compact_)
+    return CHECKPOINT_STATE_FIXED16;
+  return sizeof(real) == sizeof(float) ? CHECKPOINT_STATE_FLOAT32
+                                       : CHECKPOINT_STATE_FLOAT64;
+}
+
+void Simulation::SaveCheckpoint(void* data) const {
+  CheckpointHeader* header = static_cast<CheckpointHeader*>(data);
+  InitCheckpointHeader(CheckpointFormat(), size_, header);
+  header->steps = integrator_stats_.steps;
+  header->time = integrator_stats_.time;
+  header->dt = integrator_stats_.dt;
+  SetCheckpointKernel(kernel_.config(), header);
+  SetCheckpointSmoother(smoother_.config(), header);
+  for (int i = 0; i < 4; ++i)
+    header->rng_state[i] = rng_.state()[i];
+
+  // The state is stored exactly as it is held, so this is one copy.
+  if (compact_)
+    memcpy(CheckpointState(data), packed_.data(), packed_.byte_size());
+  else
+    memcpy(CheckpointState(data), aa_.data(), aa_.byte_size());
+}
+
+bool Simulation::LoadCheckpoint(const void* data, size_t size) {
+  const CheckpointHeader* header = ReadCheckpointHeader(data, size);
+  if (!header)
+    return false;
+
+  pp::Size checkpoint_size(header->width, header->height);
+  if (checkpoint_size != size_)
+    SetSize(checkpoint_size);
+  SetKernel(GetCheckpointKernel(*header));
+  SetSmoother(GetCheckpointSmoother(*header));
+
+  // A checkpoint in the format the state is held in is copied as is;
+  // anything else is converted while copying.
+  const void* state = CheckpointState(data);
+  if (header->state_format == static_cast<uint32_t>(CheckpointFormat())) {
+    if (compact_)
+      memcpy(packed_.data(), state, packed_.byte_size());
+    else
+      memcpy(aa_.data(), state, aa_.byte_size());
+  } else if (compact_) {
+    ReadState(state, header->state_format, &packed_);
+  } else {
+    ReadState(state, header->state_format, &aa_);
+  }
+
+  integrator_stats_ = IntegratorStats();
+  integrator_stats_.steps = header->steps;
+  integrator_stats_.time = header->time;
+  integrator_stats_.dt = header->dt;
+  if (header->dt > 0)
+    adaptive_dt_ = header->dt;
+  // An all-zero random state means the checkpoint has none.
+  rng_.SetState(header->rng_state);
+  display_valid_ = false;
+  ResetActivity();
+  return true;
 }
 
 void Simulation::SetKernel(const KernelConfig& config) {
   kernel_.SetConfig(config);
+  base_kernel_config_ = config;
+  base_kernel_size_ = size_;
+  ResetActivity();
+}
+
+void Simulation::SetKernelSet(const KernelSetConfig& config) {
+  kernel_set_.SetConfig(config);
+  base_kernel_set_config_ = config;
+  base_kernel_set_size_ = size_;
+  std::vector<GrowthConfig> growth(config.profiles.size());
+  for (size_t i = 0; i < growth.size(); ++i)
+    growth[i] = config.profiles[i].growth;
+  smoother_.SetGrowth(growth);
+  UpdateKernelSetBuffers();
+  MakePlans();
+  ResetActivity();
+}
+
+void Simulation::UpdateKernelSetBuffers() {
+  pp::Size all_size(size_.width(), size_.height() * kernel_set_.count());
+  if (kernel_set_convolutions_.size() == all_size)
+    return;
+  AlignedComplexes(all_size, ReduceSizeForComplex())
+      .swap(kernel_set_products_);
+  AlignedReals(all_size).swap(kernel_set_convolutions_);
 }
 
 void Simulation::SetSmoother(const SmootherConfig& config) {
-  smoother_.SetConfig(config);
+  // Invalid adaptive limits, e.g. from a corrupt checkpoint or replay log,
+  // are rejected in favor of the current ones.
+  SmootherConfig checked = config;
+  if (!checked.timestep.adaptive_limits_valid()) {
+    const TimestepConfig& current = smoother_.config().timestep;
+    checked.timestep.dt_min = current.dt_min;
+    checked.timestep.dt_max = current.dt_max;
+    checked.timestep.tolerance = current.tolerance;
+  }
+  smoother_.SetConfig(checked);
+  ResetActivity();
+  adaptive_dt_ = std::max(checked.timestep.dt_min,
+                          std::min(checked.timestep.dt_max,
+                                   checked.timestep.dt));
+  UpdateScratch();
+}
+
+void Simulation::UpdateScratch() {
+  Integrator integrator = smoother_.GetIntegrator();
+  pp::Size stage_size = integrator != INTEGRATOR_EULER ? size_ : pp::Size();
+  pp::Size sum_size = integrator == INTEGRATOR_RK4 ||
+                      integrator == INTEGRATOR_ADAPTIVE ? size_ : pp::Size();
+  if (rk_stage_.size() != stage_size) {
+    AlignedReals(stage_size).swap(rk_stage_);
+    AlignedReals(stage_size).swap(rk_rate_);
+  }
+  if (rk_sum_.size() != sum_size)
+    AlignedReals(sum_size).swap(rk_sum_);
+}
+
+void Simulation::SetCompact(bool compact) {
+  if (compact == compact_)
+    return;
+
+  if (compact) {
+    AlignedUint16s(size_).swap(packed_);
+    std::transform(aa_.begin(), aa_.end(), packed_.begin(), PackFixed16);
+    AlignedReals(pp::Size()).swap(aa_);
+  } else {
+    AlignedReals(size_).swap(aa_);
+    UnpackState(packed_, &aa_);
+    AlignedUint16s(pp::Size()).swap(packed_);
+  }
+  compact_ = compact;
+  display_valid_ = false;
+  MakePlans();
+  ResetActivity();
+}
+
+void Simulation::SetActivityDetection(bool enabled) {
+  detect_activity_ = enabled;
+  ResetActivity();
+}
+
+void Simulation::SetStatsEnabled(bool enabled) {
+  collect_stats_ = enabled;
+}
+
+void Simulation::Seed(uint64_t seed) {
+  rng_.Seed(seed);
+}
+
+void Simulation::SetNoise(real amount) {
+  noise_ = std::max(static_cast<real>(0), amount);
+  ResetActivity();
+}
+
+void Simulation::SetFusedDisplay(bool enabled) {
+  fused_display_ = enabled;
+}
+
+const AlignedUint16s& Simulation::display_buffer() {
+  if (compact_)
+    return packed_;
+
+  if (!display_valid_) {
+    UpdateDisplaySize();
+    std::transform(aa_.begin(), aa_.end(), display_.begin(), PackFixed16);
+    display_valid_ = true;
+  }
+  return display_;
+}
+
+void Simulation::UpdateDisplaySize() {
+  if (display_.size() != size_)
+    AlignedUint16s(size_).swap(display_);
 }
 
 void Simulation::Step() {
-  TIME(fftw_execute(aa_plan_));
+  display_valid_ = false;
+  if (cycle_replaying_ && ++cycle_replay_steps_ < kCycleCheckSteps) {
+    ReplayCycle();
+    return;
+  }
+
+  step_stats_ = StepStats();
+  if (compact_)
+    StepState(&packed_);
+  else
+    StepState(&aa_);
+
+  if (cycle_replaying_)
+    CheckCycle();
+  else if (detect_activity_ && noise_ == 0)
+    UpdateActivity();
+}
+
+template <typename T>
+void Simulation::StepState(FftAllocation<T>* state) {
+  real dt = smoother_.config().timestep.dt;
+  // Each step draws one key; the noise of each cell is derived from it.
+  StepNoise noise(noise_, noise_ > 0 ? rng_.Next() : 0);
+  const StepNoise* step_noise = noise_ > 0 ? &noise : NULL;
+  Integrator integrator = kernel_set_plan_ ? INTEGRATOR_EULER
+                                           : smoother_.GetIntegrator();
+  switch (integrator) {
+    default:
+    case INTEGRATOR_EULER:
+      ConvolveState();
+      ApplySmoother(state, step_noise);
+      step_noise = NULL;
+      break;
+    case INTEGRATOR_MIDPOINT:
+    case INTEGRATOR_RK4:
+      Integrate(state);
+      break;
+    case INTEGRATOR_ADAPTIVE:
+      dt = IntegrateAdaptive(state);
+      break;
+  }
+  // The other integrators combine several rates at the end, so the noise is
+  // a separate pass; StepStats don't include it.
+  if (step_noise)
+    TIME(AddNoise(*step_noise, state));
+
+  integrator_stats_.dt = dt;
+  integrator_stats_.time += dt;
+  integrator_stats_.steps++;
+}
+
+void Simulation::ApplySmoother(AlignedReals* state, const StepNoise* noise) {
+  AlignedUint16s* display = NULL;
+  if (fused_display_) {
+    UpdateDisplaySize();
+    display = &display_;
+  }
+  StepStats* stats = WantStats() ? &step_stats_ : NULL;
+  if (kernel_set_plan_) {
+    TIME(smoother_.ApplyGrowth(kernel_set_convolutions_, state, stats,
+                               display, noise));
+  } else {
+    TIME(smoother_.Apply(an_, am_, state, stats, display, noise));
+  }
+  display_valid_ = display != NULL;
+}
+
+void Simulation::ApplySmoother(AlignedUint16s* state,
+                               const StepNoise* noise) {
+  StepStats* stats = WantStats() ? &step_stats_ : NULL;
+  if (kernel_set_plan_)
+    TIME(smoother_.ApplyGrowth(kernel_set_convolutions_, state, stats, noise));
+  else
+    TIME(smoother_.Apply(an_, am_, state, stats, noise));
+}
+
+struct Simulation::MultiplyKernelSetTask {
+  void Run(int task) {
+    int count = simulation->aaf_.count();
+    simulation->MultiplyKernelSetRange(
+        count * static_cast<int64_t>(task) / task_count,
+        count * static_cast<int64_t>(task + 1) / task_count);
+  }
+
+  Simulation* simulation;
+  int task_count;
+};
+
+// Each value of aaf_ is read once and multiplied by every kernel's, rather
+// than read again by a MultiplyComplex() pass per kernel.
+void Simulation::MultiplyKernelSetRange(int begin, int end) {
+  int count = aaf_.count();
+  int kernel_count = kernel_set_.count();
+  const fftw_complex* in = aaf_.data();
+  const fftw_complex* spectra = kernel_set_.spectra().data();
+  fftw_complex* out = kernel_set_products_.data();
+  for (int i = begin; i < end; ++i) {
+    real re = in[i][0];
+    real im = in[i][1];
+    for (int k = 0; k < kernel_count; ++k) {
+      const fftw_complex& kernel = spectra[k * count + i];
+      fftw_complex& product = out[k * count + i];
+      product[0] = re * kernel[0] - im * kernel[1];
+      product[1] = re * kernel[1] + im * kernel[0];
+    }
+  }
+}
+
+// Convolves |in| with both kernels, writing the results to an_ and am_, or
+// with every kernel of the kernel set, writing the results to
+// kernel_set_convolutions_. |in| may be am_ itself.
+void Simulation::Convolve(real* in) {
+  TIME(fftw_execute_dft_r2c(aa_plan_, in, aaf_.data()));
+  if (kernel_set_plan_) {
+    MultiplyKernelSetTask task;
+    task.simulation = this;
+    task.task_count = std::max(1, thread_pool_.thread_count());
+    TIME(thread_pool_.Run(&task, task.task_count));
+    TIME(fftw_execute(kernel_set_plan_));
+    return;
+  }
   TIME(MultiplyComplex(aaf_, kernel_.krf(), &tempf_));
   TIME(fftw_execute(an_plan_));
   TIME(MultiplyComplex(aaf_, kernel_.kdf(), &tempf_));
   TIME(fftw_execute(am_plan_));
-  TIME(smoother_.Apply(an_, am_, &aa_));
 }
 
-void Simulation::Clear(real color) {
-  std::fill(aa_.begin(), aa_.end(), color);
+void Simulation::ConvolveState() {
+  if (compact_) {
+    TIME(UnpackState(packed_, &am_));
+    Convolve(am_.data());
+  } else {
+    Convolve(aa_.data());
+  }
 }
 
-void Simulation::DrawFilledCircle(real x, real y, real radius, real color) {
-  int width = aa_.size().width();
-  int height = aa_.size().height();
-  int ix = static_cast<int>(x) % width;
-  int iy = static_cast<int>(y) % height;
-
-  const int kOverlapLeft = 1;
-  const int kOverlapRight = 2;
-  const int kOverlapTop = 1;
-  const int kOverlapBottom = 2;
-  int overlap_x = 0;
-  int overlap_y = 0;
-  if (ix - radius < 0) overlap_x |= kOverlapLeft;
-  if (ix + radius + 1 > width) overlap_x |= kOverlapRight;
-  if (iy - radius < 0) overlap_y |= kOverlapTop;
-  if (iy + radius + 1 > height) overlap_y |= kOverlapBottom;
-
-  for (int ox = 0; ox < 3; ++ox) {
-    int nx = ix;
-    if (ox & kOverlapLeft) nx += width;
-    if (ox & kOverlapRight) nx -= width;
-
-    for (int oy = 0; oy < 3; ++oy) {
-      int ny = iy;
-      if (oy & kOverlapTop) ny += height;
-      if (oy & kOverlapBottom) ny -= height;
-
-      if ((!ox || (overlap_x & ox)) && (!oy || (overlap_y & oy)))
-        DrawFilledCircleNoWrap(nx, ny, radius, color);
-    }
+// Each stage costs a full convolution (three FFTs), but the step can be many
+// times larger than an Euler step for the same accuracy.
+template <typename T>
+void Simulation::Integrate(FftAllocation<T>* state) {
+  real dt = smoother_.config().timestep.dt;
+
+  ConvolveState();
+  TIME(smoother_.Rate(an_, am_, *state, &rk_rate_));
+
+  if (smoother_.GetIntegrator() == INTEGRATOR_MIDPOINT) {
+    NullStepStats null_stats;
+    TIME(AddScaled(*state, dt / 2, rk_rate_, &rk_stage_, &null_stats));
+    Convolve(rk_stage_.data());
+    TIME(smoother_.Rate(an_, am_, rk_stage_, &rk_rate_));
+    TIME(AddScaled(*state, dt, rk_rate_, state, &step_stats_));
+    return;
   }
+
+  std::fill(rk_sum_.begin(), rk_sum_.end(), 0);
+  TIME(RungeKuttaStage(*state, dt / 2, 1, rk_rate_, &rk_stage_, &rk_sum_));
+  Convolve(rk_stage_.data());
+  TIME(smoother_.Rate(an_, am_, rk_stage_, &rk_rate_));
+  TIME(RungeKuttaStage(*state, dt / 2, 2, rk_rate_, &rk_stage_, &rk_sum_));
+  Convolve(rk_stage_.data());
+  TIME(smoother_.Rate(an_, am_, rk_stage_, &rk_rate_));
+  TIME(RungeKuttaStage(*state, dt, 2, rk_rate_, &rk_stage_, &rk_sum_));
+  Convolve(rk_stage_.data());
+  TIME(smoother_.Rate(an_, am_, rk_stage_, &rk_rate_));
+  TIME(RungeKuttaFinish(dt / 6, rk_sum_, rk_rate_, state, &step_stats_));
 }
 
-void Simulation::DrawFilledCircleNoWrap(real x, real y, real radius,
-                                        real color) {
-  int width = aa_.size().width();
-  int height = aa_.size().height();
-  int left = std::max(0, static_cast<int>(x - radius));
-  int right = std::min(width, static_cast<int>(x + radius + 1));
-  int top = std::max(0, static_cast<int>(y - radius));
-  int bottom = std::min(height, static_cast<int>(y + radius + 1));
+// Returns the step size that was used. The difference between Heun's method
+// and the Euler step it starts with estimates the local error of the Euler
+// step, so the controller is conservative for the second-order result.
+template <typename T>
+real Simulation::IntegrateAdaptive(FftAllocation<T>* state) {
+  const real kSafety = 0.9;
+  const real kMinFactor = 0.2;
+  const real kMaxFactor = 2;
+  const TimestepConfig& timestep = smoother_.config().timestep;
+
+  // The rate at the start of the step doesn't depend on dt, so it is reused
+  // when a step is rejected.
+  ConvolveState();
+  TIME(smoother_.Rate(an_, am_, *state, &rk_sum_));
+
+  for (int rejected = 0;; ++rejected) {
+    real dt = adaptive_dt_;
+    NullStepStats null_stats;
+    TIME(AddScaled(*state, dt, rk_sum_, &rk_stage_, &null_stats));
+    Convolve(rk_stage_.data());
+    TIME(smoother_.Rate(an_, am_, rk_stage_, &rk_rate_));
 
-  for (int j = top; j < bottom; ++j) {
-    for (int i = left; i < right; ++i) {
-      real dx = x - i;
-      real dy = y - j;
-      real length = dx * dx + dy * dy;
-      if (length < radius * radius)
-        aa_[j * width + i] = color;
+    // A non-finite error (e.g. from a NaN rate) can't be controlled; fall
+    // back to the smallest step.
+    real error = dt / 2 * MaxAbsDifference(rk_sum_, rk_rate_);
+    bool finite = error <= std::numeric_limits<real>::max();
+    real factor = kMaxFactor;
+    if (finite && error > 0)
+      factor = kSafety * sqrt(timestep.tolerance / error);
+    factor = std::max(kMinFactor, std::min(kMaxFactor, factor));
+    adaptive_dt_ = std::max(timestep.dt_min,
+                            std::min(timestep.dt_max, dt * factor));
+    if (!finite || rejected == kMaxRejectedSteps)
+      adaptive_dt_ = timestep.dt_min;
+
+    if ((finite && error <= timestep.tolerance) || dt <= timestep.dt_min) {
+      TIME(RungeKuttaFinish(dt / 2, rk_sum_, rk_rate_, state, &step_stats_));
+      return dt;
     }
+
+    integrator_stats_.rejected_steps++;
   }
 }
 
-void Simulation::Splat() {
-  real mx, my;
-  int width = aa_.size().width();
-  int height = aa_.size().height();
+void Simulation::UpdateActivity() {
+  Activity activity = activity_.Update(step_stats_);
+  int period = activity_.period();
+
+  if (cycle_period_ == 0) {
+    if (activity != ACTIVITY_PERIODIC || period > kMaxCachedPeriod)
+      return;
+
+    // Start recording with the current state; once a whole period has been
+    // recorded, the next step is the first recorded state again.
+    cycle_period_ = period;
+    cycle_frames_ = 0;
+    AlignedUint16s(pp::Size(size_.width(), size_.height() * period))
+        .swap(cycle_);
+    cycle_stats_.resize(period);
+  } else if (activity != ACTIVITY_PERIODIC || period != cycle_period_) {
+    ResetActivity();
+    return;
+  }
+
+  uint16_t* frame = cycle_.data() + cycle_frames_ * size_.GetArea();
+  if (compact_) {
+    memcpy(frame, packed_.data(), packed_.byte_size());
+  } else {
+    std::transform(aa_.begin(), aa_.end(), frame, PackFixed16);
+  }
+  cycle_stats_[cycle_frames_] = step_stats_;
+
+  if (++cycle_frames_ == cycle_period_) {
+    cycle_frames_ = 0;
+    cycle_replaying_ = true;
+  }
+}
 
-  real ring_radius = kernel_.config().ring_radius;
+void Simulation::ResetActivity() {
+  activity_.Reset();
+  if (cycle_period_ != 0)
+    AlignedUint16s(pp::Size()).swap(cycle_);
+  cycle_stats_.clear();
+  cycle_period_ = 0;
+  cycle_frames_ = 0;
+  cycle_replaying_ = false;
+  cycle_replay_steps_ = 0;
+}
+
+void Simulation::ReplayCycle() {
+  const uint16_t* frame = cycle_.data() + cycle_frames_ * size_.GetArea();
+  if (compact_) {
+    memcpy(packed_.data(), frame, packed_.byte_size());
+  } else {
+    std::transform(frame, frame + size_.GetArea(), aa_.begin(),
+                   UnpackFixed16);
+  }
+  step_stats_ = cycle_stats_[cycle_frames_];
 
-  mx = 2 * ring_radius; if (mx>width) mx=width;
-  my = 2 * ring_radius; if (my>height) my=height;
+  cycle_frames_ = (cycle_frames_ + 1) % cycle_period_;
+  integrator_stats_.time += integrator_stats_.dt;
+  integrator_stats_.steps++;
+}
 
-  for (int t=0; t<=(int)(width*height/(mx*my)); t++) {
-    real x = RND(width);
-    real y = RND(height);
-    real r = ring_radius * (RND(0.5) + 0.5);
-    DrawFilledCircle(x, y, r, 1.0);
+void Simulation::CheckCycle() {
+  // The real step stands in for the recorded state it should reproduce. If
+  // it doesn't, the hashes only matched by accident, or the state drifts too
+  // slowly to show in one period; either way, go back to real steps.
+  if (step_stats_.hash != cycle_stats_[cycle_frames_].hash) {
+    ResetActivity();
+    return;
   }
+  cycle_frames_ = (cycle_frames_ + 1) % cycle_period_;
+  cycle_replay_steps_ = 0;
+}
+
+void Simulation::Clear(real color) {
+  ResetActivity();
+  display_valid_ = false;
+  if (compact_)
+    std::fill(packed_.begin(), packed_.end(), PackFixed16(color));
+  else
+    std::fill(aa_.begin(), aa_.end(), color);
+}
+
+void Simulation::DrawFilledCircle(real x, real y, real radius, real color) {
+  Capsule capsule(x, y, radius, color);
+  DrawCapsules(&capsule, 1);
+}
+
+struct Simulation::DrawCapsulesTask {
+  void Run(int task) {
+    int height = simulation->size_.height();
+    int begin = height * task / task_count;
+    int end = height * (task + 1) / task_count;
+    for (int i = 0; i < count; ++i)
+      simulation->DrawCapsuleRows(capsules[i], begin, end);
+  }
+
+  Simulation* simulation;
+  const Capsule* capsules;
+  int count;
+  int task_count;
+};
+
+void Simulation::DrawCapsules(const Capsule* capsules, int count) {
+  if (count == 0)
+    return;
+  ResetActivity();
+
+  // Waking the threads costs more than drawing a few small dabs.
+  const real kMinThreadedArea = 16384;
+  real area = 0;
+  for (int i = 0; i < count; ++i) {
+    const Capsule& c = capsules[i];
+    real length = fabs(c.x1 - c.x0) + fabs(c.y1 - c.y0);
+    area += 2 * c.radius * (2 * c.radius + length);
+  }
+
+  DrawCapsulesTask task;
+  task.simulation = this;
+  task.capsules = capsules;
+  task.count = count;
+  task.task_count = 1;
+  if (area >= kMinThreadedArea) {
+    // Every band gets at least one row.
+    task.task_count = std::min(size_.height(),
+                               std::max(1, thread_pool_.thread_count()));
+  }
+  thread_pool_.Run(&task, task.task_count);
+}
+
+void Simulation::DrawCapsuleRows(const Capsule& capsule, int begin,
+                                 int end) {
+  int width = size_.width();
+  int height = size_.height();
+  if (compact_) {
+    FillCapsuleRows(packed_.data(), width, height, capsule,
+                    PackFixed16(capsule.color), begin, end);
+  } else {
+    FillCapsuleRows(aa_.data(), width, height, capsule, capsule.color,
+                    begin, end);
+    // Keep the display buffer valid while the user is drawing.
+    if (display_valid_) {
+      FillCapsuleRows(display_.data(), width, height, capsule,
+                      PackFixed16(capsule.color), begin, end);
+    }
+  }
+}
+
+struct Simulation::SplatTask {
+  void Run(int task) {
+    int height = simulation->size_.height();
+    simulation->SplatRows(seed, height * task / task_count,
+                          height * (task + 1) / task_count);
+  }
+
+  Simulation* simulation;
+  uint64_t seed;
+  int task_count;
+};
+
+void Simulation::Splat() {
+  ResetActivity();
+  SplatTask task;
+  task.simulation = this;
+  task.seed = rng_.Next();
+  // Every band gets at least one row.
+  task.task_count = std::min(size_.height(),
+                             std::max(1, thread_pool_.thread_count()));
+  thread_pool_.Run(&task, task.task_count);
+}
+
+// Each band regenerates the circles that can reach it, and draws its own
+// rows; see AddSplatCapsules().
+void Simulation::SplatRows(uint64_t seed, int begin, int end) {
+  std::vector<Capsule> capsules;
+  AddSplatCapsules(size_.width(), size_.height(),
+                   kernel_.config().ring_radius, seed, begin, end,
+                   &capsules);
+  for (size_t i = 0; i < capsules.size(); ++i)
+    DrawCapsuleRows(capsules[i], begin, end);
 }
@@ -16,14 +16,34 @@
 #define SIMULATION_H_
 
 #include <ppapi/cpp/size.h>
+#include <vector>
 
+#include "activity.h"
+#include "checkpoint.h"
 #include "kernel.h"
+#include "kernel_set.h"
+#include "rasterizer.h"
 #include "smoother.h"
+#include "step_stats.h"
+#include "thread_pool.h"
 
 #include "fftw.h"
 #include "fft_allocation.h"
+#include "rng.h"
 #include "simulation_config.h"
 
+struct IntegratorStats {
+  IntegratorStats() : dt(0), time(0), steps(0), rejected_steps(0) {}
+
+  // The step size of the last step.
+  real dt;
+  // Simulated time, i.e. the sum of all step sizes.
+  double time;
+  int steps;
+  // Steps thrown away by INTEGRATOR_ADAPTIVE because the error was too large.
+  int rejected_steps;
+};
+
 class Simulation {
  public:
   explicit Simulation(const SimulationConfig& config);
@@ -31,38 +51,183 @@ class Simulation {
 
   const pp::Size& size() const { return size_; }
   const Kernel& kernel() const { return kernel_; }
+  const KernelSet& kernel_set() const { return kernel_set_; }
   const Smoother& smoother() const { return smoother_; }
+  // The worker threads, which may be shared with other per-frame work.
+  ThreadPool* thread_pool() { return &thread_pool_; }
+  const IntegratorStats& integrator_stats() const {
+    return integrator_stats_;
+  }
+  // Only computed when stats or activity detection are enabled.
+  const StepStats& step_stats() const { return step_stats_; }
+  bool stats_enabled() const { return collect_stats_; }
+  bool activity_detection() const { return detect_activity_; }
+  Activity activity() const { return activity_.activity(); }
+  int period() const { return activity_.period(); }
+  // True when Step() replays a cached cycle instead of computing it.
+  bool replaying_cycle() const { return cycle_replaying_; }
   const AlignedReals& buffer() const { return aa_; }
+  // Only valid when compact() is true; buffer() is empty in that case.
+  const AlignedUint16s& packed_buffer() const { return packed_; }
+  bool compact() const { return compact_; }
+  // The state as 16-bit fixed point, for rendering. With fused display
+  // enabled, the Euler step writes this alongside the state; otherwise it is
+  // converted here when needed. In compact mode it is packed_buffer().
+  const AlignedUint16s& display_buffer();
+  bool fused_display() const { return fused_display_; }
+  real noise() const { return noise_; }
 
 #ifdef USE_THREADS
   void SetThreadCount(int thread_count);
 #endif
+  // The state is undefined after SetSize(); Resize() resamples it to the new
+  // size instead, through the Fourier domain. If |scale_kernel| is true, the
+  // kernel radii are scaled by the square root of the change in area (the
+  // geometric mean of the two axes' scales), so patterns keep evolving the
+  // same way. They are scaled from the radii given to SetKernel() and
+  // SetKernelSet() at the size they were given at, so repeated resizes don't
+  // accumulate rounding.
   void SetSize(const pp::Size& size);
+  void Resize(const pp::Size& size, bool scale_kernel);
   void SetKernel(const KernelConfig& config);
+  // While |config| has any kernels, they replace the disc and ring kernel:
+  // each step is one forward transform, a pass that multiplies its spectrum
+  // by every kernel's, one batched inverse transform of all the products,
+  // and Smoother::ApplyGrowth(). Such steps always use the Euler integrator
+  // with the smoother's dt. Kernel sets are not saved in checkpoints.
+  void SetKernelSet(const KernelSetConfig& config);
   void SetSmoother(const SmootherConfig& config);
+  void SetCompact(bool compact);
+  // Classifies the state after each step; see activity(). A periodic state
+  // with a short period is recorded for one period and then replayed instead
+  // of stepped, checking a real step every so often. The recording is 16-bit
+  // fixed point, so without SetCompact() replaying drops the state to that
+  // precision.
+  void SetActivityDetection(bool enabled);
+  void SetStatsEnabled(bool enabled);
+  void SetFusedDisplay(bool enabled);
+  // Restarts the random numbers used by Splat() and noise.
+  void Seed(uint64_t seed);
+  // Adds uniform noise in [-amount, amount] to every value after each step.
+  // With the Euler integrator it is added while the smoother writes the new
+  // state, so it costs no extra pass. Noise keeps the state from ever
+  // repeating, so activity detection is paused while it is on.
+  void SetNoise(real amount);
+
+  // Checkpoints hold the state, kernel and smoother configs, integrator
+  // stats and random number state; see checkpoint.h. SaveCheckpoint() writes
+  // CheckpointSize() bytes to |data|, which must be aligned to
+  // kCheckpointAlignment if the state is to be used in place.
+  // LoadCheckpoint() resizes the simulation to match, and returns false if
+  // |data| is not a valid checkpoint.
+  size_t CheckpointSize() const;
+  void SaveCheckpoint(void* data) const;
+  bool LoadCheckpoint(const void* data, size_t size);
 
   void Step();
   void Clear(real color);
   void DrawFilledCircle(real x, real y, real radius, real color);
+  // Draws the capsules in order, in one pass over the rows they touch. Each
+  // row of a capsule is a single span, split in two where it wraps around.
+  void DrawCapsules(const Capsule* capsules, int count);
+  // Draws circles about the size of the ring kernel over the whole world.
+  // The work is split between threads, and the result only depends on the
+  // seed.
   void Splat();
 
  private:
   void MakePlans();
   void DestroyPlans();
-  void DrawFilledCircleNoWrap(real x, real y, real radius, real color);
+  // SetSize(), with the kernel set's config replaced at the same time.
+  void SetSizeAndKernelSet(const pp::Size& size,
+                           const KernelSetConfig& kernel_set_config);
+  void UpdateScratch();
+  void Convolve(real* in);
+  void ConvolveState();
+  struct MultiplyKernelSetTask;
+  // Multiplies values [begin, end) of aaf_ by every kernel set spectrum.
+  void MultiplyKernelSetRange(int begin, int end);
+  void UpdateKernelSetBuffers();
+  template <typename T>
+  void StepState(FftAllocation<T>* state);
+  void ApplySmoother(AlignedReals* state, const StepNoise* noise);
+  void ApplySmoother(AlignedUint16s* state, const StepNoise* noise);
+  void UpdateDisplaySize();
+  template <typename T>
+  void Integrate(FftAllocation<T>* state);
+  template <typename T>
+  real IntegrateAdaptive(FftAllocation<T>* state);
+  struct DrawCapsulesTask;
+  // Only rows [begin, end) are drawn.
+  void DrawCapsuleRows(const Capsule& capsule, int begin, int end);
+  struct SplatTask;
+  void SplatRows(uint64_t seed, int begin, int end);
+  void UpdateActivity();
+  void ResetActivity();
+  void ReplayCycle();
+  void CheckCycle();
+  CheckpointStateFormat CheckpointFormat() const;
+  bool WantStats() const { return collect_stats_ || detect_activity_; }
 
   pp::Size size_;
+  // Declared before smoother_, which keeps a pointer to it.
+  ThreadPool thread_pool_;
   Kernel kernel_;
   Smoother smoother_;
+  KernelSet kernel_set_;
+  // The config last given to SetKernel() (or made current by a resize that
+  // didn't scale the kernel), and the size it applies to.
+  KernelConfig base_kernel_config_;
+  pp::Size base_kernel_size_;
+  // The same, for SetKernelSet().
+  KernelSetConfig base_kernel_set_config_;
+  pp::Size base_kernel_set_size_;
   int thread_count_;
+  bool compact_;
   AlignedReals aa_;
+  AlignedUint16s packed_;
   AlignedReals an_;
   AlignedReals am_;
   AlignedComplexes aaf_;
   AlignedComplexes tempf_;
+  // The products of aaf_ with each kernel set spectrum, and their inverse
+  // transforms, one after another; empty without a kernel set.
+  AlignedComplexes kernel_set_products_;
+  AlignedReals kernel_set_convolutions_;
+  bool fused_display_;
+  // Empty until display_buffer() or a fused step needs it. display_valid_ is
+  // true when it matches the state.
+  AlignedUint16s display_;
+  bool display_valid_;
+  // Scratch buffers for the higher-order integrators; empty when unused.
+  // INTEGRATOR_ADAPTIVE keeps the rate at the start of the step in rk_sum_.
+  AlignedReals rk_stage_;
+  AlignedReals rk_rate_;
+  AlignedReals rk_sum_;
+  real adaptive_dt_;
+  IntegratorStats integrator_stats_;
+  bool detect_activity_;
+  bool collect_stats_;
+  Rng rng_;
+  real noise_;
+  StepStats step_stats_;
+  ActivityDetector activity_;
+  // When the state is periodic, one period of states is recorded here, one
+  // after another, and then replayed.
+  AlignedUint16s cycle_;
+  // The StepStats of each recorded state, reported again when it is
+  // replayed; their hashes are what the replay is checked against.
+  std::vector<StepStats> cycle_stats_;
+  int cycle_period_;
+  int cycle_frames_;
+  bool cycle_replaying_;
+  // Steps replayed since the replay was last checked against a real step.
+  int cycle_replay_steps_;
   fftw_plan aa_plan_;
   fftw_plan an_plan_;
   fftw_plan am_plan_;
+  // NULL without a kernel set.
+  fftw_plan kernel_set_plan_;
 
   Simulation(const Simulation&);  // Undefined.
   Simulation& operator =(const Simulation&);  // Undefined.
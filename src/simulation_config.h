@@ -15,6 +15,7 @@
 #ifndef SIMULATION_CONFIG_H_
 #define SIMULATION_CONFIG_H_
 
+#include <stdint.h>
 #include <ppapi/cpp/size.h>
 #include "kernel_config.h"
 #include "smoother_config.h"
@@ -22,9 +23,21 @@
 struct SimulationConfig {
   explicit SimulationConfig(int thread_count, const pp::Size& size)
       : thread_count(thread_count),
-        size(size) {}
+        size(size),
+        compact_state(false),
+        detect_activity(false),
+        seed(0) {}
   int thread_count;
   pp::Size size;
+  // Store the world state between steps as 16-bit fixed point instead of
+  // real. See fixed16.h.
+  bool compact_state;
+  // Compute StepStats every step, and use them to detect dead, static and
+  // periodic states. See Simulation::activity().
+  bool detect_activity;
+  // Seeds the simulation's random numbers, for Splat() and noise. The same
+  // seed gives the same worlds, however many threads are used.
+  uint64_t seed;
   KernelConfig kernel_config;
   SmootherConfig smoother_config;
 };
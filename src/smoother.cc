@@ -13,11 +13,21 @@
 // limitations under the License.
 
 #include "smoother.h"
+
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
+#include "fixed16.h"
 #include "functions.h"
+#include "thread_pool.h"
 
 namespace {
 
 const int kLookupSize = 256;
+// Lenia's growth functions can be narrow, so they are sampled more finely
+// than the two-dimensional lookup; this is still 4KB per kernel in floats.
+const int kGrowthLookupSize = 1024;
 
 real my_hard(real x, real a, real) {
   return func_hard(x, a);
@@ -47,16 +57,47 @@ real sigmoid_mix(SigmoidFunc f, real sm, real x, real y, real m) {
   return x + (*f)(m, 0.5, sm) * (y - x);
 }
 
-real clamp01(real x) {
-  return x > 1.0 ? 1.0 : x < 0.0 ? 0.0 : x;
-}
-
 }  // namespace
 
-Smoother::Smoother(const pp::Size& size, const SmootherConfig& config)
+template <typename T>
+struct Smoother::ApplyTask {
+  void Run(int task) {
+    int height = smoother->size_.height();
+    int width = smoother->size_.width();
+    int begin = height * task / task_count * width;
+    int end = height * (task + 1) / task_count * width;
+    smoother->ApplyRange(an, am, na, begin, end, stats ? &stats[task] : NULL,
+                         display, noise);
+  }
+
+  const Smoother* smoother;
+  const real* an;
+  const real* am;
+  T* na;
+  StepStats* stats;
+  uint16_t* display;
+  const StepNoise* noise;
+  int task_count;
+};
+
+Smoother::Smoother(const pp::Size& size, const SmootherConfig& config,
+                   ThreadPool* thread_pool)
     : size_(size),
       config_(config),
-      lookup_(pp::Size(kLookupSize, kLookupSize)) {
+      thread_pool_(thread_pool),
+      lookup_(pp::Size(kLookupSize, kLookupSize)),
+      growth_count_(0),
+      growth_lookup_(pp::Size()) {
+}
+
+Integrator Smoother::GetIntegrator() const {
+  switch (config_.timestep.type) {
+    case TIMESTEP_SMOOTH1:
+    case TIMESTEP_SMOOTH2:
+      return config_.timestep.integrator;
+    default:
+      return INTEGRATOR_EULER;
+  }
 }
 
 void Smoother::SetSize(const pp::Size& size) {
@@ -68,28 +109,173 @@ void Smoother::SetConfig(const SmootherConfig& config) {
   MakeLookup();
 }
 
+void Smoother::SetGrowth(const std::vector<GrowthConfig>& growth) {
+  growth_count_ = static_cast<int>(growth.size());
+  AlignedReals(pp::Size(kGrowthLookupSize + 1, growth_count_))
+      .swap(growth_lookup_);
+  for (int k = 0; k < growth_count_; ++k) {
+    const GrowthConfig& g = growth[k];
+    real* lookup = growth_lookup_.data() + k * (kGrowthLookupSize + 1);
+    for (int i = 0; i <= kGrowthLookupSize; ++i) {
+      real u = static_cast<real>(i) / kGrowthLookupSize;
+      real x = g.sigma > 0 ? (u - g.mu) / g.sigma : HUGE_VAL;
+      lookup[i] = g.weight * (2 * exp(-x * x / 2) - 1);
+    }
+  }
+}
+
 void Smoother::Apply(const AlignedReals& buf1, const AlignedReals& buf2,
-                     AlignedReals* out) const {
+                     AlignedReals* out, StepStats* stats,
+                     AlignedUint16s* display, const StepNoise* noise) const {
+  ApplyT(buf1.data(), buf2.data(), out, stats,
+         display ? display->data() : NULL, noise);
+}
+
+void Smoother::Apply(const AlignedReals& buf1, const AlignedReals& buf2,
+                     AlignedUint16s* out, StepStats* stats,
+                     const StepNoise* noise) const {
+  ApplyT(buf1.data(), buf2.data(), out, stats, NULL, noise);
+}
+
+void Smoother::ApplyGrowth(const AlignedReals& inputs, AlignedReals* out,
+                           StepStats* stats, AlignedUint16s* display,
+                           const StepNoise* noise) const {
+  ApplyT(inputs.data(), NULL, out, stats, display ? display->data() : NULL,
+         noise);
+}
+
+void Smoother::ApplyGrowth(const AlignedReals& inputs, AlignedUint16s* out,
+                           StepStats* stats, const StepNoise* noise) const {
+  ApplyT(inputs.data(), NULL, out, stats, NULL, noise);
+}
+
+void Smoother::ApplyCells(const real* an, const real* am, real* na,
+                          int begin, int end, StepStats* stats) const {
+  ApplyRange(an, am, na, begin, end, stats, NULL, NULL);
+}
+
+template <typename T>
+void Smoother::ApplyT(const real* an, const real* am, FftAllocation<T>* out,
+                      StepStats* stats, uint16_t* display,
+                      const StepNoise* noise) const {
+  int task_count = std::max(1, thread_pool_->thread_count());
+  if (stats) {
+    if (task_stats_.size() != static_cast<size_t>(task_count))
+      task_stats_.resize(task_count);
+    std::fill(task_stats_.begin(), task_stats_.end(), StepStats());
+  }
+
+  ApplyTask<T> task;
+  task.smoother = this;
+  task.an = an;
+  task.am = am;
+  task.na = out->data();
+  task.stats = stats ? &task_stats_[0] : NULL;
+  task.display = display;
+  task.noise = noise;
+  task.task_count = task_count;
+  thread_pool_->Run(&task, task_count);
+
+  if (stats) {
+    *stats = StepStats();
+    for (int i = 0; i < task_count; ++i)
+      stats->Merge(task_stats_[i]);
+  }
+}
+
+template <typename T>
+void Smoother::ApplyRange(const real* an, const real* am, T* na, int begin,
+                          int end, StepStats* stats, uint16_t* display,
+                          const StepNoise* noise) const {
+  if (noise) {
+    ApplyRangeN(an, am, na, begin, end, stats, display, noise);
+  } else {
+    NullStepNoise null_noise;
+    ApplyRangeN(an, am, na, begin, end, stats, display, &null_noise);
+  }
+}
+
+template <typename T, typename N>
+void Smoother::ApplyRangeN(const real* an, const real* am, T* na, int begin,
+                           int end, StepStats* stats, uint16_t* display,
+                           const N* noise) const {
+  NullStepStats null_stats;
+  if (display) {
+    if (stats) {
+      DisplayStepStats<StepStats> display_stats(display, stats);
+      ApplyS(an, am, na, begin, end, &display_stats, noise);
+    } else {
+      DisplayStepStats<NullStepStats> display_stats(display, &null_stats);
+      ApplyS(an, am, na, begin, end, &display_stats, noise);
+    }
+  } else {
+    if (stats)
+      ApplyS(an, am, na, begin, end, stats, noise);
+    else
+      ApplyS(an, am, na, begin, end, &null_stats, noise);
+  }
+}
+
+template <typename T, typename S, typename N>
+void Smoother::ApplyS(const real* an, const real* am, T* na, int begin,
+                      int end, S* stats, const N* noise) const {
+  if (!am) {
+    Apply_Growth(an, na, begin, end, stats, noise);
+    return;
+  }
   switch (config_.timestep.type) {
     default:
     case TIMESTEP_DISCRETE:
-      Apply_Discrete(buf1.data(), buf2.data(), out->data());
+      Apply_Discrete(an, am, na, begin, end, stats, noise);
       break;
     case TIMESTEP_SMOOTH1:
-      Apply_Smooth1(buf1.data(), buf2.data(), out->data());
+      Apply_Smooth1(an, am, na, begin, end, stats, noise);
       break;
     case TIMESTEP_SMOOTH2:
-      Apply_Smooth2(buf1.data(), buf2.data(), out->data());
+      Apply_Smooth2(an, am, na, begin, end, stats, noise);
       break;
     case TIMESTEP_SMOOTH3:
-      Apply_Smooth3(buf1.data(), buf2.data(), out->data());
+      Apply_Smooth3(an, am, na, begin, end, stats, noise);
       break;
     case TIMESTEP_SMOOTH4:
-      Apply_Smooth4(buf1.data(), buf2.data(), out->data());
+      Apply_Smooth4(an, am, na, begin, end, stats, noise);
       break;
   }
 }
 
+void Smoother::Rate(const AlignedReals& buf1, const AlignedReals& buf2,
+                    const AlignedReals& state, AlignedReals* rate) const {
+  RateT(buf1, buf2, state, rate);
+}
+
+void Smoother::Rate(const AlignedReals& buf1, const AlignedReals& buf2,
+                    const AlignedUint16s& state, AlignedReals* rate) const {
+  RateT(buf1, buf2, state, rate);
+}
+
+template <typename T>
+void Smoother::RateT(const AlignedReals& buf1, const AlignedReals& buf2,
+                     const FftAllocation<T>& state,
+                     AlignedReals* rate) const {
+  const real* an = buf1.data();
+  const real* am = buf2.data();
+  const T* a = state.data();
+  real* k = rate->data();
+  int count = size_.width() * size_.height();
+  real scale = 1.0 / count;
+  if (config_.timestep.type == TIMESTEP_SMOOTH1) {
+    for (int i = 0; i < count; ++i) {
+      real f = Lookup(an[i] * scale, am[i] * scale);
+      k[i] = 2 * f - 1;
+    }
+  } else {
+    for (int i = 0; i < count; ++i) {
+      real f = Lookup(an[i] * scale, am[i] * scale);
+      k[i] = f - LoadState(a[i]);
+    }
+  }
+}
+
 void Smoother::MakeLookup() {
   for (int i = 0; i < kLookupSize; ++i) {
     for (int j = 0; j < kLookupSize; ++j) {
@@ -140,56 +326,114 @@ real Smoother::Lookup(real n, real m) const {
                  static_cast<int>(m * kLookupSize)];
 }
 
-void Smoother::Apply_Discrete(const real* an, const real* am, real* na) const {
-  int count = size_.width() * size_.height();
-  real scale = 1.0 / count;
-  for (int i = 0; i < count; ++i) {
+// Interpolated, since a growth function's peak may only span a few entries.
+real Smoother::GrowthLookup(int kernel, real u) const {
+  // Rounding in the transforms can leave u slightly outside [0, 1].
+  real x = std::max(static_cast<real>(0),
+                    std::min(static_cast<real>(kGrowthLookupSize),
+                             u * kGrowthLookupSize));
+  int i = std::min(kGrowthLookupSize - 1, static_cast<int>(x));
+  const real* lookup = growth_lookup_.data() + kernel * (kGrowthLookupSize + 1);
+  return lookup[i] + (x - i) * (lookup[i + 1] - lookup[i]);
+}
+
+template <typename T, typename S, typename N>
+void Smoother::Apply_Discrete(const real* an, const real* am, T* na,
+                              int begin, int end, S* stats,
+                              const N* noise) const {
+  real scale = 1.0 / (size_.width() * size_.height());
+  for (int i = begin; i < end; ++i) {
     real ani = an[i] * scale;
     real ami = am[i] * scale;
-    na[i] = Lookup(ani, ami);
+    real a = LoadState(na[i]);
+    real value = Lookup(ani, ami);
+    value = noise->Add(i, value);
+    na[i] = StoreState(value, na);
+    stats->Add(i, a, value);
   }
 }
 
-void Smoother::Apply_Smooth1(const real* an, const real* am, real* na) const {
-  int count = size_.width() * size_.height();
-  real scale = 1.0 / count;
-  for (int i = 0; i < count; ++i) {
+template <typename T, typename S, typename N>
+void Smoother::Apply_Smooth1(const real* an, const real* am, T* na,
+                             int begin, int end, S* stats,
+                             const N* noise) const {
+  real scale = 1.0 / (size_.width() * size_.height());
+  for (int i = begin; i < end; ++i) {
     real ani = an[i] * scale;
     real ami = am[i] * scale;
     real f = Lookup(ani, ami);
-    na[i] = clamp01(na[i] + config_.timestep.dt * (2 * f - 1));
+    real a = LoadState(na[i]);
+    real value = clamp01(a + config_.timestep.dt * (2 * f - 1));
+    value = noise->Add(i, value);
+    na[i] = StoreState(value, na);
+    stats->Add(i, a, value);
   }
 }
 
-void Smoother::Apply_Smooth2(const real* an, const real* am, real* na) const {
-  int count = size_.width() * size_.height();
-  real scale = 1.0 / count;
-  for (int i = 0; i < count; ++i) {
+template <typename T, typename S, typename N>
+void Smoother::Apply_Smooth2(const real* an, const real* am, T* na,
+                             int begin, int end, S* stats,
+                             const N* noise) const {
+  real scale = 1.0 / (size_.width() * size_.height());
+  for (int i = begin; i < end; ++i) {
     real ani = an[i] * scale;
     real ami = am[i] * scale;
     real f = Lookup(ani, ami);
-    na[i] = clamp01(na[i] + config_.timestep.dt * (f - na[i]));
+    real a = LoadState(na[i]);
+    real value = clamp01(a + config_.timestep.dt * (f - a));
+    value = noise->Add(i, value);
+    na[i] = StoreState(value, na);
+    stats->Add(i, a, value);
   }
 }
 
-void Smoother::Apply_Smooth3(const real* an, const real* am, real* na) const {
-  int count = size_.width() * size_.height();
-  real scale = 1.0 / count;
-  for (int i = 0; i < count; ++i) {
+template <typename T, typename S, typename N>
+void Smoother::Apply_Smooth3(const real* an, const real* am, T* na,
+                             int begin, int end, S* stats,
+                             const N* noise) const {
+  real scale = 1.0 / (size_.width() * size_.height());
+  for (int i = begin; i < end; ++i) {
     real ani = an[i] * scale;
     real ami = am[i] * scale;
     real f = Lookup(ani, ami);
-    na[i] = clamp01(ami + config_.timestep.dt * (2 * f - 1));
+    real a = LoadState(na[i]);
+    real value = clamp01(ami + config_.timestep.dt * (2 * f - 1));
+    value = noise->Add(i, value);
+    na[i] = StoreState(value, na);
+    stats->Add(i, a, value);
   }
 }
 
-void Smoother::Apply_Smooth4(const real* an, const real* am, real* na) const {
-  int count = size_.width() * size_.height();
-  real scale = 1.0 / count;
-  for (int i = 0; i < count; ++i) {
+template <typename T, typename S, typename N>
+void Smoother::Apply_Smooth4(const real* an, const real* am, T* na,
+                             int begin, int end, S* stats,
+                             const N* noise) const {
+  real scale = 1.0 / (size_.width() * size_.height());
+  for (int i = begin; i < end; ++i) {
     real ani = an[i] * scale;
     real ami = am[i] * scale;
     real f = Lookup(ani, ami);
-    na[i] = clamp01(ami + config_.timestep.dt * (f - ami));
+    real a = LoadState(na[i]);
+    real value = clamp01(ami + config_.timestep.dt * (f - ami));
+    value = noise->Add(i, value);
+    na[i] = StoreState(value, na);
+    stats->Add(i, a, value);
+  }
+}
+
+template <typename T, typename S, typename N>
+void Smoother::Apply_Growth(const real* inputs, T* na, int begin, int end,
+                            S* stats, const N* noise) const {
+  int area = size_.width() * size_.height();
+  real scale = 1.0 / area;
+  for (int i = begin; i < end; ++i) {
+    real rate = 0;
+    for (int k = 0; k < growth_count_; ++k)
+      rate += GrowthLookup(k, inputs[k * area + i] * scale);
+    real a = LoadState(na[i]);
+    real value = clamp01(a + config_.timestep.dt * rate);
+    value = noise->Add(i, value);
+    na[i] = StoreState(value, na);
+    stats->Add(i, a, value);
   }
 }
@@ -15,35 +15,137 @@
 #ifndef SMOOTHER_H_
 #define SMOOTHER_H_
 
+#include <vector>
+
 #include "fft_allocation.h"
+#include "rng.h"
 #include "smoother_config.h"
+#include "step_stats.h"
+
+class ThreadPool;
 
 class Smoother {
  public:
-  Smoother(const pp::Size& size, const SmootherConfig& config);
+  // Apply() splits its work across |thread_pool|, which must outlive the
+  // smoother.
+  Smoother(const pp::Size& size, const SmootherConfig& config,
+           ThreadPool* thread_pool);
 
   const pp::Size& size() const { return size_; }
   const SmootherConfig& config() const { return config_; }
 
+  // Returns the integrator used for the current timestep type.
+  Integrator GetIntegrator() const;
+
   void SetSize(const pp::Size& size);
   void SetConfig(const SmootherConfig& config);
+  // Sets the growth function of each kernel of a KernelSet, for
+  // ApplyGrowth().
+  void SetGrowth(const std::vector<GrowthConfig>& growth);
+  // If |stats| is not NULL, it is set to metrics of the new state. They are
+  // accumulated per thread and merged at the end. If |display| is not NULL,
+  // the new state is also written to it as 16-bit fixed point, ready to be
+  // mapped to colors, while each value is still in a register. If |noise|
+  // is not NULL, it is added to each new value before it is stored.
   void Apply(const AlignedReals& buf1,
              const AlignedReals& buf2,
-             AlignedReals* out) const;
+             AlignedReals* out,
+             StepStats* stats,
+             AlignedUint16s* display,
+             const StepNoise* noise) const;
+  // Same as above, but the state in |out| is 16-bit fixed point.
+  void Apply(const AlignedReals& buf1,
+             const AlignedReals& buf2,
+             AlignedUint16s* out,
+             StepStats* stats,
+             const StepNoise* noise) const;
+  // Like Apply(), but for a KernelSet: |inputs| holds the convolution of the
+  // state with each of its kernels, one after another, and each cell takes
+  // an Euler step of config().timestep.dt with da/dt the sum of their growth
+  // functions. The timestep type is ignored.
+  void ApplyGrowth(const AlignedReals& inputs,
+                   AlignedReals* out,
+                   StepStats* stats,
+                   AlignedUint16s* display,
+                   const StepNoise* noise) const;
+  void ApplyGrowth(const AlignedReals& inputs,
+                   AlignedUint16s* out,
+                   StepStats* stats,
+                   const StepNoise* noise) const;
+  // Updates cells [begin, end) of |na| on the calling thread, for callers
+  // that split the work between threads themselves. The buffers hold one
+  // world of size(); |stats| may be NULL. If |am| is NULL, |an| holds the
+  // inputs of ApplyGrowth() instead.
+  void ApplyCells(const real* an, const real* am, real* na, int begin,
+                  int end, StepStats* stats) const;
+  // Writes da/dt into |rate|, for the state that was convolved to produce
+  // |buf1| and |buf2|. Only meaningful for the SMOOTH1 and SMOOTH2 timesteps.
+  void Rate(const AlignedReals& buf1,
+            const AlignedReals& buf2,
+            const AlignedReals& state,
+            AlignedReals* rate) const;
+  void Rate(const AlignedReals& buf1,
+            const AlignedReals& buf2,
+            const AlignedUint16s& state,
+            AlignedReals* rate) const;
 
  private:
   void MakeLookup();
+  real GrowthLookup(int kernel, real u) const;
   real CalculateValue(real n, real m) const;
   real Lookup(real n, real m) const;
-  void Apply_Discrete(const real* an, const real* am, real* na) const;
-  void Apply_Smooth1(const real* an, const real* am, real* na) const;
-  void Apply_Smooth2(const real* an, const real* am, real* na) const;
-  void Apply_Smooth3(const real* an, const real* am, real* na) const;
-  void Apply_Smooth4(const real* an, const real* am, real* na) const;
+  template <typename T>
+  struct ApplyTask;
+
+  // |am| is NULL for ApplyGrowth(), and |an| holds every kernel's input.
+  template <typename T>
+  void ApplyT(const real* an, const real* am, FftAllocation<T>* out,
+              StepStats* stats, uint16_t* display,
+              const StepNoise* noise) const;
+  template <typename T>
+  void ApplyRange(const real* an, const real* am, T* na, int begin, int end,
+                  StepStats* stats, uint16_t* display,
+                  const StepNoise* noise) const;
+  template <typename T, typename N>
+  void ApplyRangeN(const real* an, const real* am, T* na, int begin, int end,
+                   StepStats* stats, uint16_t* display, const N* noise) const;
+  template <typename T, typename S, typename N>
+  void ApplyS(const real* an, const real* am, T* na, int begin, int end,
+              S* stats, const N* noise) const;
+  template <typename T>
+  void RateT(const AlignedReals& buf1, const AlignedReals& buf2,
+             const FftAllocation<T>& state, AlignedReals* rate) const;
+  // Each of these updates the values of |na| in [begin, end).
+  template <typename T, typename S, typename N>
+  void Apply_Discrete(const real* an, const real* am, T* na, int begin,
+                      int end, S* stats, const N* noise) const;
+  template <typename T, typename S, typename N>
+  void Apply_Smooth1(const real* an, const real* am, T* na, int begin,
+                     int end, S* stats, const N* noise) const;
+  template <typename T, typename S, typename N>
+  void Apply_Smooth2(const real* an, const real* am, T* na, int begin,
+                     int end, S* stats, const N* noise) const;
+  template <typename T, typename S, typename N>
+  void Apply_Smooth3(const real* an, const real* am, T* na, int begin,
+                     int end, S* stats, const N* noise) const;
+  template <typename T, typename S, typename N>
+  void Apply_Smooth4(const real* an, const real* am, T* na, int begin,
+                     int end, S* stats, const N* noise) const;
+  template <typename T, typename S, typename N>
+  void Apply_Growth(const real* inputs, T* na, int begin, int end, S* stats,
+                    const N* noise) const;
 
   pp::Size size_;
   SmootherConfig config_;
+  ThreadPool* thread_pool_;
   AlignedReals lookup_;
+  // The growth function of each kernel set kernel, times its weight, at
+  // kGrowthLookupSize + 1 evenly spaced inputs from 0 to 1.
+  int growth_count_;
+  AlignedReals growth_lookup_;
+  // Each task's stats for ApplyT(), resized only when the thread pool's
+  // thread count changes.
+  mutable std::vector<StepStats> task_stats_;
 
   Smoother(const Smoother&);
   Smoother& operator =(const Smoother&);
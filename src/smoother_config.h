@@ -23,9 +23,39 @@ enum Timestep {
   TIMESTEP_SMOOTH4
 };
 
+// How the SMOOTH1 and SMOOTH2 timesteps, which define da/dt in terms of the
+// current state, are integrated. The other timesteps always use a single
+// update per step.
+enum Integrator {
+  INTEGRATOR_EULER,
+  // Explicit midpoint method; convolves the state twice per step.
+  INTEGRATOR_MIDPOINT,
+  // Classic fourth-order Runge-Kutta; convolves the state four times per step.
+  INTEGRATOR_RK4,
+  // Heun's method with an embedded Euler step for error estimation. dt is
+  // only the initial step size; it then varies within [dt_min, dt_max] to
+  // keep the estimated error below |tolerance|. Convolves the state at least
+  // twice per step, plus once per rejected step.
+  INTEGRATOR_ADAPTIVE
+};
+
 struct TimestepConfig {
+  TimestepConfig()
+      : type(TIMESTEP_DISCRETE), dt(0), integrator(INTEGRATOR_EULER),
+        dt_min(0.001), dt_max(1), tolerance(0.01) {}
+
+  // True if 0 < dt_min <= dt_max and tolerance > 0 (so not NaN either).
+  bool adaptive_limits_valid() const {
+    return dt_min > 0 && dt_min <= dt_max && tolerance > 0;
+  }
+
   Timestep type;
   real dt;
+  Integrator integrator;
+  // Only used by INTEGRATOR_ADAPTIVE.
+  real dt_min;
+  real dt_max;
+  real tolerance;
 };
 
 enum Sigmoid {
@@ -65,4 +95,16 @@ struct SmootherConfig {
   real sm;
 };
 
+// The growth function of one kernel of a KernelSet, as in Lenia: the
+// convolution u with the kernel adds
+//   weight * (2 * exp(-(u - mu)^2 / (2 * sigma^2)) - 1)
+// to da/dt.
+struct GrowthConfig {
+  GrowthConfig() : mu(0.15), sigma(0.015), weight(1) {}
+
+  real mu;
+  real sigma;
+  real weight;
+};
+
 #endif  // SMOOTHER_CONFIG_H_
@@ -0,0 +1,106 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef STEP_STATS_H_
+#define STEP_STATS_H_
+
+#include <stdint.h>
+#include <algorithm>
+
+#include "fixed16.h"
+
+// Metrics of the new state, accumulated by the smoother while it writes each
+// value, so they don't cost an extra pass over the state. When the state is
+// split between threads, each thread fills its own StepStats and they are
+// merged afterward.
+struct StepStats {
+  static const int kHistogramBins = 16;
+
+  StepStats()
+      : hash(0), mass(0), change(0), min_value(1), max_value(0), count(0) {
+    for (int i = 0; i < kHistogramBins; ++i)
+      histogram[i] = 0;
+  }
+
+  void Add(int index, real old_value, real new_value) {
+    // Hash the top 12 bits of each value, so states that differ only by
+    // rounding noise still hash equally. Summing per-cell hashes makes the
+    // result independent of the order the cells are visited in.
+    uint32_t h = (index * 0x9e3779b1u) ^ (PackFixed16(new_value) >> 4);
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    hash += h;
+    mass += new_value;
+    change += new_value > old_value ? new_value - old_value
+                                    : old_value - new_value;
+    if (new_value < min_value)
+      min_value = new_value;
+    if (new_value > max_value)
+      max_value = new_value;
+    int bin = static_cast<int>(new_value * kHistogramBins);
+    histogram[std::max(0, std::min(kHistogramBins - 1, bin))]++;
+    count++;
+  }
+
+  void Merge(const StepStats& other) {
+    hash += other.hash;
+    mass += other.mass;
+    change += other.change;
+    if (other.min_value < min_value)
+      min_value = other.min_value;
+    if (other.max_value > max_value)
+      max_value = other.max_value;
+    for (int i = 0; i < kHistogramBins; ++i)
+      histogram[i] += other.histogram[i];
+    count += other.count;
+  }
+
+  // Order-independent hash of the quantized state.
+  uint32_t hash;
+  // Sum of the new state.
+  double mass;
+  // Sum of |new - old|.
+  double change;
+  real min_value;
+  real max_value;
+  // Number of values in [i / kHistogramBins, (i + 1) / kHistogramBins).
+  int histogram[kHistogramBins];
+  int count;
+};
+
+// Used when no stats are wanted; the calls compile away.
+struct NullStepStats {
+  void Add(int, real, real) {}
+};
+
+// Also stores each new value as 16-bit fixed point in |display|, so it can be
+// rendered without reading the state again, and passes it on to |stats|.
+template <typename S>
+struct DisplayStepStats {
+  DisplayStepStats(uint16_t* display, S* stats)
+      : display(display), stats(stats) {}
+
+  void Add(int index, real old_value, real new_value) {
+    display[index] = PackFixed16(new_value);
+    stats->Add(index, old_value, new_value);
+  }
+
+  uint16_t* display;
+  S* stats;
+};
+
+#endif  // STEP_STATS_H_
@@ -0,0 +1,140 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thread_pool.h"
+
+#include <stdio.h>
+
+#ifdef USE_THREADS
+
+ThreadPool::ThreadPool(int thread_count)
+    : func_(NULL),
+      user_data_(NULL),
+      task_count_(0),
+      next_task_(0),
+      tasks_done_(0),
+      quit_(false),
+      thread_count_(thread_count) {
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&work_cond_, NULL);
+  pthread_cond_init(&done_cond_, NULL);
+  StartThreads();
+}
+
+ThreadPool::~ThreadPool() {
+  StopThreads();
+  pthread_cond_destroy(&done_cond_);
+  pthread_cond_destroy(&work_cond_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+void ThreadPool::SetThreadCount(int thread_count) {
+  StopThreads();
+  thread_count_ = thread_count;
+  StartThreads();
+}
+
+void ThreadPool::Run(TaskFunc func, void* user_data, int task_count) {
+  if (threads_.empty() || task_count <= 1) {
+    for (int i = 0; i < task_count; ++i)
+      func(user_data, i);
+    return;
+  }
+
+  pthread_mutex_lock(&mutex_);
+  func_ = func;
+  user_data_ = user_data;
+  task_count_ = task_count;
+  next_task_ = 0;
+  tasks_done_ = 0;
+  pthread_cond_broadcast(&work_cond_);
+  RunTasksLocked();
+  while (tasks_done_ < task_count_)
+    pthread_cond_wait(&done_cond_, &mutex_);
+  // Let the workers go back to sleep.
+  task_count_ = 0;
+  next_task_ = 0;
+  pthread_mutex_unlock(&mutex_);
+}
+
+// static
+void* ThreadPool::WorkerMain(void* arg) {
+  ThreadPool* pool = static_cast<ThreadPool*>(arg);
+  pthread_mutex_lock(&pool->mutex_);
+  for (;;) {
+    while (!pool->quit_ && pool->next_task_ >= pool->task_count_)
+      pthread_cond_wait(&pool->work_cond_, &pool->mutex_);
+    if (pool->quit_)
+      break;
+    pool->RunTasksLocked();
+  }
+  pthread_mutex_unlock(&pool->mutex_);
+  return NULL;
+}
+
+void ThreadPool::StartThreads() {
+  quit_ = false;
+  for (int i = 1; i < thread_count_; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, &WorkerMain, this) != 0) {
+      printf("Unable to create worker thread.\n");
+      break;
+    }
+    threads_.push_back(thread);
+  }
+}
+
+void ThreadPool::StopThreads() {
+  pthread_mutex_lock(&mutex_);
+  quit_ = true;
+  pthread_cond_broadcast(&work_cond_);
+  pthread_mutex_unlock(&mutex_);
+  for (size_t i = 0; i < threads_.size(); ++i)
+    pthread_join(threads_[i], NULL);
+  threads_.clear();
+}
+
+// Called with mutex_ held. The lock is released while each task runs.
+void ThreadPool::RunTasksLocked() {
+  while (next_task_ < task_count_) {
+    int task = next_task_++;
+    TaskFunc func = func_;
+    void* user_data = user_data_;
+    pthread_mutex_unlock(&mutex_);
+    func(user_data, task);
+    pthread_mutex_lock(&mutex_);
+    if (++tasks_done_ == task_count_)
+      pthread_cond_signal(&done_cond_);
+  }
+}
+
+#else  // !USE_THREADS
+
+ThreadPool::ThreadPool(int thread_count)
+    : thread_count_(thread_count) {
+}
+
+ThreadPool::~ThreadPool() {
+}
+
+void ThreadPool::SetThreadCount(int thread_count) {
+  thread_count_ = thread_count;
+}
+
+void ThreadPool::Run(TaskFunc func, void* user_data, int task_count) {
+  for (int i = 0; i < task_count; ++i)
+    func(user_data, i);
+}
+
+#endif  // USE_THREADS
@@ -0,0 +1,76 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#ifdef USE_THREADS
+#include <pthread.h>
+#include <vector>
+#endif
+
+// Runs a function over a range of task indices on a fixed set of worker
+// threads. The calling thread runs tasks too, so a pool with a thread count
+// of N starts N - 1 threads. Without USE_THREADS, all tasks run on the
+// calling thread.
+class ThreadPool {
+ public:
+  typedef void (*TaskFunc)(void* user_data, int task);
+
+  explicit ThreadPool(int thread_count);
+  ~ThreadPool();
+
+  int thread_count() const { return thread_count_; }
+  void SetThreadCount(int thread_count);
+
+  // Calls |func| for every task in [0, task_count), and waits until they have
+  // all finished.
+  void Run(TaskFunc func, void* user_data, int task_count);
+
+  // Same as above, but calls |task->Run(i)|.
+  template <typename T>
+  void Run(T* task, int task_count) {
+    Run(&RunTask<T>, task, task_count);
+  }
+
+ private:
+  template <typename T>
+  static void RunTask(void* user_data, int task) {
+    static_cast<T*>(user_data)->Run(task);
+  }
+
+#ifdef USE_THREADS
+  static void* WorkerMain(void* arg);
+  void StartThreads();
+  void StopThreads();
+  void RunTasksLocked();
+
+  std::vector<pthread_t> threads_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t work_cond_;
+  pthread_cond_t done_cond_;
+  TaskFunc func_;
+  void* user_data_;
+  int task_count_;
+  int next_task_;
+  int tasks_done_;
+  bool quit_;
+#endif
+  int thread_count_;
+
+  ThreadPool(const ThreadPool&);  // Undefined.
+  ThreadPool& operator =(const ThreadPool&);  // Undefined.
+};
+
+#endif  // THREAD_POOL_H_
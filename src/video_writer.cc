@@ -0,0 +1,209 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "video_writer.h"
+
+#include <string.h>
+#include <sys/time.h>
+
+namespace {
+
+double NowMs() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+// Pixels are R, G, B, A in memory, so R is the low byte.
+inline int Red(uint32_t pixel) { return pixel & 0xff; }
+inline int Green(uint32_t pixel) { return (pixel >> 8) & 0xff; }
+inline int Blue(uint32_t pixel) { return (pixel >> 16) & 0xff; }
+
+// BT.601 limited range, in 8.8 fixed point. The loops are simple enough for
+// the compiler to vectorize.
+void ConvertLuma(const uint32_t* pixels, int count, uint8_t* y) {
+  for (int i = 0; i < count; ++i) {
+    uint32_t p = pixels[i];
+    y[i] = static_cast<uint8_t>(
+        ((66 * Red(p) + 129 * Green(p) + 25 * Blue(p) + 128) >> 8) + 16);
+  }
+}
+
+// Each chroma sample covers 2x2 pixels from |row0| and |row1|. The sums of
+// four pixels make the results 10.10 fixed point; the offset keeps them
+// positive before the shift.
+void ConvertChroma(const uint32_t* row0, const uint32_t* row1, int count,
+                   uint8_t* u, uint8_t* v) {
+  const int kOffset = (128 << 10) + 512;
+  for (int i = 0; i < count; ++i) {
+    uint32_t p00 = row0[2 * i];
+    uint32_t p01 = row0[2 * i + 1];
+    uint32_t p10 = row1[2 * i];
+    uint32_t p11 = row1[2 * i + 1];
+    int r = Red(p00) + Red(p01) + Red(p10) + Red(p11);
+    int g = Green(p00) + Green(p01) + Green(p10) + Green(p11);
+    int b = Blue(p00) + Blue(p01) + Blue(p10) + Blue(p11);
+    u[i] = static_cast<uint8_t>((-38 * r - 74 * g + 112 * b + kOffset) >> 10);
+    v[i] = static_cast<uint8_t>((112 * r - 94 * g - 18 * b + kOffset) >> 10);
+  }
+}
+
+void ConvertToI420(const uint32_t* pixels, const pp::Size& size,
+                   uint8_t* out) {
+  int width = size.width();
+  int height = size.height();
+  uint8_t* y = out;
+  uint8_t* u = y + width * height;
+  uint8_t* v = u + (width / 2) * (height / 2);
+  ConvertLuma(pixels, width * height, y);
+  for (int row = 0; row < height / 2; ++row) {
+    const uint32_t* row0 = pixels + 2 * row * width;
+    ConvertChroma(row0, row0 + width, width / 2, u + row * (width / 2),
+                  v + row * (width / 2));
+  }
+}
+
+}  // namespace
+
+VideoWriter::VideoWriter(FILE* file, VideoFormat format,
+                         const pp::Size& size, int fps)
+    : file_(file),
+      format_(format),
+      size_(size),
+      frame_count_(0),
+      wait_ms_(0),
+      ok_(true),
+      finished_(false),
+      head_(0),
+      queued_(0) {
+  for (int i = 0; i < kBufferCount; ++i)
+    buffers_[i].resize(size.GetArea());
+
+  if (format_ == VIDEO_FORMAT_Y4M) {
+    output_.resize(size.GetArea() + 2 * (size.width() / 2) *
+                                        (size.height() / 2));
+    ok_ = fprintf(file_, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n",
+                  size.width(), size.height(), fps) > 0;
+  }
+
+#ifdef USE_THREADS
+  finishing_ = false;
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&frame_cond_, NULL);
+  pthread_cond_init(&space_cond_, NULL);
+  pthread_create(&thread_, NULL, &VideoWriter::WorkerMain, this);
+#endif
+}
+
+VideoWriter::~VideoWriter() {
+  Finish();
+#ifdef USE_THREADS
+  pthread_cond_destroy(&space_cond_);
+  pthread_cond_destroy(&frame_cond_);
+  pthread_mutex_destroy(&mutex_);
+#endif
+}
+
+uint32_t* VideoWriter::BeginFrame() {
+#ifdef USE_THREADS
+  // The buffer after the queued frames is not touched by the worker until
+  // it is queued.
+  pthread_mutex_lock(&mutex_);
+  if (queued_ == kBufferCount) {
+    double start_ms = NowMs();
+    while (queued_ == kBufferCount)
+      pthread_cond_wait(&space_cond_, &mutex_);
+    wait_ms_ += NowMs() - start_ms;
+  }
+  std::vector<uint32_t>& buffer = buffers_[(head_ + queued_) % kBufferCount];
+  pthread_mutex_unlock(&mutex_);
+  return &buffer[0];
+#else
+  return &buffers_[0][0];
+#endif
+}
+
+void VideoWriter::EndFrame() {
+  if (finished_)
+    return;
+
+  frame_count_++;
+#ifdef USE_THREADS
+  pthread_mutex_lock(&mutex_);
+  queued_++;
+  pthread_cond_signal(&frame_cond_);
+  pthread_mutex_unlock(&mutex_);
+#else
+  WriteFrame(buffers_[0]);
+#endif
+}
+
+void VideoWriter::Finish() {
+  if (finished_)
+    return;
+  finished_ = true;
+
+#ifdef USE_THREADS
+  pthread_mutex_lock(&mutex_);
+  finishing_ = true;
+  pthread_cond_signal(&frame_cond_);
+  pthread_mutex_unlock(&mutex_);
+  pthread_join(thread_, NULL);
+#endif
+  if (fflush(file_) != 0)
+    ok_ = false;
+}
+
+void VideoWriter::WriteFrame(const std::vector<uint32_t>& pixels) {
+  if (!ok_)
+    return;
+
+  if (format_ == VIDEO_FORMAT_Y4M) {
+    ConvertToI420(&pixels[0], size_, &output_[0]);
+    ok_ = fputs("FRAME\n", file_) >= 0 &&
+          fwrite(&output_[0], 1, output_.size(), file_) == output_.size();
+  } else {
+    size_t size = pixels.size() * sizeof(uint32_t);
+    ok_ = fwrite(&pixels[0], 1, size, file_) == size;
+  }
+}
+
+#ifdef USE_THREADS
+
+// static
+void* VideoWriter::WorkerMain(void* arg) {
+  static_cast<VideoWriter*>(arg)->RunWorker();
+  return NULL;
+}
+
+void VideoWriter::RunWorker() {
+  pthread_mutex_lock(&mutex_);
+  for (;;) {
+    while (queued_ == 0 && !finishing_)
+      pthread_cond_wait(&frame_cond_, &mutex_);
+    if (queued_ == 0)
+      break;
+
+    const std::vector<uint32_t>& buffer = buffers_[head_];
+    pthread_mutex_unlock(&mutex_);
+    WriteFrame(buffer);
+    pthread_mutex_lock(&mutex_);
+    head_ = (head_ + 1) % kBufferCount;
+    queued_--;
+    pthread_cond_signal(&space_cond_);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+#endif  // USE_THREADS
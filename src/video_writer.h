@@ -0,0 +1,96 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef VIDEO_WRITER_H_
+#define VIDEO_WRITER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <ppapi/cpp/size.h>
+
+#ifdef USE_THREADS
+#include <pthread.h>
+#endif
+
+enum VideoFormat {
+  // A YUV4MPEG2 stream of 4:2:0 frames, BT.601 limited range, which ffmpeg
+  // and most players read. The width and height must be even.
+  VIDEO_FORMAT_Y4M,
+  // R, G, B, A bytes for every pixel, with no header.
+  VIDEO_FORMAT_RGBA
+};
+
+// Writes rendered frames to a file or pipe. Frames are double-buffered: one
+// is converted and written on a background thread while the next is
+// rendered, so disk I/O overlaps the simulation. Without USE_THREADS, each
+// frame is written in EndFrame().
+class VideoWriter {
+ public:
+  static const int kBufferCount = 2;
+
+  // |file| must stay open until Finish().
+  VideoWriter(FILE* file, VideoFormat format, const pp::Size& size, int fps);
+  ~VideoWriter();
+
+  const pp::Size& size() const { return size_; }
+  int frame_count() const { return frame_count_; }
+  // Time BeginFrame() has spent waiting for a free buffer.
+  double wait_ms() const { return wait_ms_; }
+  // False once a write has failed, e.g. because a pipe was closed.
+  bool ok() const { return ok_; }
+
+  // Returns the pixels to render the next frame into; the colors must be in
+  // COLOR_FORMAT_RGBA. Each BeginFrame() must be followed by EndFrame().
+  uint32_t* BeginFrame();
+  void EndFrame();
+  // Waits for the queued frames to be written. Called by the destructor if
+  // needed.
+  void Finish();
+
+ private:
+  void WriteFrame(const std::vector<uint32_t>& pixels);
+#ifdef USE_THREADS
+  static void* WorkerMain(void* arg);
+  void RunWorker();
+#endif
+
+  FILE* file_;
+  VideoFormat format_;
+  pp::Size size_;
+  int frame_count_;
+  double wait_ms_;
+  bool ok_;
+  bool finished_;
+
+  // Frames waiting to be written are buffers_[head_], ... in order.
+  std::vector<uint32_t> buffers_[kBufferCount];
+  int head_;
+  int queued_;
+  // Only used by the thread that writes frames.
+  std::vector<uint8_t> output_;
+
+#ifdef USE_THREADS
+  pthread_t thread_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t frame_cond_;
+  pthread_cond_t space_cond_;
+  bool finishing_;
+#endif
+
+  VideoWriter(const VideoWriter&);  // Undefined.
+  VideoWriter& operator =(const VideoWriter&);  // Undefined.
+};
+
+#endif  // VIDEO_WRITER_H_
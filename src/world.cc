@@ -0,0 +1,330 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "world.h"
+
+#include <string.h>
+#include <vector>
+
+#include "simulation.h"
+
+namespace {
+
+// Copies the payload, which may not be aligned for T. Returns false if it is
+// the wrong size.
+template <typename T>
+bool ReadPayload(const void* payload, size_t size, T* value) {
+  if (size != sizeof(T))
+    return false;
+  memcpy(value, payload, sizeof(T));
+  return true;
+}
+
+}  // namespace
+
+World::World(Simulation* simulation)
+    : simulation_(simulation),
+      log_(NULL),
+      frame_steps_(0) {}
+
+World::~World() {
+  delete log_;
+}
+
+void World::StartReplayLog() {
+  StopReplayLog();
+
+  std::vector<uint8_t> checkpoint(simulation_->CheckpointSize());
+  simulation_->SaveCheckpoint(&checkpoint[0]);
+  simulation_->LoadCheckpoint(&checkpoint[0], checkpoint.size());
+
+  log_ = new ReplayLogWriter;
+  log_->AddEvent(REPLAY_EVENT_CHECKPOINT, &checkpoint[0], checkpoint.size());
+  SetOption(REPLAY_OPTION_FUSED_DISPLAY, simulation_->fused_display());
+  SetOption(REPLAY_OPTION_ACTIVITY_DETECTION,
+            simulation_->activity_detection());
+  if (simulation_->noise() > 0) {
+    ReplayNoise event = {simulation_->noise()};
+    log_->AddEvent(REPLAY_EVENT_SET_NOISE, event);
+  }
+  // Checkpoints don't hold kernel sets.
+  if (simulation_->kernel_set().count() > 0) {
+    std::vector<uint8_t> event;
+    MakeReplayKernelSet(simulation_->kernel_set().config(), &event);
+    log_->AddEvent(REPLAY_EVENT_SET_KERNEL_SET, &event[0], event.size());
+  }
+  frame_steps_ = 0;
+}
+
+void World::StopReplayLog() {
+  delete log_;
+  log_ = NULL;
+}
+
+void World::Clear(real color) {
+  if (log_) {
+    ReplayClear event = {color};
+    log_->AddEvent(REPLAY_EVENT_CLEAR, event);
+  }
+  simulation_->Clear(color);
+}
+
+void World::SetSize(const pp::Size& size) {
+  if (log_) {
+    ReplaySize event = {size.width(), size.height(), 0, 0};
+    log_->AddEvent(REPLAY_EVENT_SET_SIZE, event);
+  }
+  simulation_->SetSize(size);
+}
+
+void World::Resize(const pp::Size& size, bool scale_kernel) {
+  if (log_) {
+    ReplaySize event = {size.width(), size.height(), 1, scale_kernel};
+    log_->AddEvent(REPLAY_EVENT_SET_SIZE, event);
+  }
+  simulation_->Resize(size, scale_kernel);
+}
+
+void World::SetKernel(const KernelConfig& config) {
+  if (log_)
+    log_->AddEvent(REPLAY_EVENT_SET_KERNEL, MakeReplayKernel(config));
+  simulation_->SetKernel(config);
+}
+
+void World::SetKernelSet(const KernelSetConfig& config) {
+  if (log_) {
+    std::vector<uint8_t> event;
+    MakeReplayKernelSet(config, &event);
+    log_->AddEvent(REPLAY_EVENT_SET_KERNEL_SET,
+                   event.empty() ? NULL : &event[0], event.size());
+  }
+  simulation_->SetKernelSet(config);
+}
+
+void World::SetSmoother(const SmootherConfig& config) {
+  if (log_)
+    log_->AddEvent(REPLAY_EVENT_SET_SMOOTHER, MakeReplaySmoother(config));
+  simulation_->SetSmoother(config);
+}
+
+void World::SetCompact(bool compact) {
+  SetOption(REPLAY_OPTION_COMPACT, compact);
+  simulation_->SetCompact(compact);
+}
+
+void World::SetFusedDisplay(bool enabled) {
+  SetOption(REPLAY_OPTION_FUSED_DISPLAY, enabled);
+  simulation_->SetFusedDisplay(enabled);
+}
+
+void World::SetActivityDetection(bool enabled) {
+  SetOption(REPLAY_OPTION_ACTIVITY_DETECTION, enabled);
+  simulation_->SetActivityDetection(enabled);
+}
+
+void World::Seed(uint64_t seed) {
+  if (log_) {
+    ReplaySeed event = {seed};
+    log_->AddEvent(REPLAY_EVENT_SEED, event);
+  }
+  simulation_->Seed(seed);
+}
+
+void World::SetNoise(real amount) {
+  if (log_) {
+    ReplayNoise event = {amount};
+    log_->AddEvent(REPLAY_EVENT_SET_NOISE, event);
+  }
+  simulation_->SetNoise(amount);
+}
+
+// The random state is part of the checkpoint that starts the log, so a
+// replay splats the same circles.
+void World::Splat() {
+  if (log_)
+    log_->AddEvent(REPLAY_EVENT_SPLAT, NULL, 0);
+  simulation_->Splat();
+}
+
+bool World::LoadCheckpoint(const void* data, size_t size) {
+  if (!simulation_->LoadCheckpoint(data, size))
+    return false;
+  // Only the part that was read is logged.
+  if (log_)
+    log_->AddEvent(REPLAY_EVENT_CHECKPOINT, data,
+                   simulation_->CheckpointSize());
+  return true;
+}
+
+void World::DrawFilledCircle(real x, real y, real radius, real color) {
+  if (log_) {
+    ReplayCircle event = {x, y, radius, color};
+    log_->AddEvent(REPLAY_EVENT_CIRCLE, event);
+  }
+  simulation_->DrawFilledCircle(x, y, radius, color);
+}
+
+void World::DrawCapsules(const Capsule* capsules, int count) {
+  if (log_ && count > 0) {
+    std::vector<ReplayCapsule> events(count);
+    for (int i = 0; i < count; ++i) {
+      const Capsule& c = capsules[i];
+      ReplayCapsule event = {c.x0, c.y0, c.x1, c.y1, c.radius, c.color};
+      events[i] = event;
+    }
+    log_->AddEvent(REPLAY_EVENT_CAPSULES, &events[0],
+                   count * sizeof(ReplayCapsule));
+  }
+  simulation_->DrawCapsules(capsules, count);
+}
+
+void World::Step() {
+  if (log_)
+    log_->AddEvent(REPLAY_EVENT_STEP, NULL, 0);
+  simulation_->Step();
+  frame_steps_++;
+}
+
+void World::EndFrame(double elapsed_ms) {
+  if (log_) {
+    ReplayFrame event;
+    event.steps = frame_steps_;
+    event.hash = simulation_->step_stats().hash;
+    event.elapsed_ms = elapsed_ms;
+    log_->AddEvent(REPLAY_EVENT_FRAME, event);
+  }
+  frame_steps_ = 0;
+}
+
+bool World::Apply(ReplayEventType type, const void* payload, size_t size) {
+  switch (type) {
+    case REPLAY_EVENT_CHECKPOINT:
+      return LoadCheckpoint(payload, size);
+    case REPLAY_EVENT_CLEAR: {
+      ReplayClear event;
+      if (!ReadPayload(payload, size, &event))
+        return false;
+      Clear(event.color);
+      return true;
+    }
+    case REPLAY_EVENT_SET_SIZE: {
+      ReplaySize event;
+      if (!ReadPayload(payload, size, &event) || event.width <= 0 ||
+          event.height <= 0)
+        return false;
+      pp::Size new_size(event.width, event.height);
+      if (event.resample)
+        Resize(new_size, event.scale_kernel != 0);
+      else
+        SetSize(new_size);
+      return true;
+    }
+    case REPLAY_EVENT_SET_KERNEL: {
+      ReplayKernel event;
+      if (!ReadPayload(payload, size, &event))
+        return false;
+      SetKernel(GetReplayKernel(event));
+      return true;
+    }
+    case REPLAY_EVENT_SET_KERNEL_SET: {
+      KernelSetConfig config;
+      if (!GetReplayKernelSet(payload, size, &config))
+        return false;
+      SetKernelSet(config);
+      return true;
+    }
+    case REPLAY_EVENT_SET_SMOOTHER: {
+      ReplaySmoother event;
+      if (!ReadPayload(payload, size, &event))
+        return false;
+      SetSmoother(GetReplaySmoother(event));
+      return true;
+    }
+    case REPLAY_EVENT_SET_OPTION: {
+      ReplayOption event;
+      if (!ReadPayload(payload, size, &event))
+        return false;
+      switch (event.option) {
+        case REPLAY_OPTION_COMPACT:
+          SetCompact(event.value != 0);
+          return true;
+        case REPLAY_OPTION_FUSED_DISPLAY:
+          SetFusedDisplay(event.value != 0);
+          return true;
+        case REPLAY_OPTION_ACTIVITY_DETECTION:
+          SetActivityDetection(event.value != 0);
+          return true;
+      }
+      return false;
+    }
+    case REPLAY_EVENT_SPLAT:
+      Splat();
+      return true;
+    case REPLAY_EVENT_CIRCLE: {
+      ReplayCircle event;
+      if (!ReadPayload(payload, size, &event))
+        return false;
+      DrawFilledCircle(event.x, event.y, event.radius, event.color);
+      return true;
+    }
+    case REPLAY_EVENT_STEP:
+      Step();
+      return true;
+    case REPLAY_EVENT_FRAME: {
+      ReplayFrame event;
+      if (!ReadPayload(payload, size, &event))
+        return false;
+      EndFrame(event.elapsed_ms);
+      return true;
+    }
+    case REPLAY_EVENT_SEED: {
+      ReplaySeed event;
+      if (!ReadPayload(payload, size, &event))
+        return false;
+      Seed(event.seed);
+      return true;
+    }
+    case REPLAY_EVENT_SET_NOISE: {
+      ReplayNoise event;
+      if (!ReadPayload(payload, size, &event))
+        return false;
+      SetNoise(event.amount);
+      return true;
+    }
+    case REPLAY_EVENT_CAPSULES: {
+      if (size % sizeof(ReplayCapsule) != 0)
+        return false;
+      int count = static_cast<int>(size / sizeof(ReplayCapsule));
+      std::vector<Capsule> capsules(count);
+      for (int i = 0; i < count; ++i) {
+        ReplayCapsule event;
+        memcpy(&event, static_cast<const uint8_t*>(payload) +
+                   i * sizeof(event), sizeof(event));
+        capsules[i] = Capsule(event.x0, event.y0, event.x1, event.y1,
+                              event.radius, event.color);
+      }
+      DrawCapsules(count ? &capsules[0] : NULL, count);
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+void World::SetOption(ReplayOptionType option, bool value) {
+  if (!log_)
+    return;
+  ReplayOption event = {option, value};
+  log_->AddEvent(REPLAY_EVENT_SET_OPTION, event);
+}
@@ -0,0 +1,87 @@
+// Copyright 2013 Ben Smith. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef WORLD_H_
+#define WORLD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ppapi/cpp/size.h>
+
+#include "kernel_config.h"
+#include "kernel_set_config.h"
+#include "rasterizer.h"
+#include "replay_log.h"
+#include "smoother_config.h"
+
+class Simulation;
+
+// Every change the app makes to the simulation goes through here, so that it
+// can be written to a replay log (see replay_log.h), and so that replaying
+// a log runs exactly the same code. Nothing here depends on ppapi beyond
+// pp::Size, so logs can be replayed by the headless driver.
+class World {
+ public:
+  // |simulation| must outlive the world.
+  explicit World(Simulation* simulation);
+  ~World();
+
+  Simulation* simulation() { return simulation_; }
+  bool logging() const { return log_ != NULL; }
+  // Only valid while logging.
+  const std::vector<uint8_t>& replay_log() const { return log_->data(); }
+
+  // Starts a new log with a checkpoint of the simulation. The simulation is
+  // reloaded from that checkpoint, so it starts from exactly the state a
+  // replay does.
+  void StartReplayLog();
+  void StopReplayLog();
+
+  void Clear(real color);
+  void SetSize(const pp::Size& size);
+  void Resize(const pp::Size& size, bool scale_kernel);
+  void SetKernel(const KernelConfig& config);
+  void SetKernelSet(const KernelSetConfig& config);
+  void SetSmoother(const SmootherConfig& config);
+  void SetCompact(bool compact);
+  void SetFusedDisplay(bool enabled);
+  void SetActivityDetection(bool enabled);
+  void Seed(uint64_t seed);
+  void SetNoise(real amount);
+  void Splat();
+  bool LoadCheckpoint(const void* data, size_t size);
+  void DrawFilledCircle(real x, real y, real radius, real color);
+  void DrawCapsules(const Capsule* capsules, int count);
+  void Step();
+  // Marks the end of a displayed frame whose updates took |elapsed_ms|.
+  void EndFrame(double elapsed_ms);
+
+  // Applies an event read from a replay log. Returns false if the payload
+  // is malformed. Frames are only counted; checking their hashes is up to
+  // the caller.
+  bool Apply(ReplayEventType type, const void* payload, size_t size);
+
+ private:
+  void SetOption(ReplayOptionType option, bool value);
+
+  Simulation* simulation_;
+  ReplayLogWriter* log_;
+  // Steps since the last EndFrame().
+  uint32_t frame_steps_;
+
+  World(const World&);  // Undefined.
+  World& operator =(const World&);  // Undefined.
+};
+
+#endif  // WORLD_H_